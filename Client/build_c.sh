@@ -11,7 +11,7 @@ rm libcloudflare_ddns.h
 
 # 编译公网地址检测器 C 模块
 echo "编译 libpublic_address_detector.so..."
-gcc -fPIC -shared -o libpublic_address_detector.so public_address_detector.c -I. -lpthread
+gcc -fPIC -shared -o libpublic_address_detector.so public_address_detector.c -I. -DDDNS_WITH_TLS -lssl -lcrypto -lpthread
 
 
 # 编译 Cloudflare DDNS Go 模块
@@ -30,7 +30,7 @@ echo "编译 main.c..."
 export DYLD_LIBRARY_PATH=./libs:.
 rm ./bin/ddns-client-c
 mkdir bin
-gcc -o ./bin/ddns-client-c main.c -I./libs -L./libs -lpublic_address_detector -lcloudflare_ddns -Wl,-rpath=./libs
+gcc -o ./bin/ddns-client-c main.c trace.c control.c tenant.c -I./libs -L./libs -lpublic_address_detector -lcloudflare_ddns -lpthread -Wl,-rpath=./libs
 
 echo "C 版本编译完成！"
 echo "可执行文件: ./bin/ddns-client-c"
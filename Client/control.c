@@ -0,0 +1,232 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#ifdef _WIN32
+    #include <windows.h>
+#else
+    #include <unistd.h>
+    #include <fcntl.h>
+    #include <poll.h>
+    #include <sys/socket.h>
+    #include <sys/stat.h>
+    #include <sys/un.h>
+
+    // macOS没有MSG_NOSIGNAL
+    #ifndef MSG_NOSIGNAL
+    #define MSG_NOSIGNAL 0
+    #endif
+#endif
+
+#include "control.h"
+#include "trace.h"
+
+#define CONTROL_BUFFER_SIZE 4096
+#define CONTROL_READ_TIMEOUT_MS 1000   // 单个命令从连接到收齐一行的总时限
+#define CONTROL_MAX_PENDING 8          // 同时等待命令的连接数
+
+#ifndef _WIN32
+
+int control_open(const char* path) {
+    struct sockaddr_un addr;
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        return -1;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+    // 上次异常退出可能残留路径；只允许当前用户连接
+    unlink(path);
+    mode_t old_mask = umask(077);
+    int rc = bind(fd, (struct sockaddr*)&addr, sizeof(addr));
+    umask(old_mask);
+
+    if (rc < 0 || listen(fd, 4) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    return fd;
+}
+
+// 尚未收齐命令的连接，全部非阻塞读取，慢客户端不会拖住主循环
+typedef struct {
+    int fd;
+    size_t got;
+    long long deadline_ms;
+    char command[64];
+} ControlConn;
+
+static ControlConn g_pending[CONTROL_MAX_PENDING];
+static int g_pending_count = 0;
+
+static long long control_now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// 执行一条命令并回复，返回CONTROL_*
+static int control_execute(int conn, const char* command, ControlDumpFn dump, void* arg) {
+    char reply[CONTROL_BUFFER_SIZE];
+    int action = CONTROL_NONE;
+
+    if (strcmp(command, "stats") == 0) {
+        trace_format(reply, sizeof(reply));
+    } else if (strcmp(command, "refresh") == 0) {
+        snprintf(reply, sizeof(reply), "OK refresh scheduled\n");
+        action = CONTROL_REFRESH;
+    } else if (strcmp(command, "dump") == 0) {
+        if (!dump || dump(reply, sizeof(reply), arg) <= 0) {
+            snprintf(reply, sizeof(reply), "ERROR no state\n");
+        }
+    } else if (strcmp(command, "reset") == 0) {
+        trace_reset();
+        snprintf(reply, sizeof(reply), "OK stats reset\n");
+    } else {
+        snprintf(reply, sizeof(reply), "ERROR unknown command (stats|refresh|dump|reset)\n");
+    }
+
+    // 回复不超过套接字发送缓冲，对端不读时直接丢弃
+    send(conn, reply, strlen(reply), MSG_NOSIGNAL | MSG_DONTWAIT);
+    return action;
+}
+
+// 读取连接上已到达的数据，收齐一行、对端关闭或缓冲已满时执行命令
+// 返回-1表示连接仍在等待，否则为命令的CONTROL_*
+static int control_read(ControlConn* c, ControlDumpFn dump, void* arg) {
+    ssize_t n = recv(c->fd, c->command + c->got, sizeof(c->command) - 1 - c->got, MSG_DONTWAIT);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+        return -1;
+    }
+    if (n > 0) {
+        c->got += (size_t)n;
+        if (!memchr(c->command, '\n', c->got) && c->got < sizeof(c->command) - 1) {
+            return -1;
+        }
+    }
+
+    c->command[c->got] = '\0';
+    c->command[strcspn(c->command, "\r\n")] = '\0';
+    return control_execute(c->fd, c->command, dump, arg);
+}
+
+static void control_drop(int index) {
+    close(g_pending[index].fd);
+    g_pending[index] = g_pending[--g_pending_count];
+}
+
+int control_poll(int fd, int timeout_ms, ControlDumpFn dump, void* arg) {
+    if (fd < 0) {
+        if (timeout_ms > 0) {
+            usleep(timeout_ms * 1000);
+        }
+        return CONTROL_NONE;
+    }
+
+    struct pollfd pfds[1 + CONTROL_MAX_PENDING];
+    long long now = control_now_ms();
+    int wait_ms = timeout_ms;
+
+    pfds[0].fd = fd;
+    pfds[0].events = POLLIN;
+    pfds[0].revents = 0;
+    for (int i = 0; i < g_pending_count; i++) {
+        pfds[1 + i].fd = g_pending[i].fd;
+        pfds[1 + i].events = POLLIN;
+        pfds[1 + i].revents = 0;
+        long long left = g_pending[i].deadline_ms - now;
+        if (left < wait_ms) {
+            wait_ms = left > 0 ? (int)left : 0;
+        }
+    }
+
+    int count = g_pending_count;
+    if (poll(pfds, (nfds_t)(1 + count), wait_ms) < 0) {
+        return CONTROL_NONE;
+    }
+
+    // 已有连接先读，到达时限仍未收齐命令的连接直接关闭
+    int action = CONTROL_NONE;
+    now = control_now_ms();
+    for (int i = count - 1; i >= 0; i--) {
+        int result = -1;
+        if (pfds[1 + i].revents) {
+            result = control_read(&g_pending[i], dump, arg);
+        }
+        if (result == CONTROL_REFRESH) {
+            action = CONTROL_REFRESH;
+        }
+        if (result >= 0 || now >= g_pending[i].deadline_ms) {
+            control_drop(i);
+        }
+    }
+
+    if (pfds[0].revents) {
+        int conn;
+        while ((conn = accept(fd, NULL, NULL)) >= 0) {
+            if (g_pending_count >= CONTROL_MAX_PENDING) {
+                close(conn);
+                continue;
+            }
+            fcntl(conn, F_SETFD, FD_CLOEXEC);
+            ControlConn* c = &g_pending[g_pending_count++];
+            c->fd = conn;
+            c->got = 0;
+            c->deadline_ms = now + CONTROL_READ_TIMEOUT_MS;
+
+            // 命令通常随连接一起到达，立即尝试读取
+            int result = control_read(c, dump, arg);
+            if (result == CONTROL_REFRESH) {
+                action = CONTROL_REFRESH;
+            }
+            if (result >= 0) {
+                control_drop(g_pending_count - 1);
+            }
+        }
+    }
+    return action;
+}
+
+void control_close(int fd, const char* path) {
+    while (g_pending_count > 0) {
+        control_drop(g_pending_count - 1);
+    }
+    if (fd >= 0) {
+        close(fd);
+        unlink(path);
+    }
+}
+
+#else
+
+int control_open(const char* path) {
+    (void)path;
+    return -1;
+}
+
+int control_poll(int fd, int timeout_ms, ControlDumpFn dump, void* arg) {
+    (void)fd;
+    (void)dump;
+    (void)arg;
+    Sleep(timeout_ms);
+    return CONTROL_NONE;
+}
+
+void control_close(int fd, const char* path) {
+    (void)fd;
+    (void)path;
+}
+
+#endif
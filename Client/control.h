@@ -0,0 +1,32 @@
+#ifndef CONTROL_H
+#define CONTROL_H
+
+#include <stddef.h>
+
+// 本地控制套接字（Unix域，仅POSIX平台）
+// 每个连接发送一行命令，返回文本后关闭：
+//   stats   各阶段耗时统计
+//   refresh 立即重新检测并更新DNS
+//   dump    当前配置与状态
+//   reset   清空耗时统计
+// 例如: echo stats | nc -U ddns_monitor.sock
+
+#define CONTROL_SOCKET_PATH "ddns_monitor.sock"
+
+#define CONTROL_NONE 0
+#define CONTROL_REFRESH 1   // 收到refresh命令
+
+// 输出当前状态，供dump命令使用，返回写入的字节数
+typedef int (*ControlDumpFn)(char* buf, size_t len, void* arg);
+
+// 创建控制套接字，失败或平台不支持时返回-1
+int control_open(const char* path);
+
+// 最多等待timeout_ms毫秒并处理期间到达的命令，返回CONTROL_*
+// fd为-1时只等待
+int control_poll(int fd, int timeout_ms, ControlDumpFn dump, void* arg);
+
+// 关闭控制套接字并删除路径
+void control_close(int fd, const char* path);
+
+#endif // CONTROL_H
@@ -1,13 +1,15 @@
 package main
 
 /*
-#cgo CFLAGS: -I.
-#cgo windows LDFLAGS: -L. -lpublic_address_detector
-#cgo linux LDFLAGS: -L. -lpublic_address_detector -lpthread
-#cgo darwin LDFLAGS: -L. -lpublic_address_detector -lpthread
-
-#include "public_address_detector.h"
 #include <stdlib.h>
+// 耗时统计的阶段编号
+#define DDNS_STAGE_SYSTEM_IPS 0
+#define DDNS_STAGE_REFLEXIVE  1
+#define DDNS_STAGE_PROBE      2
+#define DDNS_STAGE_DNS_LOOKUP 3
+#define DDNS_STAGE_DNS_UPDATE 4
+#define DDNS_STAGE_COUNT      5
+#define DDNS_MAX_SPANS        32
 // 定义结构体，与C头文件中的一致
 typedef struct {
     char* result;
@@ -15,18 +17,35 @@ typedef struct {
     int   serverPort;
     int   timeout;
     char* ipAddr;
+    char* serverToken;
+    int   serverTLS;                        // 控制连接使用TLS
+    char* serverCA;                         // 校验服务端证书的CA文件，空为系统默认
+    char* serverName;                       // 服务端证书中的名称，空为按serverIP校验
+    int   spanCount;                        // 本次执行记录的阶段耗时个数
+    int   spanStage[DDNS_MAX_SPANS];        // DDNS_STAGE_*
+    long long spanMicros[DDNS_MAX_SPANS];   // 耗时（微秒，单调时钟）
 } DDNSResult;
 */
 import "C"
 import (
+	"context"
+	"crypto/rand"
+	"crypto/tls"
+	"crypto/x509"
+	"encoding/binary"
+	"encoding/hex"
 	"encoding/json"
-	"errors"
 	"fmt"
 	"io/ioutil"
 	"log"
 	"net"
 	"net/http"
+	"os"
+	"path/filepath"
+	"sort"
+	"strconv"
 	"strings"
+	"sync"
 	"time"
 	"unsafe"
 )
@@ -40,6 +59,41 @@ type Config struct {
 	ServerIP   string `json:"serverIP"`
 	ServerPort int    `json:"serverPort"`
 	Timeout    int    `json:"timeout"`
+	// ServerToken 长连接会话的认证令牌，与服务端 -k 参数一致
+	ServerToken string `json:"serverToken"`
+	// ServerTLS 控制连接使用TLS 1.3（服务端 -t 参数），恢复会话省去重复连接的完整握手
+	ServerTLS bool `json:"serverTLS"`
+	// ServerCA 校验服务端证书的CA文件（PEM），为空时使用系统证书
+	ServerCA string `json:"serverCA"`
+	// ServerName 服务端证书中的名称，为空时按serverIP校验证书中的IP地址
+	ServerName string `json:"serverName"`
+	// InterfaceAllow 只使用这些网卡上的地址（支持通配符），为空时不限制
+	InterfaceAllow []string `json:"interfaceAllow"`
+	// InterfaceDeny 不使用这些网卡上的地址（支持通配符），优先于InterfaceAllow
+	InterfaceDeny []string `json:"interfaceDeny"`
+	// DNSVerify 直接向权威DNS查询记录当前值，与目标地址不一致时才调用Cloudflare API
+	DNSVerify bool `json:"dnsVerify"`
+	// DNSServers 权威DNS服务器地址（IP或IP:端口），不经过系统解析器
+	DNSServers []string `json:"dnsServers"`
+	// FlapConfirm 候选地址连续验证通过的轮数，达到后才替换当前记录，0或1时立即替换
+	FlapConfirm int `json:"flapConfirm"`
+	// FlapDwell 记录变更后至少保持的秒数，当前地址仍在本机接口上时不提前替换
+	FlapDwell int `json:"flapDwell"`
+	// FlapSticky 当前记录的地址本轮仍验证通过时保持不变，不切换到更优先的地址
+	FlapSticky bool `json:"flapSticky"`
+	// Tenants 多租户模式下各网络命名空间对应的记录（仅C版本后台服务使用）
+	Tenants []TenantConfig `json:"tenants"`
+}
+
+// TenantConfig 一个网络命名空间（容器、VRF等）及其DNS记录，与顶层记录共用API密钥和服务端
+type TenantConfig struct {
+	Name string `json:"name"`
+	// Netns 命名空间名（/var/run/netns/下）或命名空间文件路径（如/proc/<pid>/ns/net）
+	Netns      string `json:"netns"`
+	RecordName string `json:"recordName"`
+	// Domain、ZoneID 为空时使用顶层配置
+	Domain string `json:"domain"`
+	ZoneID string `json:"zoneID"`
 }
 
 type DNSRecord struct {
@@ -49,6 +103,11 @@ type DNSRecord struct {
 	Content string `json:"content"`
 }
 
+type DNSRecordResponse struct {
+	Success bool      `json:"success"`
+	Result  DNSRecord `json:"result"`
+}
+
 type CloudflareResponse struct {
 	Success  bool        `json:"success"`
 	Errors   []string    `json:"errors"`
@@ -65,6 +124,202 @@ type DNSListResponse struct {
 
 var cfg Config
 
+// 所有Cloudflare API请求共用一个客户端，多个记录集的更新复用同一组TLS连接
+var httpClient = &http.Client{}
+
+// 控制连接的TLS配置，会话票据缓存由所有控制连接共享，重复连接时恢复会话
+var (
+	serverTLSOnce   sync.Once
+	serverTLSConfig *tls.Config
+	serverTLSErr    error
+)
+
+func getServerTLSConfig() (*tls.Config, error) {
+	serverTLSOnce.Do(func() {
+		conf := &tls.Config{
+			MinVersion:         tls.VersionTLS13,
+			ServerName:         cfg.ServerName,
+			ClientSessionCache: tls.NewLRUClientSessionCache(16),
+		}
+		if conf.ServerName == "" {
+			conf.ServerName = cfg.ServerIP
+		}
+		if cfg.ServerCA != "" {
+			pem, err := ioutil.ReadFile(cfg.ServerCA)
+			if err != nil {
+				serverTLSErr = err
+				return
+			}
+			pool := x509.NewCertPool()
+			if !pool.AppendCertsFromPEM(pem) {
+				serverTLSErr = fmt.Errorf("CA文件中没有可用的证书: %s", cfg.ServerCA)
+				return
+			}
+			conf.RootCAs = pool
+		}
+		serverTLSConfig = conf
+	})
+	return serverTLSConfig, serverTLSErr
+}
+
+// dialServer 连接服务端控制端口，配置了serverTLS时在ctx的截止时间内完成TLS握手
+// crypto/tls不发送0-RTT早期数据，重复连接凭票据恢复会话，请求在握手后发出
+func dialServer(ctx context.Context, network, serverIP string, serverPort int) (net.Conn, error) {
+	var dialer net.Dialer
+	conn, err := dialer.DialContext(ctx, network, net.JoinHostPort(serverIP, strconv.Itoa(serverPort)))
+	if err != nil || !cfg.ServerTLS {
+		return conn, err
+	}
+
+	conf, err := getServerTLSConfig()
+	if err != nil {
+		conn.Close()
+		return nil, err
+	}
+	tlsConn := tls.Client(conn, conf)
+	if err := tlsConn.HandshakeContext(ctx); err != nil {
+		conn.Close()
+		return nil, err
+	}
+	return tlsConn, nil
+}
+
+// 耗时统计的阶段，编号与DDNSResult中的DDNS_STAGE_*一致
+const (
+	stageSystemIPs = iota
+	stageReflexive
+	stageProbe
+	stageDNSLookup
+	stageDNSUpdate
+)
+
+var stageNames = []string{"system_ips", "reflexive", "probe", "dns_lookup", "dns_update"}
+
+type span struct {
+	stage   int
+	elapsed time.Duration
+}
+
+// 本轮执行中各阶段的耗时，time.Since基于单调时钟，不受系统时间调整影响
+// 探测在多个goroutine中并发执行，追加时需加锁
+var (
+	spans   []span
+	spansMu sync.Mutex
+)
+
+// traceSpan 记录从start到现在的阶段耗时，一般以 defer traceSpan(stage, time.Now()) 使用
+func traceSpan(stage int, start time.Time) {
+	elapsed := time.Since(start)
+
+	spansMu.Lock()
+	spans = append(spans, span{stage, elapsed})
+	spansMu.Unlock()
+}
+
+// 状态文件，保存最近一次验证通过的地址和DNS记录，重启后无需重新探测即可恢复
+const stateFile = "conf/state.json"
+const stateVersion = 1
+
+// 缓存的记录超过该时间后重新向Cloudflare查询一次，防止记录在别处被修改
+const recordCacheTTL = time.Hour
+
+type CachedRecord struct {
+	ID        string `json:"id"`
+	Content   string `json:"content"`
+	CheckedAt int64  `json:"checkedAt"`
+	// ChangedAt 记录内容最近一次由本客户端修改的时间，未知时为0
+	ChangedAt int64 `json:"changedAt,omitempty"`
+}
+
+type ClientState struct {
+	Version    int                     `json:"version"`
+	ConfigKey  string                  `json:"configKey"`
+	ServerIP   string                  `json:"serverIP"`
+	ServerPort int                     `json:"serverPort"`
+	Family     string                  `json:"family"`
+	Address    string                  `json:"address"`
+	Records    map[string]CachedRecord `json:"records"`
+	VerifiedAt int64                   `json:"verifiedAt"`
+	Flap       *FlapHistory            `json:"flap,omitempty"`
+	// TenantFlap 租户记录集各自的探测历史，键为记录集的cacheKey
+	TenantFlap map[string]*FlapHistory `json:"tenantFlap,omitempty"`
+}
+
+var state ClientState
+
+// configKey 配置指纹，域名、记录或服务端变化后旧状态作废
+func configKey() string {
+	return fmt.Sprintf("%s|%s|%s|%s|%d", cfg.ZoneID, cfg.RecordName, cfg.Domain, cfg.ServerIP, cfg.ServerPort)
+}
+
+// loadState 读取状态文件，不存在、版本或配置不匹配时从空状态开始
+func loadState() {
+	state = ClientState{Records: map[string]CachedRecord{}}
+
+	data, err := ioutil.ReadFile(stateFile)
+	if err != nil {
+		return
+	}
+
+	var saved ClientState
+	if err := json.Unmarshal(data, &saved); err != nil {
+		log.Printf("状态文件损坏，忽略: %v\n", err)
+		return
+	}
+	if saved.Version != stateVersion || saved.ConfigKey != configKey() {
+		return
+	}
+	if saved.Records == nil {
+		saved.Records = map[string]CachedRecord{}
+	}
+	state = saved
+}
+
+// saveState 原子写入状态文件：先写临时文件并落盘，再rename覆盖
+func saveState() error {
+	state.Version = stateVersion
+	state.ConfigKey = configKey()
+
+	data, err := json.Marshal(&state)
+	if err != nil {
+		return err
+	}
+
+	tmp := stateFile + ".tmp"
+	f, err := os.OpenFile(tmp, os.O_WRONLY|os.O_CREATE|os.O_TRUNC, 0600)
+	if err != nil {
+		return err
+	}
+	if _, err := f.Write(data); err != nil {
+		f.Close()
+		os.Remove(tmp)
+		return err
+	}
+	if err := f.Sync(); err != nil {
+		f.Close()
+		os.Remove(tmp)
+		return err
+	}
+	if err := f.Close(); err != nil {
+		os.Remove(tmp)
+		return err
+	}
+	return os.Rename(tmp, stateFile)
+}
+
+// checkpointState 记录一次验证通过的结果并写入状态文件
+func checkpointState(family, address string) {
+	state.ServerIP = cfg.ServerIP
+	state.ServerPort = cfg.ServerPort
+	state.Family = family
+	state.Address = address
+	state.VerifiedAt = time.Now().Unix()
+
+	if err := saveState(); err != nil {
+		log.Printf("写入状态文件失败: %v\n", err)
+	}
+}
+
 func init() {
 	// 从配置文件读取
 	data, err := ioutil.ReadFile("conf/config.json")
@@ -80,9 +335,13 @@ func init() {
 			ServerPort: 0,
 			Timeout:    10,
 		}
+		httpClient.Timeout = time.Duration(cfg.Timeout) * time.Second
+		loadState()
 		return
 	}
 	json.Unmarshal(data, &cfg)
+	httpClient.Timeout = time.Duration(cfg.Timeout) * time.Second
+	loadState()
 }
 
 // SetDNS 简单的封装函数
@@ -94,23 +353,52 @@ func SetDNS(ipType, ip string) string {
 	}
 }
 
-// 查询现有DNS记录
-func getExistingDNSRecord(ipType string) (*DNSRecord, error) {
-	fullName := cfg.RecordName + "." + cfg.Domain
-	if cfg.RecordName == "" {
-		fullName = cfg.Domain
+// recordSet 同一名称的一组A/AAAA记录，顶层配置是默认记录集，每个租户各有一组
+type recordSet struct {
+	zoneID   string
+	fullName string
+	cacheKey string // state.Records中的键前缀，默认记录集为空以兼容已有的状态文件
+}
+
+func recordFullName(recordName, domain string) string {
+	if recordName == "" {
+		return domain
+	}
+	return recordName + "." + domain
+}
+
+func defaultRecordSet() recordSet {
+	return recordSet{zoneID: cfg.ZoneID, fullName: recordFullName(cfg.RecordName, cfg.Domain)}
+}
+
+func tenantRecordSet(t TenantConfig) recordSet {
+	zoneID, domain := t.ZoneID, t.Domain
+	if zoneID == "" {
+		zoneID = cfg.ZoneID
+	}
+	if domain == "" {
+		domain = cfg.Domain
 	}
 
+	rs := recordSet{zoneID: zoneID, fullName: recordFullName(t.RecordName, domain)}
+	// 记录名变化后旧缓存自然失效
+	rs.cacheKey = "tenant/" + t.Name + "/" + rs.fullName + "/"
+	return rs
+}
+
+// 查询现有DNS记录
+func getExistingDNSRecord(rs recordSet, ipType string) (*DNSRecord, error) {
+	defer traceSpan(stageDNSLookup, time.Now())
+
 	// 使用API查询记录
 	url := fmt.Sprintf("https://api.cloudflare.com/client/v4/zones/%s/dns_records?type=%s&name=%s",
-		cfg.ZoneID, ipType, fullName)
+		rs.zoneID, ipType, rs.fullName)
 
 	req, _ := http.NewRequest("GET", url, nil)
 	req.Header.Set("Authorization", "Bearer "+cfg.APIKey)
 	req.Header.Set("Content-Type", "application/json")
 
-	client := &http.Client{Timeout: time.Duration(cfg.Timeout) * time.Second}
-	resp, err := client.Do(req)
+	resp, err := httpClient.Do(req)
 
 	if err != nil {
 		return nil, err
@@ -132,24 +420,243 @@ func getExistingDNSRecord(ipType string) (*DNSRecord, error) {
 	return &response.Result[0], nil
 }
 
+// DNS报文中的记录类型和标志位
+const (
+	dnsTypeA    = 1
+	dnsTypeAAAA = 28
+	dnsClassIN  = 1
+
+	dnsFlagQR = 0x8000
+	dnsFlagAA = 0x0400
+	dnsFlagTC = 0x0200
+
+	dnsRcodeNXDomain = 3
+)
+
+// 单个权威服务器的查询超时，超时后尝试下一个服务器
+const dnsQueryTimeout = 2 * time.Second
+
+// buildDNSQuery 构造一个不要求递归的单问题查询报文
+func buildDNSQuery(id uint16, name string, qtype uint16) ([]byte, error) {
+	msg := make([]byte, 12, 12+len(name)+6)
+	binary.BigEndian.PutUint16(msg[0:], id)
+	binary.BigEndian.PutUint16(msg[4:], 1) // QDCOUNT
+
+	for _, label := range strings.Split(strings.TrimSuffix(name, "."), ".") {
+		if len(label) == 0 || len(label) > 63 {
+			return nil, fmt.Errorf("无效域名: %s", name)
+		}
+		msg = append(msg, byte(len(label)))
+		msg = append(msg, label...)
+	}
+	msg = append(msg, 0)
+	msg = append(msg, byte(qtype>>8), byte(qtype), 0, dnsClassIN)
+	return msg, nil
+}
+
+// skipDNSName 跳过报文中off处的域名（含压缩指针），返回其后的偏移
+func skipDNSName(msg []byte, off int) (int, error) {
+	for off < len(msg) {
+		n := int(msg[off])
+		switch {
+		case n == 0:
+			return off + 1, nil
+		case n&0xc0 == 0xc0:
+			return off + 2, nil
+		default:
+			off += 1 + n
+		}
+	}
+	return 0, fmt.Errorf("DNS报文被截断")
+}
+
+// parseDNSAnswer 校验响应并取出回答中qtype类型的地址，域名不存在时返回空列表
+func parseDNSAnswer(msg []byte, id, qtype uint16) ([]net.IP, error) {
+	if len(msg) < 12 || binary.BigEndian.Uint16(msg[0:]) != id {
+		return nil, fmt.Errorf("DNS响应ID不匹配")
+	}
+	flags := binary.BigEndian.Uint16(msg[2:])
+	if flags&dnsFlagQR == 0 || flags&dnsFlagAA == 0 {
+		return nil, fmt.Errorf("不是权威DNS响应")
+	}
+	if flags&dnsFlagTC != 0 {
+		return nil, fmt.Errorf("DNS响应被截断")
+	}
+	if rcode := flags & 0x0f; rcode == dnsRcodeNXDomain {
+		return nil, nil
+	} else if rcode != 0 {
+		return nil, fmt.Errorf("DNS响应错误码 %d", rcode)
+	}
+
+	off := 12
+	for i := 0; i < int(binary.BigEndian.Uint16(msg[4:])); i++ {
+		var err error
+		if off, err = skipDNSName(msg, off); err != nil {
+			return nil, err
+		}
+		off += 4
+	}
+
+	var ips []net.IP
+	for i := 0; i < int(binary.BigEndian.Uint16(msg[6:])); i++ {
+		var err error
+		if off, err = skipDNSName(msg, off); err != nil {
+			return nil, err
+		}
+		if off+10 > len(msg) {
+			return nil, fmt.Errorf("DNS报文被截断")
+		}
+		rrType := binary.BigEndian.Uint16(msg[off:])
+		rdLen := int(binary.BigEndian.Uint16(msg[off+8:]))
+		off += 10
+		if off+rdLen > len(msg) {
+			return nil, fmt.Errorf("DNS报文被截断")
+		}
+		// 只取与查询类型一致的记录，CNAME等其他记录说明该名称不是直接指向地址
+		if rrType == qtype && (rdLen == net.IPv4len || rdLen == net.IPv6len) {
+			ips = append(ips, net.IP(append([]byte(nil), msg[off:off+rdLen]...)))
+		}
+		off += rdLen
+	}
+	return ips, nil
+}
+
+// dnsServerAddr 补全权威服务器地址的默认端口
+func dnsServerAddr(server string) string {
+	if _, _, err := net.SplitHostPort(server); err == nil {
+		return server
+	}
+	return net.JoinHostPort(server, "53")
+}
+
+// queryAuthoritative 依次向配置的权威服务器发送UDP查询，返回第一个有效响应中的地址
+func queryAuthoritative(name string, qtype uint16) ([]net.IP, error) {
+	defer traceSpan(stageDNSLookup, time.Now())
+
+	var idBytes [2]byte
+	if _, err := rand.Read(idBytes[:]); err != nil {
+		return nil, err
+	}
+	id := binary.BigEndian.Uint16(idBytes[:])
+	query, err := buildDNSQuery(id, name, qtype)
+	if err != nil {
+		return nil, err
+	}
+
+	lastErr := fmt.Errorf("未配置权威DNS服务器")
+	buf := make([]byte, 1232)
+	for _, server := range cfg.DNSServers {
+		ips, err := func() ([]net.IP, error) {
+			// 已连接的UDP套接字只接收来自该服务器的响应
+			conn, err := net.DialTimeout("udp", dnsServerAddr(server), dnsQueryTimeout)
+			if err != nil {
+				return nil, err
+			}
+			defer conn.Close()
+
+			conn.SetDeadline(time.Now().Add(dnsQueryTimeout))
+			if _, err := conn.Write(query); err != nil {
+				return nil, err
+			}
+			for {
+				n, err := conn.Read(buf)
+				if err != nil {
+					return nil, err
+				}
+				// ID不匹配的报文可能是迟到的旧响应，继续等待
+				if n >= 2 && binary.BigEndian.Uint16(buf) != id {
+					continue
+				}
+				return parseDNSAnswer(buf[:n], id, qtype)
+			}
+		}()
+		if err == nil {
+			return ips, nil
+		}
+		lastErr = fmt.Errorf("%s: %v", server, err)
+	}
+	return nil, lastErr
+}
+
+// verifyByDNS 查询权威DNS，判断记录是否已经是ip
+func verifyByDNS(ipType, fullName, ip string) (bool, error) {
+	qtype := uint16(dnsTypeA)
+	if ipType == "AAAA" {
+		qtype = dnsTypeAAAA
+	}
+
+	ips, err := queryAuthoritative(fullName, qtype)
+	if err != nil {
+		return false, err
+	}
+	want := net.ParseIP(ip)
+	for _, got := range ips {
+		if got.Equal(want) {
+			return true, nil
+		}
+	}
+	return false, nil
+}
+
 func setCloudflareDNS(ipType, ip string) (string, error) {
+	return setRecordDNS(defaultRecordSet(), ipType, ip)
+}
+
+// setRecordDNS 把记录集rs中ipType类型的记录设置为ip
+func setRecordDNS(rs recordSet, ipType, ip string) (string, error) {
 	if ipType != "A" && ipType != "AAAA" {
 		return "", fmt.Errorf("无效IP类型")
 	}
 
-	fullName := cfg.RecordName + "." + cfg.Domain
-	if cfg.RecordName == "" {
-		fullName = cfg.Domain
+	fullName := rs.fullName
+	cacheKey := rs.cacheKey + ipType
+
+	// 1. 先查缓存，缓存未过期时省去查询请求
+	cached, hasCache := state.Records[cacheKey]
+	if hasCache && time.Since(time.Unix(cached.CheckedAt, 0)) > recordCacheTTL {
+		hasCache = false
 	}
 
-	// 1. 先查询现有记录
-	existingRecord, err := getExistingDNSRecord(ipType)
-	if err != nil {
-		return "", fmt.Errorf("查询记录失败: %v", err)
+	// 启用DNS校验时以权威DNS的回答为准：一致则无需调用API，不一致说明缓存已不可信
+	// 查询失败时退回到缓存和API查询
+	if cfg.DNSVerify && len(cfg.DNSServers) > 0 {
+		matched, err := verifyByDNS(ipType, fullName, ip)
+		if err != nil {
+			log.Printf("权威DNS查询失败，改用API查询: %v\n", err)
+		} else if matched {
+			if record, ok := state.Records[cacheKey]; ok {
+				record.Content = ip
+				record.CheckedAt = time.Now().Unix()
+				state.Records[cacheKey] = record
+			}
+			return fmt.Sprintf("✅ IP未改变: %s 已经是 %s", fullName, ip), nil
+		} else {
+			hasCache = false
+		}
+	}
+	if hasCache && cached.Content == ip {
+		return fmt.Sprintf("✅ IP未改变: %s 已经是 %s", fullName, ip), nil
+	}
+
+	var existingRecord *DNSRecord
+	if hasCache {
+		existingRecord = &DNSRecord{ID: cached.ID, Type: ipType, Name: fullName, Content: cached.Content}
+	} else {
+		// 缓存缺失或过期，查询现有记录
+		record, err := getExistingDNSRecord(rs, ipType)
+		if err != nil {
+			return "", fmt.Errorf("查询记录失败: %v", err)
+		}
+		existingRecord = record
 	}
 
 	// 2. 如果记录存在且IP相同，直接返回
 	if existingRecord != nil && existingRecord.Content == ip {
+		changedAt := state.Records[cacheKey].ChangedAt
+		if state.Records[cacheKey].Content != ip {
+			changedAt = 0
+		}
+		state.Records[cacheKey] = CachedRecord{ID: existingRecord.ID, Content: ip, CheckedAt: time.Now().Unix(), ChangedAt: changedAt}
 		return fmt.Sprintf("✅ IP未改变: %s 已经是 %s", fullName, ip), nil
 	}
 
@@ -176,12 +683,12 @@ func setCloudflareDNS(ipType, ip string) (string, error) {
 	if existingRecord != nil {
 		// 更新现有记录
 		url = fmt.Sprintf("https://api.cloudflare.com/client/v4/zones/%s/dns_records/%s",
-			cfg.ZoneID, existingRecord.ID)
+			rs.zoneID, existingRecord.ID)
 		method = "PUT"
 		action = "更新"
 	} else {
 		// 创建新记录
-		url = fmt.Sprintf("https://api.cloudflare.com/client/v4/zones/%s/dns_records", cfg.ZoneID)
+		url = fmt.Sprintf("https://api.cloudflare.com/client/v4/zones/%s/dns_records", rs.zoneID)
 		method = "POST"
 		action = "创建"
 	}
@@ -190,9 +697,9 @@ func setCloudflareDNS(ipType, ip string) (string, error) {
 	req.Header.Set("Authorization", "Bearer "+cfg.APIKey)
 	req.Header.Set("Content-Type", "application/json")
 
-	client := &http.Client{Timeout: time.Duration(cfg.Timeout) * time.Second}
-
-	resp, err := client.Do(req)
+	start := time.Now()
+	resp, err := httpClient.Do(req)
+	traceSpan(stageDNSUpdate, start)
 	if err != nil {
 		return "", err
 	}
@@ -200,14 +707,129 @@ func setCloudflareDNS(ipType, ip string) (string, error) {
 
 	body, _ := ioutil.ReadAll(resp.Body)
 
-	if strings.Contains(string(body), `"success":true`) {
+	var response DNSRecordResponse
+	if json.Unmarshal(body, &response) == nil && response.Success {
+		recordID := response.Result.ID
+		if recordID == "" && existingRecord != nil {
+			recordID = existingRecord.ID
+		}
+		now := time.Now().Unix()
+		state.Records[cacheKey] = CachedRecord{ID: recordID, Content: ip, CheckedAt: now, ChangedAt: now}
 		return fmt.Sprintf("✅ %s成功: %s → %s", action, fullName, ip), nil
 	}
 
+	// 缓存的记录ID可能已失效（记录被删除），清除缓存后按查询结果重试一次
+	if hasCache {
+		delete(state.Records, cacheKey)
+		return setRecordDNS(rs, ipType, ip)
+	}
+
 	return fmt.Sprintf("❌ %s失败", action), nil
 }
 
+// IPv6地址标志，取自内核的ifa_flags（/proc/net/if_inet6第五列）
+const (
+	ifaFlagTemporary  = 0x01
+	ifaFlagDadFailed  = 0x08
+	ifaFlagDeprecated = 0x20
+	ifaFlagTentative  = 0x40
+	ifaFlagPermanent  = 0x80
+)
+
+// IPv6候选地址的优先级，数值越小越优先，同一优先级的地址并发探测
+const (
+	rankStable     = iota // 手动配置的地址或EUI-64地址
+	rankDynamic           // 其他非临时地址（稳定隐私地址、DHCPv6等）
+	rankDeprecated        // 首选生存期已过，仅在没有其他地址时使用
+	rankLocal             // 唯一本地地址，几乎不可能是公网地址
+	rankSkip              // 临时地址、DAD未完成或失败，不参与探测
+)
+
+// 最近一次枚举得到的IPv6地址优先级
+var ipv6Ranks = map[string]int{}
+
+// readIPv6Flags 读取各IPv6地址的内核标志，非Linux平台返回空表
+func readIPv6Flags() map[string]int {
+	flags := map[string]int{}
+
+	data, err := ioutil.ReadFile("/proc/net/if_inet6")
+	if err != nil {
+		return flags
+	}
+
+	// 每行: 地址 网卡序号 前缀长度 作用域 标志 网卡名
+	for _, line := range strings.Split(string(data), "\n") {
+		fields := strings.Fields(line)
+		if len(fields) < 6 || len(fields[0]) != 32 {
+			continue
+		}
+		raw, err := hex.DecodeString(fields[0])
+		if err != nil {
+			continue
+		}
+		f, err := strconv.ParseUint(fields[4], 16, 32)
+		if err != nil {
+			continue
+		}
+		flags[net.IP(raw).String()] = int(f)
+	}
+	return flags
+}
+
+// isEUI64 判断接口标识是否由MAC地址生成（中间为ff:fe）
+func isEUI64(ip net.IP) bool {
+	ip16 := ip.To16()
+	return ip16 != nil && ip16[11] == 0xff && ip16[12] == 0xfe
+}
+
+// rankIPv6 根据地址标志确定探测优先级
+func rankIPv6(ip net.IP, flags int) int {
+	switch {
+	case flags&(ifaFlagTemporary|ifaFlagTentative|ifaFlagDadFailed) != 0:
+		return rankSkip
+	case flags&ifaFlagDeprecated != 0:
+		return rankDeprecated
+	case ip.IsPrivate():
+		return rankLocal
+	case flags&ifaFlagPermanent != 0 || isEUI64(ip):
+		return rankStable
+	}
+	return rankDynamic
+}
+
+// candidateRank 返回地址的探测优先级，IPv4地址不区分优先级
+func candidateRank(family, ip string) int {
+	if family != "ipv6" {
+		return rankStable
+	}
+	if rank, ok := ipv6Ranks[ip]; ok {
+		return rank
+	}
+	return rankDynamic
+}
+
+// interfaceAllowed 按配置的允许/排除列表判断是否使用该网卡，支持通配符（如 "eth*"）
+func interfaceAllowed(name string) bool {
+	for _, pattern := range cfg.InterfaceDeny {
+		if ok, _ := filepath.Match(pattern, name); ok {
+			return false
+		}
+	}
+	if len(cfg.InterfaceAllow) == 0 {
+		return true
+	}
+	for _, pattern := range cfg.InterfaceAllow {
+		if ok, _ := filepath.Match(pattern, name); ok {
+			return true
+		}
+	}
+	return false
+}
+
+// GetSystemIPs 枚举本机地址，IPv6地址按优先级排序，临时地址和未就绪地址不参与探测
 func GetSystemIPs() (map[string][]string, error) {
+	defer traceSpan(stageSystemIPs, time.Now())
+
 	result := map[string][]string{
 		"ipv4": make([]string, 0),
 		"ipv6": make([]string, 0),
@@ -218,11 +840,18 @@ func GetSystemIPs() (map[string][]string, error) {
 		return result, err
 	}
 
+	flags := readIPv6Flags()
+	ranks := map[string]int{}
+	skipped := 0
+
 	for _, iface := range interfaces {
 		// 跳过环回和非活动接口
 		if iface.Flags&net.FlagLoopback != 0 || iface.Flags&net.FlagUp == 0 {
 			continue
 		}
+		if !interfaceAllowed(iface.Name) {
+			continue
+		}
 
 		addrs, err := iface.Addrs()
 		if err != nil {
@@ -245,109 +874,664 @@ func GetSystemIPs() (map[string][]string, error) {
 			} else {
 				// 处理IPv6
 				if !ip.IsLoopback() && !ip.IsLinkLocalUnicast() && ip.IsGlobalUnicast() {
+					rank := rankIPv6(ip, flags[ip.String()])
+					if rank == rankSkip {
+						skipped++
+						continue
+					}
+					ranks[ip.String()] = rank
 					result["ipv6"] = append(result["ipv6"], ip.String())
 				}
 			}
 		}
 	}
 
+	sort.SliceStable(result["ipv6"], func(i, j int) bool {
+		return ranks[result["ipv6"][i]] < ranks[result["ipv6"][j]]
+	})
+	ipv6Ranks = ranks
+
+	if skipped > 0 {
+		log.Printf("跳过%d个临时或未就绪的IPv6地址\n", skipped)
+	}
+
 	return result, nil
 }
 
-// DetectPublicAddress 封装C库的公共地址检测函数
+// 不可能出现在公网上的地址段（IsPrivate之外的运营商级NAT、基准测试及文档地址）
+var nonPublicNets = parseCIDRs(
+	"100.64.0.0/10",
+	"192.0.0.0/24",
+	"192.0.2.0/24",
+	"198.18.0.0/15",
+	"198.51.100.0/24",
+	"203.0.113.0/24",
+	"2001:db8::/32",
+)
+
+func parseCIDRs(cidrs ...string) []*net.IPNet {
+	nets := make([]*net.IPNet, 0, len(cidrs))
+	for _, cidr := range cidrs {
+		if _, n, err := net.ParseCIDR(cidr); err == nil {
+			nets = append(nets, n)
+		}
+	}
+	return nets
+}
+
+// isPlausiblyPublic 判断地址是否可能是公网地址
+func isPlausiblyPublic(ip net.IP) bool {
+	if ip == nil || ip.IsPrivate() || !ip.IsGlobalUnicast() {
+		return false
+	}
+	for _, n := range nonPublicNets {
+		if n.Contains(ip) {
+			return false
+		}
+	}
+	return true
+}
+
+// 最近一次查询到的反射地址，键为 "ipv4"/"ipv6"
+var reflexiveAddrs = map[string]string{}
+
+// GetReflexiveAddress 查询服务端观察到的控制连接源地址和端口（类似STUN）
+// network 为 "tcp4" 或 "tcp6"，一个RTT即可得知本机在NAT外的出口地址
+func GetReflexiveAddress(network, serverIP string, serverPort, timeout int) (net.IP, int, error) {
+	defer traceSpan(stageReflexive, time.Now())
+
+	ctx, cancel := context.WithTimeout(context.Background(), time.Duration(timeout)*time.Second)
+	defer cancel()
+
+	conn, err := dialServer(ctx, network, serverIP, serverPort)
+	if err != nil {
+		return nil, 0, err
+	}
+	defer conn.Close()
+	deadline, _ := ctx.Deadline()
+	conn.SetDeadline(deadline)
+
+	if _, err := conn.Write([]byte("WHOAMI")); err != nil {
+		return nil, 0, err
+	}
+
+	buf := make([]byte, 256)
+	n, err := conn.Read(buf)
+	if err != nil {
+		return nil, 0, err
+	}
+
+	reply := strings.TrimSpace(string(buf[:n]))
+	if !strings.HasPrefix(reply, "REFLEXIVE: ") {
+		return nil, 0, fmt.Errorf("服务端不支持反射地址查询: %s", reply)
+	}
+
+	host, port, err := net.SplitHostPort(strings.TrimPrefix(reply, "REFLEXIVE: "))
+	if err != nil {
+		return nil, 0, err
+	}
+	ip := net.ParseIP(host)
+	if ip == nil {
+		return nil, 0, fmt.Errorf("无效的反射地址: %s", host)
+	}
+	p, _ := strconv.Atoi(port)
+	return ip, p, nil
+}
+
+// planCandidates 根据反射地址规划某个协议族的探测顺序
+// 反射地址就在本机接口上时把它排在最前，探测成功即可短路（返回true）；
+// 反射地址不在本机接口上说明处于NAT之后，只保留可能是公网的地址；
+// 服务端不支持或不可达时按原方式探测全部地址
+func planCandidates(family string, candidates []string, serverIP string, serverPort, timeout int) ([]string, bool) {
+	if len(candidates) == 0 {
+		return candidates, false
+	}
+
+	network := "tcp4"
+	if family == "ipv6" {
+		network = "tcp6"
+	}
+
+	reflexive, reflexivePort, err := GetReflexiveAddress(network, serverIP, serverPort, timeout)
+	if err != nil {
+		log.Printf("查询%s反射地址失败，探测全部地址: %v\n", family, err)
+		return candidates, false
+	}
+	reflexiveAddrs[family] = reflexive.String()
+
+	for i, clientIP := range candidates {
+		if net.ParseIP(clientIP).Equal(reflexive) {
+			ordered := make([]string, 0, len(candidates))
+			ordered = append(ordered, clientIP)
+			ordered = append(ordered, candidates[:i]...)
+			ordered = append(ordered, candidates[i+1:]...)
+			return ordered, true
+		}
+	}
+
+	log.Printf("检测到NAT: %s出口地址 %s (端口 %d) 不在本机接口上\n", family, reflexive, reflexivePort)
+
+	plausible := make([]string, 0, len(candidates))
+	for _, clientIP := range candidates {
+		if isPlausiblyPublic(net.ParseIP(clientIP)) {
+			plausible = append(plausible, clientIP)
+		}
+	}
+	return plausible, false
+}
+
+// describeReflexive 描述服务端观察到的出口地址，用于提示NAT情况
+func describeReflexive() string {
+	var parts []string
+	for _, family := range []string{"ipv4", "ipv6"} {
+		if addr, ok := reflexiveAddrs[family]; ok {
+			parts = append(parts, addr)
+		}
+	}
+	if len(parts) == 0 {
+		return ""
+	}
+	return fmt.Sprintf(" (服务端观察到的出口地址: %s)", strings.Join(parts, ", "))
+}
+
+// DetectPublicAddress 检测客户端地址能否被服务端从外部连通，与C库使用相同的协议
+// 基于Go网络轮询器实现，不占用操作系统线程，可在大量goroutine中并发调用
 func DetectPublicAddress(clientIP, serverIP string, serverPort, timeout int) (int, error) {
-	// 初始化库
-	if C.detector_init() != 0 {
-		return 0, errors.New("Failed to initialize detector library")
+	defer traceSpan(stageProbe, time.Now())
+
+	ctx, cancel := context.WithTimeout(context.Background(), time.Duration(timeout)*time.Second)
+	defer cancel()
+
+	// 在指定的IP地址上监听随机端口，等待服务端回连
+	var lc net.ListenConfig
+	ln, err := lc.Listen(ctx, "tcp", net.JoinHostPort(clientIP, "0"))
+	if err != nil {
+		return 0, err
+	}
+	defer ln.Close()
+	listener := ln.(*net.TCPListener)
+	listeningPort := listener.Addr().(*net.TCPAddr).Port
+
+	// 连接到服务器，整个探测共用同一个截止时间
+	conn, err := dialServer(ctx, "tcp", serverIP, serverPort)
+	if err != nil {
+		return 0, err
+	}
+	defer conn.Close()
+
+	deadline, _ := ctx.Deadline()
+	conn.SetDeadline(deadline)
+	listener.SetDeadline(deadline)
+
+	// 与C库的请求格式一致："syn"表示接受SYN-ACK确认，"budget"为愿意等待的毫秒数
+	request := fmt.Sprintf("%s syn budget=%d", net.JoinHostPort(clientIP, strconv.Itoa(listeningPort)), timeout*1000)
+	if _, err := conn.Write([]byte(request)); err != nil {
+		return 0, err
+	}
+
+	buf := make([]byte, 1024)
+	n, err := conn.Read(buf)
+	if err != nil {
+		return 0, nil
 	}
-	defer C.detector_cleanup()
+	response := string(buf[:n])
 
-	// 将Go字符串转换为C字符串
-	cClientIP := C.CString(clientIP)
-	cServerIP := C.CString(serverIP)
+	if strings.Contains(response, "VERIFIED") {
+		// 服务端已通过SYN-ACK确认端口可达，无需等待回连
+		return 1, nil
+	}
+	if !strings.Contains(response, "SUCCESS") {
+		return 0, nil
+	}
 
-	// 确保释放C字符串内存
-	defer func() {
-		C.free(unsafe.Pointer(cClientIP))
-		C.free(unsafe.Pointer(cServerIP))
-	}()
+	// 等待服务器连接并发送随机值
+	callback, err := listener.Accept()
+	if err != nil {
+		return 0, nil
+	}
+	defer callback.Close()
+	callback.SetDeadline(deadline)
 
-	// 调用C库函数
-	result := C.detect_public_address(
-		cClientIP,
-		cServerIP,
-		C.int(serverPort),
-		C.int(timeout),
-	)
+	if n, err := callback.Read(buf); err != nil || n == 0 {
+		return 0, nil
+	}
+	return 1, nil
+}
 
-	return int(result.success), nil
+type probeOutcome struct {
+	success bool
+	err     error
 }
 
-// DetectAllIPs 检测所有IP地址
-func DetectAllIPs(ips map[string][]string, serverIP string, serverPort, timeout int) (successIPs, failIPs, errorIPs [][2]string) {
-	// 检测IPv4地址
-	if ipv4List, exists := ips["ipv4"]; exists {
-		for _, clientIP := range ipv4List {
+// probeAll 为每个地址启动一个goroutine并发探测，结果按输入顺序返回
+func probeAll(candidates []string, serverIP string, serverPort, timeout int) []probeOutcome {
+	outcomes := make([]probeOutcome, len(candidates))
+
+	var wg sync.WaitGroup
+	for i, clientIP := range candidates {
+		wg.Add(1)
+		go func(i int, clientIP string) {
+			defer wg.Done()
 			success, err := DetectPublicAddress(clientIP, serverIP, serverPort, timeout)
+			outcomes[i] = probeOutcome{success == 1, err}
+		}(i, clientIP)
+	}
+	wg.Wait()
 
-			result := [2]string{"ipv4", clientIP}
+	return outcomes
+}
 
-			if err != nil {
+// DetectAllIPs 检测所有IP地址
+// watch为各地址族需要确认是否仍可用的地址（抖动抑制中的当前记录），无论排在哪一组都与首组并发探测，
+// 结果在watched中返回；轮到它所在的组时直接使用这次的结果，不重复探测
+func DetectAllIPs(ips map[string][]string, serverIP string, serverPort, timeout int, watch map[string]string) (successIPs, failIPs, errorIPs [][2]string, watched map[string]bool) {
+	labels := map[string]string{"ipv4": "IPv4", "ipv6": "IPv6"}
+	watched = map[string]bool{}
+
+	for _, family := range []string{"ipv4", "ipv6"} {
+		candidates, shortCircuit := planCandidates(family, ips[family], serverIP, serverPort, timeout)
+
+		watchIP := watch[family]
+		var watchDone chan probeOutcome
+		if watchIP != "" && hasAddress(ips[family], watchIP) {
+			watchDone = make(chan probeOutcome, 1)
+			go func(clientIP string) {
+				watchDone <- probeAll([]string{clientIP}, serverIP, serverPort, timeout)[0]
+			}(watchIP)
+		}
+
+		// probeBatch 并发探测一组地址，组内的watch地址取提前启动的那次探测结果
+		probeBatch := func(batch []string) []probeOutcome {
+			at := -1
+			for i, clientIP := range batch {
+				if watchDone != nil && clientIP == watchIP {
+					at = i
+				}
+			}
+			if at < 0 {
+				return probeAll(batch, serverIP, serverPort, timeout)
+			}
+
+			rest := append(append([]string{}, batch[:at]...), batch[at+1:]...)
+			outcomes := probeAll(rest, serverIP, serverPort, timeout)
+			outcome := <-watchDone
+			watchDone = nil
+			return append(append(append([]probeOutcome{}, outcomes[:at]...), outcome), outcomes[at:]...)
+		}
+
+		record := func(clientIP string, outcome probeOutcome) {
+			result := [2]string{family, clientIP}
+			if clientIP == watchIP {
+				watched[clientIP] = outcome.err == nil && outcome.success
+			}
+
+			if outcome.err != nil {
 				errorIPs = append(errorIPs, result)
-				log.Printf("检测IPv4地址 %s 时出错: %v\n", clientIP, err)
-			} else if success == 1 {
+				log.Printf("检测%s地址 %s 时出错: %v\n", labels[family], clientIP, outcome.err)
+			} else if outcome.success {
 				successIPs = append(successIPs, result)
 			} else {
 				failIPs = append(failIPs, result)
 			}
 		}
+
+		// 反射地址就在本机接口上时先单独验证它，成功即无需探测其余地址
+		if shortCircuit {
+			outcome := probeBatch(candidates[:1])[0]
+			record(candidates[0], outcome)
+			if outcome.success {
+				candidates = nil
+			} else {
+				candidates = candidates[1:]
+			}
+		}
+
+		// 按优先级分组探测，某一组有地址成功后不再探测更低优先级的地址
+		for len(candidates) > 0 {
+			rank := candidateRank(family, candidates[0])
+			n := 1
+			for n < len(candidates) && candidateRank(family, candidates[n]) == rank {
+				n++
+			}
+
+			found := false
+			for i, outcome := range probeBatch(candidates[:n]) {
+				record(candidates[i], outcome)
+				found = found || outcome.success
+			}
+			if found {
+				break
+			}
+			candidates = candidates[n:]
+		}
+
+		// watch地址排在更低优先级的组或不在候选中时，只取结果不计入本轮的检测结果
+		if watchDone != nil {
+			outcome := <-watchDone
+			watched[watchIP] = outcome.err == nil && outcome.success
+		}
 	}
 
-	// 检测IPv6地址
-	if ipv6List, exists := ips["ipv6"]; exists {
-		for _, clientIP := range ipv6List {
-			success, err := DetectPublicAddress(clientIP, serverIP, serverPort, timeout)
+	return successIPs, failIPs, errorIPs, watched
+}
 
-			result := [2]string{"ipv6", clientIP}
+// 地址抖动抑制：多出口链路或隐私地址在相邻两轮之间来回切换时，每次切换都会产生一次API写入，
+// 解析器缓存中的旧记录也随之失效。每轮的探测结果以位图环保存，位i对应地址表中第i个地址，
+// 候选地址连续验证通过flapConfirm轮、且当前记录已保持flapDwell秒后才替换当前记录
 
-			if err != nil {
-				errorIPs = append(errorIPs, result)
-				log.Printf("检测IPv6地址 %s 时出错: %v\n", clientIP, err)
-			} else if success == 1 {
-				successIPs = append(successIPs, result)
-			} else {
-				failIPs = append(failIPs, result)
+// 位图环保存的轮数和跟踪的地址数上限
+const (
+	flapWindow = 32
+	flapAddrs  = 64
+)
+
+// FlapHistory 最近flapWindow轮的探测历史，随状态文件保存，单次执行的Go版本同样生效
+type FlapHistory struct {
+	Addrs    []string `json:"addrs"`
+	Probed   []uint64 `json:"probed"`
+	Verified []uint64 `json:"verified"`
+	Round    uint64   `json:"round"`
+}
+
+// flapEnabled 未配置任何抑制参数时保持原有行为：第一个验证通过的地址立即发布
+func flapEnabled() bool {
+	return cfg.FlapConfirm > 1 || cfg.FlapDwell > 0 || cfg.FlapSticky
+}
+
+// index 地址在地址表中的位置，不存在时占用空位或窗口内从未出现过的地址，地址表已满时返回-1
+func (h *FlapHistory) index(addr string) int {
+	free := -1
+	for i, a := range h.Addrs {
+		if a == addr {
+			return i
+		}
+		if free < 0 && !h.seen(i) {
+			free = i
+		}
+	}
+	if len(h.Addrs) < flapAddrs {
+		h.Addrs = append(h.Addrs, addr)
+		return len(h.Addrs) - 1
+	}
+	if free >= 0 {
+		h.Addrs[free] = addr
+		for slot := range h.Probed {
+			h.Probed[slot] &^= 1 << uint(free)
+			h.Verified[slot] &^= 1 << uint(free)
+		}
+	}
+	return free
+}
+
+// seen 第i个地址在窗口内是否被探测过
+func (h *FlapHistory) seen(i int) bool {
+	for _, bits := range h.Probed {
+		if bits&(1<<uint(i)) != 0 {
+			return true
+		}
+	}
+	return false
+}
+
+// record 写入新的一轮，覆盖环中最旧的一轮
+func (h *FlapHistory) record(probed []string, verified map[string]bool) {
+	if len(h.Probed) != flapWindow || len(h.Verified) != flapWindow {
+		h.Probed = make([]uint64, flapWindow)
+		h.Verified = make([]uint64, flapWindow)
+	}
+
+	slot := h.Round % flapWindow
+	h.Probed[slot], h.Verified[slot] = 0, 0
+	for _, addr := range probed {
+		i := h.index(addr)
+		if i < 0 {
+			continue
+		}
+		h.Probed[slot] |= 1 << uint(i)
+		if verified[addr] {
+			h.Verified[slot] |= 1 << uint(i)
+		}
+	}
+	h.Round++
+}
+
+// streak 地址截至最近一轮连续验证通过的轮数，未被探测的轮次同样中断计数
+func (h *FlapHistory) streak(addr string) int {
+	i := -1
+	for j, a := range h.Addrs {
+		if a == addr {
+			i = j
+			break
+		}
+	}
+	if i < 0 || len(h.Verified) != flapWindow {
+		return 0
+	}
+
+	n := 0
+	for n < flapWindow && uint64(n) < h.Round {
+		if h.Verified[(h.Round-1-uint64(n))%flapWindow]&(1<<uint(i)) == 0 {
+			break
+		}
+		n++
+	}
+	return n
+}
+
+// hasAddress 地址是否仍在本机接口上
+func hasAddress(addrs []string, addr string) bool {
+	for _, a := range addrs {
+		if a == addr {
+			return true
+		}
+	}
+	return false
+}
+
+// flapHistory 记录集各自的探测历史，默认记录集沿用原有的flap字段，租户记录集按cacheKey区分
+func flapHistory(rs recordSet) *FlapHistory {
+	if rs.cacheKey == "" {
+		if state.Flap == nil {
+			state.Flap = &FlapHistory{}
+		}
+		return state.Flap
+	}
+
+	if state.TenantFlap == nil {
+		state.TenantFlap = map[string]*FlapHistory{}
+	}
+	h := state.TenantFlap[rs.cacheKey]
+	if h == nil {
+		h = &FlapHistory{}
+		state.TenantFlap[rs.cacheKey] = h
+	}
+	return h
+}
+
+// flapWatch 抖动抑制需要确认是否仍可用的各地址族当前记录地址，未启用时返回nil
+func flapWatch(rs recordSet) map[string]string {
+	if !flapEnabled() {
+		return nil
+	}
+
+	watch := map[string]string{}
+	for family, recordType := range map[string]string{"ipv4": "A", "ipv6": "AAAA"} {
+		if current := state.Records[rs.cacheKey+recordType].Content; current != "" {
+			watch[family] = current
+		}
+	}
+	return watch
+}
+
+// holdReason 候选地址尚未满足连续验证轮数或当前记录的保持时间时返回暂缓原因，可以替换时返回空串
+func holdReason(h *FlapHistory, record CachedRecord, pick string) string {
+	streak := h.streak(pick)
+	remain := time.Duration(cfg.FlapDwell)*time.Second - time.Since(time.Unix(record.ChangedAt, 0))
+	if streak >= cfg.FlapConfirm && remain <= 0 {
+		return ""
+	}
+
+	reason := fmt.Sprintf("候选地址 %s 已连续验证%d/%d轮", pick, streak, cfg.FlapConfirm)
+	if remain > 0 {
+		reason += fmt.Sprintf("，当前记录还需保持%d秒", int(remain.Seconds()+0.5))
+	}
+	return reason
+}
+
+// dampAddresses 记录本轮探测结果，按迟滞规则决定记录集rs的各地址族发布哪个地址
+// watched为DetectAllIPs随首组探测的当前记录地址的结果
+// 返回允许发布的地址（顺序同successIPs）；全部暂缓时held为应继续使用的当前地址，notes为暂缓原因
+func dampAddresses(rs recordSet, ips map[string][]string, successIPs, failIPs, errorIPs [][2]string, watched map[string]bool) (allowed [][2]string, held, notes string) {
+	if !flapEnabled() {
+		return successIPs, "", ""
+	}
+
+	recordTypes := map[string]string{"ipv4": "A", "ipv6": "AAAA"}
+
+	var probed []string
+	verified := map[string]bool{}
+	for _, list := range [][][2]string{successIPs, failIPs, errorIPs} {
+		for _, r := range list {
+			probed = append(probed, r[1])
+		}
+	}
+	for _, r := range successIPs {
+		verified[r[1]] = true
+	}
+	// 更高优先级的地址成功后当前记录地址不计入检测结果，取它随首组探测的结果
+	for addr, ok := range watched {
+		if !hasAddress(probed, addr) {
+			probed = append(probed, addr)
+			verified[addr] = ok
+		}
+	}
+
+	h := flapHistory(rs)
+	h.record(probed, verified)
+
+	var deferred strings.Builder
+	for _, family := range []string{"ipv4", "ipv6"} {
+		var picks [][2]string
+		for _, r := range successIPs {
+			if r[0] == family {
+				picks = append(picks, r)
 			}
 		}
+		if len(picks) == 0 {
+			continue
+		}
+
+		record := state.Records[rs.cacheKey+recordTypes[family]]
+		current, pick := record.Content, picks[0][1]
+		keep := [2]string{family, current}
+
+		// 没有当前记录、地址未变或当前地址已从接口上移除时不做抑制
+		if current == "" || pick == current || !hasAddress(ips[family], current) {
+			allowed = append(allowed, picks...)
+			continue
+		}
+		if cfg.FlapSticky && verified[current] {
+			log.Printf("当前地址 %s 仍可用，保持不变，忽略候选地址 %s\n", current, pick)
+			allowed = append(allowed, keep)
+			continue
+		}
+
+		reason := holdReason(h, record, pick)
+		if reason == "" {
+			allowed = append(allowed, picks...)
+			continue
+		}
+		if verified[current] {
+			log.Printf("%s，暂时保持当前地址 %s\n", reason, current)
+			allowed = append(allowed, keep)
+			continue
+		}
+		log.Printf("%s，暂缓更新 %s\n", reason, current)
+		deferred.WriteString(fmt.Sprintf("类型=%s, 当前IP=%s, %s\n", family, current, reason))
+		if held == "" {
+			held = current
+		}
 	}
 
-	return successIPs, failIPs, errorIPs
+	if err := saveState(); err != nil {
+		log.Printf("写入状态文件失败: %v\n", err)
+	}
+	return allowed, held, deferred.String()
+}
+
+// dampTenant 租户地址只在上次验证的地址失效后才变化，按同样的迟滞规则决定是否替换租户记录，返回暂缓原因
+// C侧只在需要发布时调用，每次调用记为一轮
+func dampTenant(rs recordSet, recordType, pick string) string {
+	if !flapEnabled() {
+		return ""
+	}
+
+	h := flapHistory(rs)
+	h.record([]string{pick}, map[string]bool{pick: true})
+
+	record := state.Records[rs.cacheKey+recordType]
+	if record.Content == "" || record.Content == pick {
+		return ""
+	}
+	return holdReason(h, record, pick)
+}
+
+// attachSpans 把本轮记录的阶段耗时复制到结果中，超出容量的部分丢弃
+func attachSpans(result *C.DDNSResult) {
+	n := len(spans)
+	if n > C.DDNS_MAX_SPANS {
+		n = C.DDNS_MAX_SPANS
+	}
+	for i := 0; i < n; i++ {
+		result.spanStage[i] = C.int(spans[i].stage)
+		result.spanMicros[i] = C.longlong(spans[i].elapsed.Microseconds())
+	}
+	result.spanCount = C.int(n)
+}
+
+// attachServerTLS 把控制连接的TLS配置复制到结果中，供C侧检测库使用
+func attachServerTLS(result *C.DDNSResult) {
+	result.serverTLS = 0
+	if cfg.ServerTLS {
+		result.serverTLS = 1
+	}
+	result.serverCA = C.CString(cfg.ServerCA)
+	result.serverName = C.CString(cfg.ServerName)
 }
 
 // 以下是C语言可调用的接口
 //
 //export RunCloudflareDDNS
 func RunCloudflareDDNS() *C.DDNSResult {
+	spans = spans[:0]
+
 	// 获取系统IP
 	ips, err := GetSystemIPs()
 	if err != nil {
 		result := (*C.DDNSResult)(C.malloc(C.size_t(unsafe.Sizeof(C.DDNSResult{}))))
+		attachSpans(result)
 		result.result = C.CString(fmt.Sprintf("获取IP失败: %v", err))
 		result.serverIP = C.CString(cfg.ServerIP)
+		result.serverToken = C.CString(cfg.ServerToken)
+		attachServerTLS(result)
 		result.serverPort = C.int(cfg.ServerPort)
 		result.timeout = C.int(cfg.Timeout)
 		result.ipAddr = C.CString("")
 		return result
 	}
 
-	// 检测公共IP
-	successIPs, _, _ := DetectAllIPs(ips, cfg.ServerIP, cfg.ServerPort, cfg.Timeout)
+	// 检测公共IP，按抖动抑制规则筛选要发布的地址
+	rs := defaultRecordSet()
+	successIPs, failIPs, errorIPs, watched := DetectAllIPs(ips, cfg.ServerIP, cfg.ServerPort, cfg.Timeout, flapWatch(rs))
+	successIPs, heldIP, heldNotes := dampAddresses(rs, ips, successIPs, failIPs, errorIPs, watched)
 
 	// 分配结果结构体内存
 	result := (*C.DDNSResult)(C.malloc(C.size_t(unsafe.Sizeof(C.DDNSResult{}))))
 
 	// 设置服务器配置信息
 	result.serverIP = C.CString(cfg.ServerIP)
+	result.serverToken = C.CString(cfg.ServerToken)
+	attachServerTLS(result)
 	result.serverPort = C.int(cfg.ServerPort)
 	result.timeout = C.int(cfg.Timeout)
 
@@ -370,22 +1554,134 @@ func RunCloudflareDDNS() *C.DDNSResult {
 			finalResult.WriteString(fmt.Sprintf("类型=%s, IP=%s, 结果=%s\n", ipType, ipAddr, dnsResult))
 
 			if strings.Contains(dnsResult, "IP未改变") || strings.Contains(dnsResult, "成功") {
+				checkpointState(ipType, ipAddr)
 				result.result = C.CString(fmt.Sprintf("✅ 成功!\n%s", finalResult.String()))
 				result.ipAddr = C.CString(detectedIP)
+				attachSpans(result)
 				return result
 			}
 		}
 
 		result.result = C.CString(fmt.Sprintf("ℹ️ 执行完成:\n%s", finalResult.String()))
 		result.ipAddr = C.CString(detectedIP)
+		attachSpans(result)
+		return result
+	} else if heldNotes != "" {
+		// 返回当前地址：后台服务继续检测它，失效时再次调用本函数，候选地址的验证轮数随之累积
+		result.result = C.CString(fmt.Sprintf("⏸️ 地址变化待确认，暂不更新:\n%s", heldNotes))
+		result.ipAddr = C.CString(heldIP)
+		attachSpans(result)
 		return result
 	} else {
-		result.result = C.CString("❌ 没有检测到可用的公共IP地址")
+		result.result = C.CString("❌ 没有检测到可用的公共IP地址" + describeReflexive())
 		result.ipAddr = C.CString("")
+		attachSpans(result)
 		return result
 	}
 }
 
+// RestoreDDNSState 从状态文件恢复上次验证通过的结果，不访问网络
+// 没有可用状态（首次运行或配置已变化）时返回NULL，调用方需执行RunCloudflareDDNS
+//
+//export RestoreDDNSState
+func RestoreDDNSState() *C.DDNSResult {
+	if state.Address == "" || state.ServerIP != cfg.ServerIP || state.ServerPort != cfg.ServerPort {
+		return nil
+	}
+
+	verifiedAt := time.Unix(state.VerifiedAt, 0)
+
+	result := (*C.DDNSResult)(C.malloc(C.size_t(unsafe.Sizeof(C.DDNSResult{}))))
+	result.result = C.CString(fmt.Sprintf("已从状态文件恢复: %s (上次验证: %s)",
+		state.Address, verifiedAt.Format("2006-01-02 15:04:05")))
+	result.serverIP = C.CString(cfg.ServerIP)
+	result.serverToken = C.CString(cfg.ServerToken)
+	attachServerTLS(result)
+	result.serverPort = C.int(cfg.ServerPort)
+	result.timeout = C.int(cfg.Timeout)
+	result.ipAddr = C.CString(state.Address)
+	result.spanCount = 0
+	return result
+}
+
+// LoadDDNSConfig 只读取配置中的服务端参数，不访问网络也不更新DNS，ipAddr为空
+// 供重新exec出的后台进程使用：检测结果由父进程传入，无需再完整执行一次RunCloudflareDDNS
+//
+//export LoadDDNSConfig
+func LoadDDNSConfig() *C.DDNSResult {
+	result := (*C.DDNSResult)(C.malloc(C.size_t(unsafe.Sizeof(C.DDNSResult{}))))
+	result.result = C.CString("已读取配置")
+	result.serverIP = C.CString(cfg.ServerIP)
+	result.serverToken = C.CString(cfg.ServerToken)
+	attachServerTLS(result)
+	result.serverPort = C.int(cfg.ServerPort)
+	result.timeout = C.int(cfg.Timeout)
+	result.ipAddr = C.CString("")
+	result.spanCount = 0
+	return result
+}
+
+// TenantCount 配置的租户（网络命名空间）数
+//
+//export TenantCount
+func TenantCount() C.int {
+	return C.int(len(cfg.Tenants))
+}
+
+// TenantName 第index个租户的名称，调用方用free释放
+//
+//export TenantName
+func TenantName(index C.int) *C.char {
+	if index < 0 || int(index) >= len(cfg.Tenants) {
+		return nil
+	}
+	return C.CString(cfg.Tenants[index].Name)
+}
+
+// TenantNamespace 第index个租户的网络命名空间，调用方用free释放
+//
+//export TenantNamespace
+func TenantNamespace(index C.int) *C.char {
+	if index < 0 || int(index) >= len(cfg.Tenants) {
+		return nil
+	}
+	return C.CString(cfg.Tenants[index].Netns)
+}
+
+// PublishTenantAddress 把在租户命名空间中验证通过的地址写入该租户的记录
+// 与默认记录共用同一个HTTP客户端和状态文件，返回结果描述，调用方用free释放
+//
+//export PublishTenantAddress
+func PublishTenantAddress(index C.int, ip *C.char) *C.char {
+	if index < 0 || int(index) >= len(cfg.Tenants) {
+		return C.CString("错误: 无效的租户序号")
+	}
+
+	address := C.GoString(ip)
+	ipType := "A"
+	if strings.Contains(address, ":") {
+		ipType = "AAAA"
+	}
+
+	rs := tenantRecordSet(cfg.Tenants[index])
+	if reason := dampTenant(rs, ipType, address); reason != "" {
+		if err := saveState(); err != nil {
+			log.Printf("写入状态文件失败: %v\n", err)
+		}
+		// 不含“成功”，C侧保留待发布标记，下一轮继续计数
+		return C.CString("⏸️ 地址变化待确认，暂不更新: " + reason)
+	}
+
+	result, err := setRecordDNS(rs, ipType, address)
+	if err != nil {
+		result = fmt.Sprintf("错误: %v", err)
+	}
+	if err := saveState(); err != nil {
+		log.Printf("写入状态文件失败: %v\n", err)
+	}
+	return C.CString(result)
+}
+
 //export FreeDDNSResult
 func FreeDDNSResult(result *C.DDNSResult) {
 	if result != nil {
@@ -398,6 +1694,15 @@ func FreeDDNSResult(result *C.DDNSResult) {
 		if result.ipAddr != nil {
 			C.free(unsafe.Pointer(result.ipAddr))
 		}
+		if result.serverToken != nil {
+			C.free(unsafe.Pointer(result.serverToken))
+		}
+		if result.serverCA != nil {
+			C.free(unsafe.Pointer(result.serverCA))
+		}
+		if result.serverName != nil {
+			C.free(unsafe.Pointer(result.serverName))
+		}
 		C.free(unsafe.Pointer(result))
 	}
 }
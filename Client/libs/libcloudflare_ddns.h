@@ -22,14 +22,15 @@ extern const char *_GoStringPtr(_GoString_ s);
 
 
 #line 3 "cloudflare_ddns.go"
-
-
-
-
-
-
-#include "public_address_detector.h"
 #include <stdlib.h>
+// 耗时统计的阶段编号
+#define DDNS_STAGE_SYSTEM_IPS 0
+#define DDNS_STAGE_REFLEXIVE  1
+#define DDNS_STAGE_PROBE      2
+#define DDNS_STAGE_DNS_LOOKUP 3
+#define DDNS_STAGE_DNS_UPDATE 4
+#define DDNS_STAGE_COUNT      5
+#define DDNS_MAX_SPANS        32
 // 定义结构体，与C头文件中的一致
 typedef struct {
     char* result;
@@ -37,6 +38,13 @@ typedef struct {
     int   serverPort;
     int   timeout;
     char* ipAddr;
+    char* serverToken;
+    int   serverTLS;                        // 控制连接使用TLS
+    char* serverCA;                         // 校验服务端证书的CA文件，空为系统默认
+    char* serverName;                       // 服务端证书中的名称，空为按serverIP校验
+    int   spanCount;                        // 本次执行记录的阶段耗时个数
+    int   spanStage[DDNS_MAX_SPANS];        // DDNS_STAGE_*
+    long long spanMicros[DDNS_MAX_SPANS];   // 耗时（微秒，单调时钟）
 } DDNSResult;
 
 #line 1 "cgo-generated-wrapper"
@@ -105,6 +113,33 @@ extern "C" {
 // 以下是C语言可调用的接口
 //
 extern DDNSResult* RunCloudflareDDNS(void);
+
+// RestoreDDNSState 从状态文件恢复上次验证通过的结果，不访问网络
+// 没有可用状态（首次运行或配置已变化）时返回NULL，调用方需执行RunCloudflareDDNS
+//
+extern DDNSResult* RestoreDDNSState(void);
+
+// LoadDDNSConfig 只读取配置中的服务端参数，不访问网络也不更新DNS，ipAddr为空
+// 供重新exec出的后台进程使用：检测结果由父进程传入，无需再完整执行一次RunCloudflareDDNS
+//
+extern DDNSResult* LoadDDNSConfig(void);
+
+// TenantCount 配置的租户（网络命名空间）数
+//
+extern int TenantCount(void);
+
+// TenantName 第index个租户的名称，调用方用free释放
+//
+extern char* TenantName(int index);
+
+// TenantNamespace 第index个租户的网络命名空间，调用方用free释放
+//
+extern char* TenantNamespace(int index);
+
+// PublishTenantAddress 把在租户命名空间中验证通过的地址写入该租户的记录
+// 与默认记录共用同一个HTTP客户端和状态文件，返回结果描述，调用方用free释放
+//
+extern char* PublishTenantAddress(int index, char* ip);
 extern void FreeDDNSResult(DDNSResult* result);
 
 #ifdef __cplusplus
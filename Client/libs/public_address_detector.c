@@ -13,6 +13,8 @@
     #define inet_pton InetPtonA
     #define getaddrinfo getaddrinfo_win
     #define freeaddrinfo freeaddrinfo_win
+    #define MSG_NOSIGNAL 0
+    #define poll WSAPoll
 #else
     #include <unistd.h>
     #include <arpa/inet.h>
@@ -21,11 +23,33 @@
     #include <sys/types.h>
     #include <netdb.h>
     #include <errno.h>
+    #include <poll.h>
+    #include <pthread.h>
+    #include <signal.h>
+    #ifdef __linux__
+    #include <sys/epoll.h>
+    #include <fcntl.h>
+    #endif
+
+    // macOS没有MSG_NOSIGNAL
+    #ifndef MSG_NOSIGNAL
+    #define MSG_NOSIGNAL 0
+    #endif
+#endif
+
+// 控制连接TLS（以 -DDDNS_WITH_TLS 编译并链接 -lssl -lcrypto，仅POSIX平台）
+#if defined(DDNS_WITH_TLS) && !defined(_WIN32)
+    #define DETECTOR_TLS 1
+    #include <openssl/ssl.h>
+    #include <openssl/err.h>
+    #include <openssl/x509v3.h>
 #endif
 
 #include "public_address_detector.h"
 
 #define BUFFER_SIZE 1024
+#define TLS_TICKET_CACHE 4      // 缓存的会话票据数，每张只用一次
+#define ASYNC_EVENT_BATCH 64    // 异步检测每次epoll_wait处理的事件数
 
 // Windows下需要初始化Winsock
 #ifdef _WIN32
@@ -274,33 +298,235 @@ static int connect_to_server(const char *server_ip, int server_port) {
     return sockfd;
 }
 
-// 等待服务器连接
-static int wait_for_server_connection(int listen_fd, int timeout) {
+// 到服务端的控制连接，启用TLS时tls为对应的SSL对象
+typedef struct {
+    int fd;
+    void *tls;
+} ServerConn;
+
+// 调用过detector_set_tls后控制连接必须使用TLS，TLS不可用时连接失败而不是退回明文
+static int tls_requested = 0;
+
+#ifdef DETECTOR_TLS
+
+static struct {
+    pthread_mutex_t lock;
+    SSL_CTX *ctx;
+    char ca_file[256];
+    char server_name[256];
+    SSL_SESSION *tickets[TLS_TICKET_CACHE];  // 服务端签发的票据，后进先出
+    int ticket_count;
+} g_tls = { PTHREAD_MUTEX_INITIALIZER, NULL, "", "", { NULL }, 0 };
+
+// 服务端在握手后下发票据（TLS 1.3每次握手通常两张），保存供之后的连接恢复会话
+static int tls_new_session(SSL *ssl, SSL_SESSION *session) {
+    (void)ssl;
+
+    pthread_mutex_lock(&g_tls.lock);
+    if (g_tls.ticket_count == TLS_TICKET_CACHE) {
+        SSL_SESSION_free(g_tls.tickets[0]);
+        memmove(g_tls.tickets, g_tls.tickets + 1, (TLS_TICKET_CACHE - 1) * sizeof(SSL_SESSION *));
+        g_tls.ticket_count--;
+    }
+    g_tls.tickets[g_tls.ticket_count++] = session;
+    pthread_mutex_unlock(&g_tls.lock);
+    return 1;   // 保留引用
+}
+
+// 服务端开启了防重放，票据只能使用一次，取出后即从缓存中移除
+static SSL_SESSION *tls_take_ticket(void) {
+    SSL_SESSION *ticket = NULL;
+
+    if (g_tls.ticket_count > 0) {
+        ticket = g_tls.tickets[--g_tls.ticket_count];
+    }
+    return ticket;
+}
+
+static void tls_drop_tickets(void) {
+    while (g_tls.ticket_count > 0) {
+        SSL_SESSION_free(g_tls.tickets[--g_tls.ticket_count]);
+    }
+}
+
+// 为已连接的fd创建SSL对象；持有票据时恢复会话，*early为1表示票据允许发送early_len字节的0-RTT早期数据
+static SSL *tls_prepare(int fd, const char *server_ip, size_t early_len, int *early) {
+    char name[256];
+
+    pthread_mutex_lock(&g_tls.lock);
+    SSL *ssl = g_tls.ctx ? SSL_new(g_tls.ctx) : NULL;
+    SSL_SESSION *ticket = ssl ? tls_take_ticket() : NULL;
+    snprintf(name, sizeof(name), "%s", g_tls.server_name[0] ? g_tls.server_name : server_ip);
+    pthread_mutex_unlock(&g_tls.lock);
+
+    *early = 0;
+    if (!ssl) {
+        fprintf(stderr, "TLS is not available for %s\n", server_ip);
+        return NULL;
+    }
+    SSL_set_fd(ssl, fd);
+    SSL_set_connect_state(ssl);
+
+    // IP字面量按证书中的IP地址校验，域名同时用于SNI
+    if (get_ip_type(name)) {
+        X509_VERIFY_PARAM_set1_ip_asc(SSL_get0_param(ssl), name);
+    } else {
+        SSL_set_tlsext_host_name(ssl, name);
+        SSL_set1_host(ssl, name);
+    }
+
+    if (ticket) {
+        SSL_set_session(ssl, ticket);
+        *early = early_len > 0 && SSL_SESSION_get_max_early_data(ticket) >= early_len;
+        SSL_SESSION_free(ticket);
+    }
+    return ssl;
+}
+
+// 在已连接的fd上完成TLS握手，恢复会话时把first作为0-RTT早期数据随ClientHello发出
+// 早期数据被服务端接受时*sent为1，否则调用方需在握手后重新发送
+static int tls_connect(ServerConn *conn, const char *server_ip, const char *first, size_t first_len, int *sent) {
+    int early;
+    SSL *ssl = tls_prepare(conn->fd, server_ip, first ? first_len : 0, &early);
+    if (!ssl) {
+        return -1;
+    }
+
+    *sent = 0;
+    size_t written = 0;
+    if (early && SSL_write_early_data(ssl, first, first_len, &written) == 1) {
+        *sent = 1;
+    }
+
+    if (SSL_connect(ssl) != 1) {
+        fprintf(stderr, "TLS handshake with %s failed\n", server_ip);
+        ERR_print_errors_fp(stderr);
+        SSL_free(ssl);
+        return -1;
+    }
+    // 服务端拒绝早期数据（票据已用过、服务端重启等）时握手退化为1-RTT，请求需重发
+    if (*sent && SSL_get_early_data_status(ssl) != SSL_EARLY_DATA_ACCEPTED) {
+        *sent = 0;
+    }
+
+    conn->tls = ssl;
+    return 0;
+}
+
+#endif
+
+static int server_send(ServerConn *conn, const char *msg, size_t len) {
+#ifdef DETECTOR_TLS
+    if (conn->tls) {
+        size_t written = 0;
+        return SSL_write_ex(conn->tls, msg, len, &written) == 1 ? 0 : -1;
+    }
+#endif
+    return send(conn->fd, msg, (int)len, MSG_NOSIGNAL) == (int)len ? 0 : -1;
+}
+
+// 与recv语义一致：返回读到的字节数，对端关闭返回0，出错返回-1
+static int server_recv(ServerConn *conn, char *buf, size_t len) {
+#ifdef DETECTOR_TLS
+    if (conn->tls) {
+        size_t n = 0;
+        int ret = SSL_read_ex(conn->tls, buf, len, &n);
+        if (ret == 1) {
+            return (int)n;
+        }
+        return SSL_get_error(conn->tls, ret) == SSL_ERROR_ZERO_RETURN ? 0 : -1;
+    }
+#endif
+    return recv(conn->fd, buf, (int)len, 0);
+}
+
+// TLS层是否还有已解密未读取的数据（此时poll不会报告可读）
+static int server_pending(ServerConn *conn) {
+#ifdef DETECTOR_TLS
+    if (conn->tls) {
+        return SSL_pending(conn->tls) > 0;
+    }
+#else
+    (void)conn;
+#endif
+    return 0;
+}
+
+static void server_close(ServerConn *conn) {
+#ifdef DETECTOR_TLS
+    if (conn->tls) {
+        SSL_shutdown(conn->tls);
+        SSL_free(conn->tls);
+    }
+#endif
+    close(conn->fd);
+}
+
+// 连接服务端并发送首条消息，timeout为读取响应的超时（秒）
+static int server_open(ServerConn *conn, const char *server_ip, int server_port, int timeout, const char *first) {
+    size_t first_len = first ? strlen(first) : 0;
+    int sent = 0;
+
+    conn->tls = NULL;
+    conn->fd = connect_to_server(server_ip, server_port);
+    if (conn->fd < 0) {
+        return -1;
+    }
+
+    // 服务端积压时不无限等待响应，超过截止时间即放弃
+#ifdef _WIN32
+    DWORD recv_timeout = timeout * 1000;
+    setsockopt(conn->fd, SOL_SOCKET, SO_RCVTIMEO, (const char *)&recv_timeout, sizeof(recv_timeout));
+#else
+    struct timeval recv_timeout = { timeout, 0 };
+    setsockopt(conn->fd, SOL_SOCKET, SO_RCVTIMEO, &recv_timeout, sizeof(recv_timeout));
+#endif
+
+    if (tls_requested) {
+#ifdef DETECTOR_TLS
+        if (tls_connect(conn, server_ip, first, first_len, &sent) < 0) {
+            close(conn->fd);
+            return -1;
+        }
+#else
+        fprintf(stderr, "TLS requested but the detector was built without TLS support\n");
+        close(conn->fd);
+        return -1;
+#endif
+    }
+
+    if (first && !sent && server_send(conn, first, first_len) < 0) {
+#ifdef _WIN32
+        fprintf(stderr, "Send failed: %d\n", WSAGetLastError());
+#else
+        perror("Send failed");
+#endif
+        server_close(conn);
+        return -1;
+    }
+    return 0;
+}
+
+// 等待服务器连接，value不为NULL时存入收到的随机值
+static int wait_for_server_connection(int listen_fd, int timeout, char *value, size_t value_len) {
     int server_conn_fd;
     struct sockaddr_storage server_addr;
     socklen_t addr_len = sizeof(server_addr);
     char buffer[BUFFER_SIZE];
 
-    // 设置accept超时
-    fd_set read_fds;
-    struct timeval tv;
+    // 设置accept超时，poll不受FD_SETSIZE限制
+    struct pollfd pfd = { listen_fd, POLLIN, 0 };
 
-    FD_ZERO(&read_fds);
-    FD_SET(listen_fd, &read_fds);
+    int poll_result = poll(&pfd, 1, timeout * 1000);
 
-    tv.tv_sec = timeout;
-    tv.tv_usec = 0;
-
-    int select_result = select(listen_fd + 1, &read_fds, NULL, NULL, &tv);
-
-    if (select_result < 0) {
+    if (poll_result < 0) {
 #ifdef _WIN32
-        fprintf(stderr, "select failed: %d\n", WSAGetLastError());
+        fprintf(stderr, "poll failed: %d\n", WSAGetLastError());
 #else
-        perror("select failed");
+        perror("poll failed");
 #endif
         return -1;
-    } else if (select_result == 0) {
+    } else if (poll_result == 0) {
         return -1; // 超时
     }
 
@@ -322,12 +548,94 @@ static int wait_for_server_connection(int listen_fd, int timeout) {
     close(server_conn_fd);
 
     if (bytes_received > 0) {
+        if (value) {
+            snprintf(value, value_len, "%s", buffer);
+        }
         return 0; // 成功
     } else {
         return -1; // 失败
     }
 }
 
+// 构造探测请求，"syn"表示接受服务端以SYN-ACK直接确认可达
+// "budget"为客户端愿意等待的毫秒数，服务端据此排序并丢弃已无人等待的探测
+static void format_probe_request(const char *client_ip, int listening_port, int timeout,
+                                 char *message, size_t len) {
+    if (get_ip_type(client_ip) == AF_INET6 && client_ip[0] != '[') {
+        snprintf(message, len, "[%s]:%d syn budget=%d", client_ip, listening_port, timeout * 1000);
+    } else {
+        snprintf(message, len, "%s:%d syn budget=%d", client_ip, listening_port, timeout * 1000);
+    }
+}
+
+// 根据服务端响应完成探测，成功返回1；value不为NULL时存入回连收到的随机值
+static int finish_probe(const char *response, int listen_fd, int timeout, char *value, size_t value_len) {
+    if (strstr(response, "VERIFIED") != NULL) {
+        // 服务端已通过SYN-ACK确认端口可达，无需等待回连
+        return 1;
+    }
+    if (strstr(response, "SUCCESS") != NULL) {
+        // 等待服务器连接并发送随机值
+        return wait_for_server_connection(listen_fd, timeout, value, value_len) == 0;
+    }
+    return 0;
+}
+
+int detector_set_tls(const char* ca_file, const char* server_name) {
+    tls_requested = 1;
+#ifdef DETECTOR_TLS
+    ca_file = ca_file ? ca_file : "";
+    server_name = server_name ? server_name : "";
+
+    pthread_mutex_lock(&g_tls.lock);
+    int unchanged = g_tls.ctx && strcmp(g_tls.ca_file, ca_file) == 0 &&
+                    strcmp(g_tls.server_name, server_name) == 0;
+    pthread_mutex_unlock(&g_tls.lock);
+    if (unchanged) {
+        return 0;
+    }
+
+    // 对端关闭后写入close_notify不能终止进程
+    struct sigaction sa;
+    if (sigaction(SIGPIPE, NULL, &sa) == 0 && sa.sa_handler == SIG_DFL) {
+        signal(SIGPIPE, SIG_IGN);
+    }
+
+    SSL_CTX *ctx = SSL_CTX_new(TLS_client_method());
+    if (ctx) {
+        SSL_CTX_set_min_proto_version(ctx, TLS1_3_VERSION);
+        SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER, NULL);
+        // 票据由回调保存，不使用OpenSSL内部的会话缓存
+        SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+        SSL_CTX_sess_set_new_cb(ctx, tls_new_session);
+
+        int loaded = ca_file[0] ? SSL_CTX_load_verify_locations(ctx, ca_file, NULL)
+                                : SSL_CTX_set_default_verify_paths(ctx);
+        if (loaded != 1) {
+            fprintf(stderr, "Failed to load TLS CA %s\n", ca_file[0] ? ca_file : "(system default)");
+            ERR_print_errors_fp(stderr);
+            SSL_CTX_free(ctx);
+            ctx = NULL;
+        }
+    }
+
+    // 正在握手的连接持有旧SSL_CTX的引用，可以直接替换
+    pthread_mutex_lock(&g_tls.lock);
+    SSL_CTX_free(g_tls.ctx);
+    g_tls.ctx = ctx;
+    snprintf(g_tls.ca_file, sizeof(g_tls.ca_file), "%s", ca_file);
+    snprintf(g_tls.server_name, sizeof(g_tls.server_name), "%s", server_name);
+    tls_drop_tickets();
+    pthread_mutex_unlock(&g_tls.lock);
+
+    return ctx ? 0 : -1;
+#else
+    (void)ca_file; (void)server_name;
+    fprintf(stderr, "TLS requested but the detector was built without TLS support\n");
+    return -1;
+#endif
+}
+
 // 初始化函数
 int detector_init(void) {
 #ifdef _WIN32
@@ -351,7 +659,8 @@ DetectionResult detect_public_address(const char* client_ip, const char* server_
                                      int server_port, int timeout) {
     DetectionResult result = {0};
     int listening_port;
-    int listen_fd = -1, server_fd = -1;
+    int listen_fd = -1;
+    ServerConn server;
 
     // 在用户指定的IP地址上创建监听socket
     listen_fd = create_listening_socket(client_ip, &listening_port);
@@ -361,29 +670,11 @@ DetectionResult detect_public_address(const char* client_ip, const char* server_
         return result;
     }
 
-    // 连接到服务器
-    server_fd = connect_to_server(server_ip, server_port);
-    if (server_fd < 0) {
-        close(listen_fd);
-        result.success = 0;
-        return result;
-    }
-
-    // 发送客户端的IP和端口到服务器
+    // 连接到服务器并发送客户端的IP和端口，TLS恢复会话时请求随握手以0-RTT发出
     char message[BUFFER_SIZE];
-    if (get_ip_type(client_ip) == AF_INET6 && client_ip[0] != '[') {
-        snprintf(message, sizeof(message), "[%s]:%d", client_ip, listening_port);
-    } else {
-        snprintf(message, sizeof(message), "%s:%d", client_ip, listening_port);
-    }
+    format_probe_request(client_ip, listening_port, timeout, message, sizeof(message));
 
-    if (send(server_fd, message, strlen(message), 0) < 0) {
-#ifdef _WIN32
-        fprintf(stderr, "Send failed: %d\n", WSAGetLastError());
-#else
-        perror("Send failed");
-#endif
-        close(server_fd);
+    if (server_open(&server, server_ip, server_port, timeout, message) < 0) {
         close(listen_fd);
         result.success = 0;
         return result;
@@ -392,31 +683,905 @@ DetectionResult detect_public_address(const char* client_ip, const char* server_
     // 接收服务器的初始响应
     char response[BUFFER_SIZE];
     memset(response, 0, sizeof(response));
-    int bytes_received = recv(server_fd, response, sizeof(response) - 1, 0);
+    int bytes_received = server_recv(&server, response, sizeof(response) - 1);
 
     if (bytes_received > 0) {
         response[bytes_received] = '\0';
 
-        if (strstr(response, "SUCCESS") != NULL) {
-            // 等待服务器连接并发送随机值
-            if (wait_for_server_connection(listen_fd, timeout) == 0) {
-                result.success = 1;
-            } else {
-                result.success = 0;
-            }
-        } else {
-            result.success = 0;
-        }
+        result.success = finish_probe(response, listen_fd, timeout, NULL, 0);
     } else {
         result.success = 0;
     }
 
     // 清理
-    if (server_fd >= 0) close(server_fd);
+    server_close(&server);
     if (listen_fd >= 0) close(listen_fd);
 
     return result;
 }
 
 
-//gcc -fPIC -shared -o libpublic_address_detector.so public_address_detector.c -I. -lpthread
\ No newline at end of file
+#ifndef _WIN32
+
+#define SESSION_MAILBOX 16      // 同时等待结果的探测数上限
+#define SESSION_READ_SLICE_MS 100
+
+// 长连接会话
+struct DetectorSession {
+    ServerConn conn;
+    int closed;
+    int reverify_pending;
+    unsigned int next_tag;
+    pthread_mutex_t lock;       // 保护以下读缓冲和暂存结果，以及套接字写入
+    char inbuf[BUFFER_SIZE];
+    size_t inlen;
+    struct {
+        int used;               // 有探测在等待该标签
+        int done;               // 结果已到达
+        unsigned int tag;
+        char response[128];
+    } mailbox[SESSION_MAILBOX];
+};
+
+static long long session_now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int session_send(DetectorSession *session, const char *msg) {
+    if (server_send(&session->conn, msg, strlen(msg)) < 0) {
+        session->closed = 1;
+        return -1;
+    }
+    return 0;
+}
+
+// 读取一行（需持有锁），返回1读到一行，0超时，-1连接断开
+static int session_read_line(DetectorSession *session, char *line, size_t len, int timeout_ms) {
+    for (;;) {
+        char *nl = memchr(session->inbuf, '\n', session->inlen);
+        if (nl) {
+            size_t n = (size_t)(nl - session->inbuf);
+            size_t copy = n < len - 1 ? n : len - 1;
+            memcpy(line, session->inbuf, copy);
+            line[copy] = '\0';
+            if (copy > 0 && line[copy - 1] == '\r') {
+                line[copy - 1] = '\0';
+            }
+            session->inlen -= n + 1;
+            memmove(session->inbuf, nl + 1, session->inlen);
+            return 1;
+        }
+
+        if (session->closed || session->inlen >= sizeof(session->inbuf)) {
+            session->closed = 1;
+            return -1;
+        }
+
+        if (!server_pending(&session->conn)) {
+            struct pollfd pfd = { session->conn.fd, POLLIN, 0 };
+            int ready = poll(&pfd, 1, timeout_ms);
+            if (ready < 0 && errno != EINTR) {
+                session->closed = 1;
+                return -1;
+            }
+            if (ready <= 0) {
+                return 0;
+            }
+        }
+
+        int n = server_recv(&session->conn, session->inbuf + session->inlen,
+                            sizeof(session->inbuf) - session->inlen);
+        if (n <= 0) {
+            session->closed = 1;
+            return -1;
+        }
+        session->inlen += (size_t)n;
+        timeout_ms = 0;
+    }
+}
+
+// 为标签登记等待槽位（需持有锁），槽位用尽时返回-1
+static int session_expect(DetectorSession *session, unsigned int tag) {
+    for (int i = 0; i < SESSION_MAILBOX; i++) {
+        if (!session->mailbox[i].used) {
+            session->mailbox[i].used = 1;
+            session->mailbox[i].done = 0;
+            session->mailbox[i].tag = tag;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// 放弃等待标签（需持有锁），之后到达的结果直接丢弃
+static void session_forget(DetectorSession *session, unsigned int tag) {
+    for (int i = 0; i < SESSION_MAILBOX; i++) {
+        if (session->mailbox[i].used && session->mailbox[i].tag == tag) {
+            session->mailbox[i].used = 0;
+        }
+    }
+}
+
+// 处理一行服务端消息（需持有锁），结果放入等待该标签的槽位
+// 等待方已超时放弃的迟到结果（服务端截止后才回复的ERROR等）没有槽位，直接丢弃
+static void session_dispatch(DetectorSession *session, const char *line) {
+    if (strncmp(line, "RESULT ", 7) == 0) {
+        char *end;
+        unsigned int tag = (unsigned int)strtoul(line + 7, &end, 10);
+        for (int i = 0; i < SESSION_MAILBOX; i++) {
+            if (session->mailbox[i].used && !session->mailbox[i].done &&
+                session->mailbox[i].tag == tag) {
+                session->mailbox[i].done = 1;
+                snprintf(session->mailbox[i].response, sizeof(session->mailbox[i].response),
+                         "%s", *end == ' ' ? end + 1 : end);
+                return;
+            }
+        }
+    } else if (strncmp(line, "REVERIFY", 8) == 0) {
+        session->reverify_pending = 1;
+    }
+}
+
+// 从暂存区取出指定标签的结果（需持有锁）
+static int session_take_result(DetectorSession *session, unsigned int tag, char *response, size_t len) {
+    for (int i = 0; i < SESSION_MAILBOX; i++) {
+        if (session->mailbox[i].used && session->mailbox[i].done && session->mailbox[i].tag == tag) {
+            strncpy(response, session->mailbox[i].response, len - 1);
+            response[len - 1] = '\0';
+            session->mailbox[i].used = 0;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// 发送一条带标签的请求并等待该标签的结果，截止时间前没有结果时放弃该标签，成功返回1
+static int session_request(DetectorSession *session, unsigned int tag, const char *message,
+                           long long deadline, char *response, size_t len) {
+    char line[BUFFER_SIZE];
+    int got = 0;
+
+    pthread_mutex_lock(&session->lock);
+    int sent = session_expect(session, tag);
+    if (sent == 0) {
+        sent = session_send(session, message);
+    } else {
+        fprintf(stderr, "Too many probes in flight on session\n");
+    }
+    pthread_mutex_unlock(&session->lock);
+
+    // 分片等待结果，期间其他线程也可读取并暂存各自的结果
+    while (sent == 0 && !got) {
+        long long remaining = deadline - session_now_ms();
+        if (remaining <= 0) {
+            break;
+        }
+
+        pthread_mutex_lock(&session->lock);
+        got = session_take_result(session, tag, response, len);
+        if (!got) {
+            int slice = remaining < SESSION_READ_SLICE_MS ? (int)remaining : SESSION_READ_SLICE_MS;
+            int r = session_read_line(session, line, sizeof(line), slice);
+            if (r == 1) {
+                session_dispatch(session, line);
+                got = session_take_result(session, tag, response, len);
+            } else if (r < 0) {
+                pthread_mutex_unlock(&session->lock);
+                break;
+            }
+        }
+        pthread_mutex_unlock(&session->lock);
+    }
+
+    if (!got) {
+        pthread_mutex_lock(&session->lock);
+        session_forget(session, tag);
+        pthread_mutex_unlock(&session->lock);
+    }
+    return got;
+}
+
+DetectorSession* detector_session_open(const char* server_ip, int server_port,
+                                       const char* client_id, const char* token, int timeout) {
+    char message[BUFFER_SIZE];
+    char line[BUFFER_SIZE];
+
+    if (token && token[0]) {
+        snprintf(message, sizeof(message), "SESSION %s %s\n", client_id, token);
+    } else {
+        snprintf(message, sizeof(message), "SESSION %s\n", client_id);
+    }
+
+    DetectorSession *session = calloc(1, sizeof(*session));
+    if (!session) {
+        return NULL;
+    }
+    // 握手消息随连接发出，重连时可作为0-RTT早期数据
+    if (server_open(&session->conn, server_ip, server_port, timeout, message) < 0) {
+        free(session);
+        return NULL;
+    }
+    pthread_mutex_init(&session->lock, NULL);
+
+    // 依赖TCP保活发现长时间静默期间的断线
+    int on = 1;
+    setsockopt(session->conn.fd, SOL_SOCKET, SO_KEEPALIVE, &on, sizeof(on));
+
+    // 旧版服务端会把握手当作无效地址并返回ERROR
+    if (session_read_line(session, line, sizeof(line), timeout * 1000) != 1 ||
+        strncmp(line, "OK SESSION", 10) != 0) {
+        detector_session_close(session);
+        return NULL;
+    }
+
+    return session;
+}
+
+DetectionResult detector_session_probe(DetectorSession* session, const char* client_ip, int timeout) {
+    return detector_session_probe_named(session, client_ip, NULL, timeout);
+}
+
+DetectionResult detector_session_probe_named(DetectorSession* session, const char* client_ip,
+                                             const char* name, int timeout) {
+    DetectionResult result = {0};
+    char message[BUFFER_SIZE];
+    char request[INET6_ADDRSTRLEN + 128];
+    char response[BUFFER_SIZE];
+    char proof[64] = "";
+    int listening_port;
+
+    int listen_fd = create_listening_socket(client_ip, &listening_port);
+    if (listen_fd < 0) {
+        fprintf(stderr, "Failed to create listening socket\n");
+        return result;
+    }
+
+    format_probe_request(client_ip, listening_port, timeout, request, sizeof(request));
+    // 请求以空格分隔选项，带空白的名字无法发布
+    if (name && name[0] && name[strcspn(name, " \t\r\n")] == '\0') {
+        size_t used = strlen(request);
+        snprintf(request + used, sizeof(request) - used, " name=%s", name);
+    }
+
+    pthread_mutex_lock(&session->lock);
+    unsigned int tag = ++session->next_tag;
+    pthread_mutex_unlock(&session->lock);
+
+    snprintf(message, sizeof(message), "PROBE %u %s\n", tag, request);
+    long long deadline = session_now_ms() + (long long)timeout * 1000;
+    if (session_request(session, tag, message, deadline, response, sizeof(response))) {
+        result.success = finish_probe(response, listen_fd, timeout, proof, sizeof(proof));
+
+        // 服务端要发布的地址与会话来源不同：回传回连收到的随机值，证明确实在该地址上，服务端随后才发布
+        if (result.success && strstr(response, "CONFIRM") != NULL) {
+            snprintf(message, sizeof(message), "CONFIRM %u %s\n", tag, proof);
+            result.success = session_request(session, tag, message, deadline, response, sizeof(response)) &&
+                             strncmp(response, "PUBLISHED", 9) == 0;
+        }
+    }
+
+    close(listen_fd);
+    return result;
+}
+
+int detector_session_wait_event(DetectorSession* session, int timeout_ms) {
+    char line[BUFFER_SIZE];
+    long long deadline = session_now_ms() + timeout_ms;
+    int event = DETECTOR_EVENT_NONE;
+
+    pthread_mutex_lock(&session->lock);
+    for (;;) {
+        if (session->reverify_pending) {
+            session->reverify_pending = 0;
+            event = DETECTOR_EVENT_REVERIFY;
+            break;
+        }
+        if (session->closed) {
+            event = DETECTOR_EVENT_CLOSED;
+            break;
+        }
+
+        long long remaining = deadline - session_now_ms();
+        if (remaining <= 0) {
+            break;
+        }
+
+        // 持锁等待时每个分片后让出锁，避免阻塞并发的探测
+        int slice = remaining < SESSION_READ_SLICE_MS * 10 ? (int)remaining : SESSION_READ_SLICE_MS * 10;
+        if (session_read_line(session, line, sizeof(line), slice) == 1) {
+            session_dispatch(session, line);
+        }
+        pthread_mutex_unlock(&session->lock);
+        pthread_mutex_lock(&session->lock);
+    }
+    pthread_mutex_unlock(&session->lock);
+    return event;
+}
+
+void detector_session_close(DetectorSession* session) {
+    if (!session) {
+        return;
+    }
+    if (!session->closed) {
+        server_send(&session->conn, "QUIT\n", 5);
+    }
+    server_close(&session->conn);
+    pthread_mutex_destroy(&session->lock);
+    free(session);
+}
+
+#else
+
+// Windows下暂不支持会话，调用方退回一次性检测
+DetectorSession* detector_session_open(const char* server_ip, int server_port,
+                                       const char* client_id, const char* token, int timeout) {
+    (void)server_ip; (void)server_port; (void)client_id; (void)token; (void)timeout;
+    return NULL;
+}
+
+DetectionResult detector_session_probe(DetectorSession* session, const char* client_ip, int timeout) {
+    DetectionResult result = {0};
+    (void)session; (void)client_ip; (void)timeout;
+    return result;
+}
+
+DetectionResult detector_session_probe_named(DetectorSession* session, const char* client_ip,
+                                             const char* name, int timeout) {
+    (void)name;
+    return detector_session_probe(session, client_ip, timeout);
+}
+
+int detector_session_wait_event(DetectorSession* session, int timeout_ms) {
+    (void)session;
+    Sleep(timeout_ms);
+    return DETECTOR_EVENT_NONE;
+}
+
+void detector_session_close(DetectorSession* session) {
+    (void)session;
+}
+
+#endif
+
+
+#ifdef __linux__
+
+// 异步探测的状态，每个状态只在一个fd上等待一种事件
+enum {
+    ASYNC_CONNECTING,       // 等待非阻塞connect完成
+    ASYNC_HANDSHAKE,        // TLS握手，恢复会话时请求随ClientHello发出
+    ASYNC_SENDING,          // 发送探测请求
+    ASYNC_RESPONSE,         // 等待服务端响应
+    ASYNC_CALLBACK,         // 等待服务端回连监听端口
+    ASYNC_VALUE             // 等待回连发来随机值
+};
+
+typedef struct {
+    int id;
+    int state;
+    long long deadline;             // 截止时间（CLOCK_MONOTONIC毫秒）
+    char client_ip[64];
+    int listen_fd;
+    int callback_fd;
+    ServerConn server;
+    struct addrinfo *addr;          // 正在尝试的服务端地址
+    int watched_fd;                 // 当前注册到epoll的fd及事件
+    unsigned int watched_events;
+    char request[BUFFER_SIZE];
+    size_t request_len;
+    size_t request_sent;
+    int early;                      // TLS 0-RTT：1为待发送，2为已随ClientHello发出
+} AsyncProbe;
+
+// 异步检测上下文：所有探测的fd注册在同一个epoll实例上，由调用方线程驱动
+struct DetectorContext {
+    int epoll_fd;
+    char server_ip[256];
+    int server_port;
+    struct addrinfo *addrs;         // 服务端地址，创建时解析一次
+    int next_id;
+    AsyncProbe **pending;
+    int pending_count;
+    int pending_cap;
+    DetectorProbeResult *done;      // 已结束、尚未被collect取走的结果
+    int done_count;
+    int done_cap;
+};
+
+// 让探测只在fd上等待events，fd变化时先撤下之前注册的fd
+static void async_watch(DetectorContext *ctx, AsyncProbe *p, int fd, unsigned int events) {
+    struct epoll_event ev;
+
+    if (p->watched_fd == fd && p->watched_events == events) {
+        return;
+    }
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.ptr = p;
+    if (p->watched_fd == fd) {
+        epoll_ctl(ctx->epoll_fd, EPOLL_CTL_MOD, fd, &ev);
+    } else {
+        if (p->watched_fd >= 0) {
+            epoll_ctl(ctx->epoll_fd, EPOLL_CTL_DEL, p->watched_fd, NULL);
+        }
+        epoll_ctl(ctx->epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+    }
+    p->watched_fd = fd;
+    p->watched_events = events;
+}
+
+static void async_unwatch(DetectorContext *ctx, AsyncProbe *p) {
+    if (p->watched_fd >= 0) {
+        epoll_ctl(ctx->epoll_fd, EPOLL_CTL_DEL, p->watched_fd, NULL);
+        p->watched_fd = -1;
+    }
+}
+
+static void async_close_server(DetectorContext *ctx, AsyncProbe *p) {
+    if (p->server.fd >= 0) {
+        if (p->watched_fd == p->server.fd) {
+            async_unwatch(ctx, p);
+        }
+        server_close(&p->server);
+        p->server.fd = -1;
+        p->server.tls = NULL;
+    }
+}
+
+// 结束探测：释放其fd，结果留给detector_ctx_collect
+static void async_finish(DetectorContext *ctx, AsyncProbe *p, int success) {
+    async_unwatch(ctx, p);
+    async_close_server(ctx, p);
+    if (p->callback_fd >= 0) close(p->callback_fd);
+    if (p->listen_fd >= 0) close(p->listen_fd);
+
+    if (ctx->done_count == ctx->done_cap) {
+        int cap = ctx->done_cap ? ctx->done_cap * 2 : 8;
+        DetectorProbeResult *done = realloc(ctx->done, cap * sizeof(*done));
+        if (done) {
+            ctx->done = done;
+            ctx->done_cap = cap;
+        }
+    }
+    if (ctx->done_count < ctx->done_cap) {
+        DetectorProbeResult *r = &ctx->done[ctx->done_count++];
+        r->id = p->id;
+        r->success = success;
+        snprintf(r->client_ip, sizeof(r->client_ip), "%s", p->client_ip);
+    }
+
+    for (int i = 0; i < ctx->pending_count; i++) {
+        if (ctx->pending[i] == p) {
+            ctx->pending[i] = ctx->pending[--ctx->pending_count];
+            break;
+        }
+    }
+    free(p);
+}
+
+// 从p->addr起依次向服务端地址发起非阻塞连接，全部失败时返回-1
+static int async_connect(DetectorContext *ctx, AsyncProbe *p) {
+    for (; p->addr != NULL; p->addr = p->addr->ai_next) {
+        int fd = socket(p->addr->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, p->addr->ai_protocol);
+        if (fd < 0) {
+            continue;
+        }
+        if (connect(fd, p->addr->ai_addr, p->addr->ai_addrlen) == 0 || errno == EINPROGRESS) {
+            p->server.fd = fd;
+            p->state = ASYNC_CONNECTING;
+            async_watch(ctx, p, fd, EPOLLOUT);
+            return 0;
+        }
+        close(fd);
+    }
+    fprintf(stderr, "Could not connect to server at %s:%d\n", ctx->server_ip, ctx->server_port);
+    return -1;
+}
+
+#ifdef DETECTOR_TLS
+// SSL调用需要等待的事件，0表示出错
+static unsigned int async_tls_want(SSL *ssl, int ret) {
+    switch (SSL_get_error(ssl, ret)) {
+    case SSL_ERROR_WANT_READ:
+        return EPOLLIN;
+    case SSL_ERROR_WANT_WRITE:
+        return EPOLLOUT;
+    default:
+        return 0;
+    }
+}
+#endif
+
+// 非阻塞收发控制连接：需要等待时返回-1并在*wait中给出等待的事件，出错时*wait为0
+static ssize_t async_send(ServerConn *conn, const char *buf, size_t len, unsigned int *wait) {
+    *wait = 0;
+#ifdef DETECTOR_TLS
+    if (conn->tls) {
+        size_t n = 0;
+        ERR_clear_error();
+        int ret = SSL_write_ex(conn->tls, buf, len, &n);
+        if (ret == 1) {
+            return (ssize_t)n;
+        }
+        *wait = async_tls_want(conn->tls, ret);
+        return -1;
+    }
+#endif
+    ssize_t n = send(conn->fd, buf, len, MSG_NOSIGNAL);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+        *wait = EPOLLOUT;
+    }
+    return n;
+}
+
+static ssize_t async_recv(ServerConn *conn, char *buf, size_t len, unsigned int *wait) {
+    *wait = 0;
+#ifdef DETECTOR_TLS
+    if (conn->tls) {
+        size_t n = 0;
+        ERR_clear_error();
+        int ret = SSL_read_ex(conn->tls, buf, len, &n);
+        if (ret == 1) {
+            return (ssize_t)n;
+        }
+        if (SSL_get_error(conn->tls, ret) == SSL_ERROR_ZERO_RETURN) {
+            return 0;
+        }
+        *wait = async_tls_want(conn->tls, ret);
+        return -1;
+    }
+#endif
+    ssize_t n = recv(conn->fd, buf, len, 0);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+        *wait = EPOLLIN;
+    }
+    return n;
+}
+
+// 推进探测，直到需要等待I/O或探测结束
+// 每次先尝试操作再注册等待：TLS层可能已缓存了解密后的数据，此时fd不会再报告可读
+static void async_advance(DetectorContext *ctx, AsyncProbe *p) {
+    unsigned int wait;
+    ssize_t n;
+
+    for (;;) {
+        switch (p->state) {
+        case ASYNC_CONNECTING: {
+            int err = 0;
+            socklen_t len = sizeof(err);
+            if (getsockopt(p->server.fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err != 0) {
+                // 换下一个服务端地址
+                async_close_server(ctx, p);
+                p->addr = p->addr->ai_next;
+                if (async_connect(ctx, p) < 0) {
+                    async_finish(ctx, p, 0);
+                }
+                return;
+            }
+            if (!tls_requested) {
+                p->state = ASYNC_SENDING;
+                break;
+            }
+#ifdef DETECTOR_TLS
+            p->server.tls = tls_prepare(p->server.fd, ctx->server_ip, p->request_len, &p->early);
+            if (!p->server.tls) {
+                async_finish(ctx, p, 0);
+                return;
+            }
+            p->state = ASYNC_HANDSHAKE;
+            break;
+#else
+            fprintf(stderr, "TLS requested but the detector was built without TLS support\n");
+            async_finish(ctx, p, 0);
+            return;
+#endif
+        }
+
+        case ASYNC_HANDSHAKE: {
+#ifdef DETECTOR_TLS
+            SSL *ssl = p->server.tls;
+            int ret;
+
+            ERR_clear_error();
+            if (p->early == 1) {
+                size_t written = 0;
+                ret = SSL_write_early_data(ssl, p->request, p->request_len, &written);
+                if (ret != 1) {
+                    if ((wait = async_tls_want(ssl, ret)) != 0) {
+                        async_watch(ctx, p, p->server.fd, wait);
+                        return;
+                    }
+                    fprintf(stderr, "TLS handshake with %s failed\n", ctx->server_ip);
+                    async_finish(ctx, p, 0);
+                    return;
+                }
+                p->early = 2;
+            }
+            ret = SSL_do_handshake(ssl);
+            if (ret != 1) {
+                if ((wait = async_tls_want(ssl, ret)) != 0) {
+                    async_watch(ctx, p, p->server.fd, wait);
+                    return;
+                }
+                fprintf(stderr, "TLS handshake with %s failed\n", ctx->server_ip);
+                ERR_print_errors_fp(stderr);
+                async_finish(ctx, p, 0);
+                return;
+            }
+            // 服务端拒绝早期数据时握手退化为1-RTT，请求需重发
+            if (p->early == 2 && SSL_get_early_data_status(ssl) == SSL_EARLY_DATA_ACCEPTED) {
+                p->state = ASYNC_RESPONSE;
+            } else {
+                p->state = ASYNC_SENDING;
+            }
+#endif
+            break;
+        }
+
+        case ASYNC_SENDING:
+            n = async_send(&p->server, p->request + p->request_sent, p->request_len - p->request_sent, &wait);
+            if (n < 0) {
+                if (wait) {
+                    async_watch(ctx, p, p->server.fd, wait);
+                } else {
+                    perror("Send failed");
+                    async_finish(ctx, p, 0);
+                }
+                return;
+            }
+            p->request_sent += n;
+            if (p->request_sent == p->request_len) {
+                p->state = ASYNC_RESPONSE;
+            }
+            break;
+
+        case ASYNC_RESPONSE: {
+            char response[BUFFER_SIZE];
+            n = async_recv(&p->server, response, sizeof(response) - 1, &wait);
+            if (n < 0 && wait) {
+                async_watch(ctx, p, p->server.fd, wait);
+                return;
+            }
+            if (n <= 0) {
+                async_finish(ctx, p, 0);
+                return;
+            }
+            response[n] = '\0';
+            if (strstr(response, "VERIFIED") != NULL) {
+                async_finish(ctx, p, 1);
+                return;
+            }
+            if (strstr(response, "SUCCESS") == NULL) {
+                async_finish(ctx, p, 0);
+                return;
+            }
+            // 服务端回复SUCCESS时随机值已经发出，控制连接不再需要
+            async_close_server(ctx, p);
+            p->state = ASYNC_CALLBACK;
+            break;
+        }
+
+        case ASYNC_CALLBACK:
+            p->callback_fd = accept(p->listen_fd, NULL, NULL);
+            if (p->callback_fd < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+                    async_watch(ctx, p, p->listen_fd, EPOLLIN);
+                } else {
+                    perror("Accept failed");
+                    async_finish(ctx, p, 0);
+                }
+                return;
+            }
+            fcntl(p->callback_fd, F_SETFL, fcntl(p->callback_fd, F_GETFL) | O_NONBLOCK);
+            p->state = ASYNC_VALUE;
+            break;
+
+        case ASYNC_VALUE: {
+            char value[BUFFER_SIZE];
+            n = recv(p->callback_fd, value, sizeof(value), 0);
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+                async_watch(ctx, p, p->callback_fd, EPOLLIN);
+                return;
+            }
+            async_finish(ctx, p, n > 0);
+            return;
+        }
+        }
+    }
+}
+
+DetectorContext* detector_ctx_create(const char* server_ip, int server_port) {
+    struct addrinfo hints, *addrs;
+    char port_str[10];
+
+    snprintf(port_str, sizeof(port_str), "%d", server_port);
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    int ret = getaddrinfo(server_ip, port_str, &hints, &addrs);
+    if (ret != 0) {
+        fprintf(stderr, "getaddrinfo error: %s\n", gai_strerror(ret));
+        return NULL;
+    }
+
+    DetectorContext *ctx = calloc(1, sizeof(*ctx));
+    if (!ctx) {
+        freeaddrinfo(addrs);
+        return NULL;
+    }
+    ctx->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (ctx->epoll_fd < 0) {
+        perror("epoll_create1 failed");
+        freeaddrinfo(addrs);
+        free(ctx);
+        return NULL;
+    }
+    snprintf(ctx->server_ip, sizeof(ctx->server_ip), "%s", server_ip);
+    ctx->server_port = server_port;
+    ctx->addrs = addrs;
+    return ctx;
+}
+
+int detector_ctx_submit(DetectorContext* ctx, const char* client_ip, int timeout) {
+    int listening_port;
+
+    if (ctx->pending_count == ctx->pending_cap) {
+        int cap = ctx->pending_cap ? ctx->pending_cap * 2 : 8;
+        AsyncProbe **pending = realloc(ctx->pending, cap * sizeof(*pending));
+        if (!pending) {
+            return -1;
+        }
+        ctx->pending = pending;
+        ctx->pending_cap = cap;
+    }
+    AsyncProbe *p = calloc(1, sizeof(*p));
+    if (!p) {
+        return -1;
+    }
+
+    int id = ctx->next_id++;
+    p->id = id;
+    p->listen_fd = p->callback_fd = p->server.fd = p->watched_fd = -1;
+    p->deadline = session_now_ms() + (long long)timeout * 1000;
+    snprintf(p->client_ip, sizeof(p->client_ip), "%s", client_ip);
+    ctx->pending[ctx->pending_count++] = p;
+
+    // 之后的失败都记为该探测的结果
+    p->listen_fd = create_listening_socket(client_ip, &listening_port);
+    if (p->listen_fd < 0) {
+        fprintf(stderr, "Failed to create listening socket\n");
+        async_finish(ctx, p, 0);
+        return id;
+    }
+    fcntl(p->listen_fd, F_SETFL, fcntl(p->listen_fd, F_GETFL) | O_NONBLOCK);
+    fcntl(p->listen_fd, F_SETFD, FD_CLOEXEC);
+
+    format_probe_request(client_ip, listening_port, timeout, p->request, sizeof(p->request));
+    p->request_len = strlen(p->request);
+
+    p->addr = ctx->addrs;
+    if (async_connect(ctx, p) < 0) {
+        async_finish(ctx, p, 0);
+    }
+    return id;
+}
+
+int detector_ctx_fd(const DetectorContext* ctx) {
+    return ctx->epoll_fd;
+}
+
+int detector_ctx_timeout(const DetectorContext* ctx) {
+    if (ctx->done_count > 0) {
+        return 0;
+    }
+    if (ctx->pending_count == 0) {
+        return -1;
+    }
+
+    long long nearest = ctx->pending[0]->deadline;
+    for (int i = 1; i < ctx->pending_count; i++) {
+        if (ctx->pending[i]->deadline < nearest) {
+            nearest = ctx->pending[i]->deadline;
+        }
+    }
+    long long remaining = nearest - session_now_ms();
+    return remaining > 0 ? (int)remaining : 0;
+}
+
+int detector_ctx_step(DetectorContext* ctx, int timeout_ms) {
+    struct epoll_event events[ASYNC_EVENT_BATCH];
+
+    if (ctx->pending_count == 0) {
+        return 0;
+    }
+
+    // 不越过最近的截止时间
+    int wait = detector_ctx_timeout(ctx);
+    if (timeout_ms >= 0 && (wait < 0 || timeout_ms < wait)) {
+        wait = timeout_ms;
+    }
+
+    int n = epoll_wait(ctx->epoll_fd, events, ASYNC_EVENT_BATCH, wait);
+    // 每个探测同一时刻只注册一个fd，同一批事件中不会重复出现已结束的探测
+    for (int i = 0; i < n; i++) {
+        async_advance(ctx, events[i].data.ptr);
+    }
+
+    long long now = session_now_ms();
+    for (int i = ctx->pending_count - 1; i >= 0; i--) {
+        if (ctx->pending[i]->deadline <= now) {
+            async_finish(ctx, ctx->pending[i], 0);
+        }
+    }
+    return ctx->pending_count;
+}
+
+int detector_ctx_collect(DetectorContext* ctx, DetectorProbeResult* results, int max) {
+    int n = ctx->done_count < max ? ctx->done_count : max;
+
+    if (n <= 0) {
+        return 0;
+    }
+    memcpy(results, ctx->done, n * sizeof(*results));
+    memmove(ctx->done, ctx->done + n, (ctx->done_count - n) * sizeof(*results));
+    ctx->done_count -= n;
+    return n;
+}
+
+void detector_ctx_destroy(DetectorContext* ctx) {
+    if (!ctx) {
+        return;
+    }
+    while (ctx->pending_count > 0) {
+        async_finish(ctx, ctx->pending[0], 0);
+    }
+    close(ctx->epoll_fd);
+    freeaddrinfo(ctx->addrs);
+    free(ctx->pending);
+    free(ctx->done);
+    free(ctx);
+}
+
+#else
+
+// 异步检测依赖epoll（仅Linux），其他平台调用方退回detect_public_address
+DetectorContext* detector_ctx_create(const char* server_ip, int server_port) {
+    (void)server_ip; (void)server_port;
+    return NULL;
+}
+
+int detector_ctx_submit(DetectorContext* ctx, const char* client_ip, int timeout) {
+    (void)ctx; (void)client_ip; (void)timeout;
+    return -1;
+}
+
+int detector_ctx_fd(const DetectorContext* ctx) {
+    (void)ctx;
+    return -1;
+}
+
+int detector_ctx_timeout(const DetectorContext* ctx) {
+    (void)ctx;
+    return -1;
+}
+
+int detector_ctx_step(DetectorContext* ctx, int timeout_ms) {
+    (void)ctx; (void)timeout_ms;
+    return 0;
+}
+
+int detector_ctx_collect(DetectorContext* ctx, DetectorProbeResult* results, int max) {
+    (void)ctx; (void)results; (void)max;
+    return 0;
+}
+
+void detector_ctx_destroy(DetectorContext* ctx) {
+    (void)ctx;
+}
+
+#endif
+
+//gcc -fPIC -shared -o libpublic_address_detector.so public_address_detector.c -I. -DDDNS_WITH_TLS -lssl -lcrypto -lpthread
\ No newline at end of file
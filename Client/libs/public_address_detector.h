@@ -19,6 +19,73 @@ void detector_cleanup(void);
 // 主要检测函数
 DetectionResult detect_public_address(const char* client_ip, const char* server_ip, int server_port, int timeout);
 
+// 控制连接改用TLS 1.3（需以DDNS_WITH_TLS编译），ca_file为校验服务端证书的CA文件（NULL使用系统默认），
+// server_name用于SNI和证书校验（NULL时按server_ip校验证书中的IP地址）
+// 服务端下发的会话票据缓存在进程内，之后的连接恢复会话并把首条请求作为0-RTT早期数据发出
+// 调用后所有控制连接都要求TLS；加载失败时返回-1，连接将失败而不会退回明文
+int detector_set_tls(const char* ca_file, const char* server_name);
+
+// 长连接会话：一条已认证的控制连接上以带标签的消息复用多次探测（仅POSIX平台）
+typedef struct DetectorSession DetectorSession;
+
+// 会话事件
+#define DETECTOR_EVENT_NONE 0       // 等待超时，无事件
+#define DETECTOR_EVENT_REVERIFY 1   // 服务端发现源地址变化，要求立即重新验证
+#define DETECTOR_EVENT_CLOSED -1    // 会话已断开，需要重新建立
+
+// 建立会话，client_id为客户端标识，token为服务端认证令牌（可为NULL）
+// 服务端不支持会话或认证失败时返回NULL，调用方应退回detect_public_address
+DetectorSession* detector_session_open(const char* server_ip, int server_port,
+                                       const char* client_id, const char* token, int timeout);
+
+// 通过会话检测地址，可被多个线程并发调用
+DetectionResult detector_session_probe(DetectorSession* session, const char* client_ip, int timeout);
+
+// 同上，name为服务端内置DNS发布该地址时使用的记录名（默认为会话的客户端标识）
+DetectionResult detector_session_probe_named(DetectorSession* session, const char* client_ip,
+                                             const char* name, int timeout);
+
+// 等待服务端推送，最多timeout_ms毫秒，返回DETECTOR_EVENT_*
+int detector_session_wait_event(DetectorSession* session, int timeout_ms);
+
+// 关闭会话
+void detector_session_close(DetectorSession* session);
+
+// 异步检测：一个线程在同一上下文中并发运行多个探测（仅Linux，其他平台create返回NULL）
+// 上下文内部以epoll驱动各探测的非阻塞连接、TLS握手和回连，每个探测有自己的截止时间
+// 可把detector_ctx_fd放入调用方自己的事件循环，可读或detector_ctx_timeout到期时调用step
+// 上下文不是线程安全的，只能由一个线程使用
+typedef struct DetectorContext DetectorContext;
+
+typedef struct {
+    int id;                 // detector_ctx_submit返回的探测编号
+    int success;
+    char client_ip[64];
+} DetectorProbeResult;
+
+// 创建上下文，服务端地址只解析一次；失败返回NULL
+DetectorContext* detector_ctx_create(const char* server_ip, int server_port);
+
+// 提交一个探测，timeout为该探测的截止时间（秒），返回探测编号，内存不足时返回-1
+// 提交时即发起连接，立即失败的探测也会产生结果
+int detector_ctx_submit(DetectorContext* ctx, const char* client_ip, int timeout);
+
+// 可poll的fd，有事件待处理时可读
+int detector_ctx_fd(const DetectorContext* ctx);
+
+// 距最近截止时间的毫秒数，有结果待取时为0，没有进行中的探测时为-1
+int detector_ctx_timeout(const DetectorContext* ctx);
+
+// 处理就绪的事件和到期的探测，最多等待timeout_ms毫秒（-1为等到下一个事件或截止时间）
+// 返回仍在进行的探测数
+int detector_ctx_step(DetectorContext* ctx, int timeout_ms);
+
+// 取出最多max个已结束探测的结果，返回取出的个数
+int detector_ctx_collect(DetectorContext* ctx, DetectorProbeResult* results, int max);
+
+// 销毁上下文，进行中的探测被放弃
+void detector_ctx_destroy(DetectorContext* ctx);
+
 #ifdef __cplusplus
 }
 #endif
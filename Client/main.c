@@ -16,19 +16,26 @@
     #include <sys/types.h>
     #include <sys/stat.h>
     #include <fcntl.h>
+    #include <poll.h>
 #endif
 
 // 假设这些头文件存在
 #include "libs/public_address_detector.h"
 #include "libs/libcloudflare_ddns.h"
+#include "trace.h"
+#include "control.h"
+#include "tenant.h"
 
 #define DETECTION_INTERVAL 30  // 30秒
+#define SESSION_RETRY_CYCLES 10 // 会话建立失败后间隔多少个周期再尝试
+#define DAEMON_ENV "DDNS_MONITOR_DAEMON" // 重新exec出的后台进程，值为父进程得到的地址
 
 typedef struct {
     char server_ip[64];
     int server_port;
     int timeout;
     char client_ip[64];
+    char server_token[128];
 } AppConfig;
 
 // 检测结果枚举
@@ -71,21 +78,50 @@ void log_message(const char* message, ...) {
     fclose(log_file);
 }
 
+// 本地控制套接字，不可用时为-1
+static int g_control_fd = -1;
+static time_t g_last_update = 0;     // 最近一次完整DDNS更新时间
+static time_t g_last_verified = 0;   // 最近一次检测成功时间
+
+// 控制连接启用TLS时配置检测库，之后的一次性检测和会话都使用TLS
+void apply_tls_config(const DDNSResult* result) {
+    if (!result->serverTLS) {
+        return;
+    }
+    const char* ca = result->serverCA && result->serverCA[0] ? result->serverCA : NULL;
+    const char* name = result->serverName && result->serverName[0] ? result->serverName : NULL;
+    if (detector_set_tls(ca, name) < 0) {
+        log_message("TLS配置加载失败（CA: %s），无法连接服务端", ca ? ca : "系统默认");
+    }
+}
+
 // DDNS更新函数
 int update_ddns_config(AppConfig* config) {
     log_message("开始获取DDNS配置...");
 
+    long long start = trace_now_us();
     DDNSResult* result = RunCloudflareDDNS();
+    trace_record(TRACE_DDNS_CYCLE, trace_now_us() - start);
     if (!result) {
         log_message("DDNS更新失败: 返回空结果");
         return 0;
     }
 
+    // Go侧各阶段耗时，编号与TraceStage一致
+    for (int i = 0; i < result->spanCount; i++) {
+        trace_record((TraceStage)result->spanStage[i], result->spanMicros[i]);
+    }
+    g_last_update = time(NULL);
+
     // 保存配置信息
     strncpy(config->server_ip, result->serverIP, sizeof(config->server_ip) - 1);
     config->server_port = result->serverPort;
     config->timeout = result->timeout;
     strncpy(config->client_ip, result->ipAddr, sizeof(config->client_ip) - 1);
+    if (result->serverToken) {
+        strncpy(config->server_token, result->serverToken, sizeof(config->server_token) - 1);
+    }
+    apply_tls_config(result);
 
     log_message("DDNS配置获取成功: %s:%d, 超时:%d秒, IP:%s",
                 config->server_ip, config->server_port,
@@ -95,6 +131,187 @@ int update_ddns_config(AppConfig* config) {
     return 1;
 }
 
+// 从状态文件恢复上次验证通过的配置，不做任何网络操作
+// 恢复的地址由随后的首次检测验证，失效时再走完整的update_ddns_config
+int restore_ddns_config(AppConfig* config) {
+    DDNSResult* result = RestoreDDNSState();
+    if (!result) {
+        return 0;
+    }
+
+    strncpy(config->server_ip, result->serverIP, sizeof(config->server_ip) - 1);
+    config->server_port = result->serverPort;
+    config->timeout = result->timeout;
+    strncpy(config->client_ip, result->ipAddr, sizeof(config->client_ip) - 1);
+    if (result->serverToken) {
+        strncpy(config->server_token, result->serverToken, sizeof(config->server_token) - 1);
+    }
+    apply_tls_config(result);
+
+    log_message("%s", result->result);
+
+    FreeDDNSResult(result);
+    return 1;
+}
+
+// 重新exec出的后台进程沿用父进程的结果：地址由父进程经环境变量传入，
+// 其余参数只从配置读取，不再重复探测和更新DNS
+int inherit_ddns_config(AppConfig* config, const char* client_ip) {
+    DDNSResult* result = LoadDDNSConfig();
+    if (!result) {
+        return 0;
+    }
+
+    strncpy(config->server_ip, result->serverIP, sizeof(config->server_ip) - 1);
+    config->server_port = result->serverPort;
+    config->timeout = result->timeout;
+    strncpy(config->client_ip, client_ip, sizeof(config->client_ip) - 1);
+    if (result->serverToken) {
+        strncpy(config->server_token, result->serverToken, sizeof(config->server_token) - 1);
+    }
+    apply_tls_config(result);
+
+    log_message("后台进程沿用启动时的配置: %s:%d, IP:%s",
+                config->server_ip, config->server_port, config->client_ip);
+
+    FreeDDNSResult(result);
+    return 1;
+}
+
+// 与服务端的长连接会话，不可用时为NULL（退回一次性检测）
+static DetectorSession* g_session = NULL;
+static int g_session_retry = 0;
+
+// 配置中的租户（网络命名空间），与默认记录共用会话和检测周期
+static Tenant g_tenants[TENANT_MAX];
+static int g_tenant_count = 0;
+
+// 会话中的客户端标识（主机名），租户的记录名也挂在它之下
+void get_client_id(char* client_id, size_t len) {
+    snprintf(client_id, len, "ddns-client");
+#ifndef _WIN32
+    gethostname(client_id, len - 1);
+#endif
+}
+
+// 确保会话可用，建立失败后隔若干周期再重试
+void ensure_session(AppConfig* config) {
+    char client_id[64] = "";
+
+    if (g_session) {
+        return;
+    }
+    if (g_session_retry > 0) {
+        g_session_retry--;
+        return;
+    }
+
+    get_client_id(client_id, sizeof(client_id));
+
+    g_session = detector_session_open(config->server_ip, config->server_port,
+                                      client_id, config->server_token, config->timeout);
+    if (g_session) {
+        log_message("已建立会话: %s:%d (客户端标识: %s)",
+                    config->server_ip, config->server_port, client_id);
+    } else {
+        log_message("会话建立失败，使用一次性检测");
+        g_session_retry = SESSION_RETRY_CYCLES;
+    }
+}
+
+// dump命令：输出当前配置与状态
+int dump_state(char* buf, size_t len, void* arg) {
+    AppConfig* config = arg;
+    char updated[20] = "-", verified[20] = "-";
+
+    if (g_last_update) {
+        strftime(updated, sizeof(updated), "%Y-%m-%d %H:%M:%S", localtime(&g_last_update));
+    }
+    if (g_last_verified) {
+        strftime(verified, sizeof(verified), "%Y-%m-%d %H:%M:%S", localtime(&g_last_verified));
+    }
+
+    int used = snprintf(buf, len,
+                        "server: %s:%d\n"
+                        "timeout: %d\n"
+                        "client_ip: %s\n"
+                        "session: %s\n"
+                        "last_update: %s\n"
+                        "last_verified: %s\n",
+                        config->server_ip, config->server_port, config->timeout,
+                        config->client_ip, g_session ? "connected" : "none", updated, verified);
+    if (used > 0 && (size_t)used < len) {
+        used += (int)tenants_format(g_tenants, g_tenant_count, buf + used, len - used);
+    }
+    return used;
+}
+
+// 等待下一个检测周期，期间处理服务端推送和本地控制命令
+// 返回1表示需要立即重新验证（服务端推送REVERIFY或收到refresh命令）
+int wait_next_cycle(AppConfig* config, int seconds) {
+    time_t deadline = time(NULL) + seconds;
+
+    // 按1秒分片等待，控制命令最多延迟一个分片
+    while (time(NULL) < deadline) {
+        if (g_session) {
+            int event = detector_session_wait_event(g_session, 1000);
+
+            if (event == DETECTOR_EVENT_REVERIFY) {
+                log_message("服务端检测到源地址变化，立即重新验证");
+                return 1;
+            }
+            if (event == DETECTOR_EVENT_CLOSED) {
+                log_message("会话已断开，下次检测时重新建立");
+                detector_session_close(g_session);
+                g_session = NULL;
+            }
+            if (control_poll(g_control_fd, 0, dump_state, config) == CONTROL_REFRESH) {
+                log_message("收到refresh命令，立即重新检测");
+                return 1;
+            }
+        } else if (control_poll(g_control_fd, 1000, dump_state, config) == CONTROL_REFRESH) {
+            log_message("收到refresh命令，立即重新检测");
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// 一次性检测：探测由异步检测上下文驱动，等待期间继续响应本地控制命令
+DetectionResult detect_oneshot(AppConfig* config) {
+    DetectionResult result = {0};
+    DetectorContext* ctx = detector_ctx_create(config->server_ip, config->server_port);
+
+    if (!ctx) {
+        // 平台不支持异步检测
+        return detect_public_address(config->client_ip, config->server_ip,
+                                     config->server_port, config->timeout);
+    }
+
+#ifndef _WIN32
+    if (detector_ctx_submit(ctx, config->client_ip, config->timeout) >= 0) {
+        DetectorProbeResult probe;
+
+        while (detector_ctx_step(ctx, 0) > 0) {
+            struct pollfd fds[2] = {
+                { detector_ctx_fd(ctx), POLLIN, 0 },
+                { g_control_fd, POLLIN, 0 },
+            };
+            poll(fds, g_control_fd >= 0 ? 2 : 1, detector_ctx_timeout(ctx));
+            // 正在检测，refresh无需额外处理
+            if (g_control_fd >= 0 && (fds[1].revents & POLLIN)) {
+                control_poll(g_control_fd, 0, dump_state, config);
+            }
+        }
+        if (detector_ctx_collect(ctx, &probe, 1) == 1) {
+            result.success = probe.success;
+        }
+    }
+#endif
+    detector_ctx_destroy(ctx);
+    return result;
+}
+
 // 改进的检测函数，返回详细状态
 DetectResult run_detection(AppConfig* config) {
     log_message("开始网络检测: %s -> %s:%d",
@@ -115,18 +332,23 @@ DetectResult run_detection(AppConfig* config) {
         return DETECT_UNKNOWN;
     }
 
-    // 执行检测
-    DetectionResult result = detect_public_address(
-        config->client_ip,
-        config->server_ip,
-        config->server_port,
-        config->timeout
-    );
+    // 执行检测，会话可用时复用长连接
+    DetectionResult result;
+    ensure_session(config);
+    long long start = trace_now_us();
+    if (g_session) {
+        result = detector_session_probe(g_session, config->client_ip, config->timeout);
+    } else {
+        result = detect_oneshot(config);
+    }
+
+    trace_record(TRACE_DETECT, trace_now_us() - start);
 
     // 清理库
     detector_cleanup();
 
     if (result.success) {
+        g_last_verified = time(NULL);
         log_message("检测成功");
         return DETECT_SUCCESS;
     } else {
@@ -140,6 +362,59 @@ DetectResult run_detection(AppConfig* config) {
     }
 }
 
+// 读取Go配置中的租户并打开各自的网络命名空间
+void load_tenants(void) {
+    int count = TenantCount();
+    char client_id[64] = "";
+
+    get_client_id(client_id, sizeof(client_id));
+
+    for (int i = 0; i < count && g_tenant_count < TENANT_MAX; i++) {
+        char* name = TenantName(i);
+        char* netns = TenantNamespace(i);
+        Tenant* tenant = &g_tenants[g_tenant_count++];
+
+        if (tenant_init(tenant, i, name ? name : "", netns ? netns : "", client_id) < 0) {
+            log_message("租户%s: 无法打开网络命名空间 %s: %s", tenant->name, tenant->netns, strerror(errno));
+        } else {
+            log_message("租户%s: 网络命名空间 %s", tenant->name, tenant->netns);
+        }
+        free(name);
+        free(netns);
+    }
+}
+
+// 在各租户的命名空间中检测地址，地址变化时更新该租户的记录
+void run_tenants(AppConfig* config) {
+    if (g_tenant_count == 0 || detector_init() != 0) {
+        return;
+    }
+
+    long long start = trace_now_us();
+    tenants_detect(g_tenants, g_tenant_count, g_session,
+                   config->server_ip, config->server_port, config->timeout);
+    trace_record(TRACE_TENANTS, trace_now_us() - start);
+    detector_cleanup();
+
+    for (int i = 0; i < g_tenant_count; i++) {
+        Tenant* tenant = &g_tenants[i];
+
+        if (!tenant->verified) {
+            log_message("租户%s检测失败: %s (候选地址%d个)", tenant->name, tenant->status, tenant->candidates);
+            continue;
+        }
+        if (!tenant->changed && !tenant->publish_pending) {
+            continue;
+        }
+
+        // 更新失败时下一轮即使地址未变也重新发布
+        char* result = PublishTenantAddress(tenant->index, tenant->address);
+        log_message("租户%s: %s", tenant->name, result ? result : "无结果");
+        tenant->publish_pending = !result || (!strstr(result, "成功") && !strstr(result, "IP未改变"));
+        free(result);
+    }
+}
+
 // 处理网络错误
 void handle_network_error(int error_count) {
     log_message("检测到网络问题，等待恢复... (错误次数: %d)", error_count);
@@ -156,32 +431,88 @@ void handle_network_error(int error_count) {
     }
 }
 
-int main() {
+#ifndef _WIN32
+// fork出的子进程脱离终端并重新exec自身，成功时不返回
+void enter_background(char* argv[], const AppConfig* config) {
+    // 创建新会话，脱离终端
+    setsid();
+
+    // 注意：不改变工作目录，保持当前目录以便写入日志
+    // chdir("/");  // 注释掉这行，保持当前目录
+
+    // 关闭标准文件描述符，但保留错误输出
+    // 只关闭标准输入，保留输出和错误以便调试
+    close(STDIN_FILENO);
+
+    // 可以打开/dev/null作为标准输入
+    open("/dev/null", O_RDONLY);
+
+    // 注意：我们不关闭STDOUT和STDERR，让后台进程也能看到输出
+    // 如果需要完全后台，可以重定向到日志文件
+    /*
+    close(STDOUT_FILENO);
+    close(STDERR_FILENO);
+    open("/dev/null", O_WRONLY);
+    open("/dev/null", O_WRONLY);
+    */
+
+    // Go运行时在加载共享库时就启动了自己的线程，fork出的子进程只剩当前线程，
+    // 之后再调用Go导出的函数会死锁。因此子进程重新exec自身获得新的运行时，
+    // 父进程已得到的地址经环境变量交给新进程，新进程不再重复完整的更新
+    setenv(DAEMON_ENV, config->client_ip, 1);
+    execv("/proc/self/exe", argv);
+    execvp(argv[0], argv);
+    log_message("后台进程exec失败: %s", strerror(errno));
+    _exit(1);
+}
+#endif
+
+int main(int argc, char* argv[]) {
     AppConfig config = {0};
     int network_error_count = 0;
+    int daemon_child = 0;
+    (void)argc;
 
-    printf("DDNS监控服务启动...\n");
-    printf("日志文件: ddns_monitor.log\n");
+#ifndef _WIN32
+    daemon_child = getenv(DAEMON_ENV) != NULL;
+#endif
 
-    // 记录启动时间
-    log_message("========== 服务启动 ==========");
+    if (!daemon_child) {
+        printf("DDNS监控服务启动...\n");
+        printf("日志文件: ddns_monitor.log\n");
 
-    // 1. 获取初始配置
-    if (!update_ddns_config(&config)) {
-        fprintf(stderr, "初始DDNS配置获取失败\n");
-        log_message("服务启动失败: 无法获取DDNS配置");
-        return 1;
+        // 记录启动时间
+        log_message("========== 服务启动 ==========");
+    }
+
+    // 1. 获取初始配置，优先使用状态文件，没有时才完整探测并更新DNS
+    // 后台进程直接沿用父进程的结果，失败时退出而不是再完整更新一次
+    int restored = 0;
+    if (daemon_child) {
+        if (!inherit_ddns_config(&config, getenv(DAEMON_ENV))) {
+            log_message("后台进程无法读取配置，退出");
+            return 1;
+        }
+    } else {
+        restored = restore_ddns_config(&config);
+        if (!restored && !update_ddns_config(&config)) {
+            fprintf(stderr, "初始DDNS配置获取失败\n");
+            log_message("服务启动失败: 无法获取DDNS配置");
+            return 1;
+        }
     }
 
-    printf("配置获取成功:\n");
-    printf("  服务器: %s:%d\n", config.server_ip, config.server_port);
-    printf("  超时: %d秒\n", config.timeout);
-    printf("  客户端IP: %s\n", config.client_ip);
-    printf("  检测间隔: %d秒\n", DETECTION_INTERVAL);
+    if (!daemon_child) {
+        printf(restored ? "配置已从状态文件恢复:\n" : "配置获取成功:\n");
+        printf("  服务器: %s:%d\n", config.server_ip, config.server_port);
+        printf("  超时: %d秒\n", config.timeout);
+        printf("  客户端IP: %s\n", config.client_ip);
+        printf("  检测间隔: %d秒\n", DETECTION_INTERVAL);
+    }
 
 #ifndef _WIN32
     // Unix/Linux/Mac后台运行
-    pid_t pid = fork();
+    pid_t pid = daemon_child ? 0 : fork();
 
     if (pid < 0) {
         perror("fork失败");
@@ -198,31 +529,18 @@ int main() {
         return 0;
     }
 
-    // 子进程继续执行（后台服务）
-
-    // 创建新会话，脱离终端
-    setsid();
-
-    // 注意：不改变工作目录，保持当前目录以便写入日志
-    // chdir("/");  // 注释掉这行，保持当前目录
-
-    // 关闭标准文件描述符，但保留错误输出
-    // 只关闭标准输入，保留输出和错误以便调试
-    close(STDIN_FILENO);
-
-    // 可以打开/dev/null作为标准输入
-    open("/dev/null", O_RDONLY);
-
-    // 注意：我们不关闭STDOUT和STDERR，让后台进程也能看到输出
-    // 如果需要完全后台，可以重定向到日志文件
-    /*
-    close(STDOUT_FILENO);
-    close(STDERR_FILENO);
-    open("/dev/null", O_WRONLY);
-    open("/dev/null", O_WRONLY);
-    */
+    // 子进程继续执行（后台服务），重新exec后不再返回
+    if (!daemon_child) {
+        enter_background(argv, &config);
+    }
 #endif
 
+    g_control_fd = control_open(CONTROL_SOCKET_PATH);
+    if (g_control_fd >= 0) {
+        log_message("控制套接字: %s", CONTROL_SOCKET_PATH);
+    }
+
+    load_tenants();
     log_message("后台检测服务开始运行");
 
     // 2. 立即执行第一次检测
@@ -246,11 +564,17 @@ int main() {
             log_message("首次检测遇到未知错误");
             break;
     }
+    run_tenants(&config);
 
     // 3. 主循环
     int detection_count = 1;  // 从1开始，因为已经执行了一次
     while (1) {
-        sleep(DETECTION_INTERVAL);
+        if (wait_next_cycle(&config, DETECTION_INTERVAL)) {
+            // 源地址已变化或手动刷新，直接重新获取配置并更新DNS
+            update_ddns_config(&config);
+            run_tenants(&config);
+            continue;
+        }
         detection_count++;
 
         log_message("执行第%d次检测...", detection_count);
@@ -285,6 +609,8 @@ int main() {
                 break;
         }
 
+        run_tenants(&config);
+
         // 每10次检测输出一次状态摘要
         if (detection_count % 10 == 0) {
             log_message("状态摘要: 已执行%d次检测，网络错误计数: %d",
@@ -292,12 +618,16 @@ int main() {
         }
     }
 
+    for (int i = 0; i < g_tenant_count; i++) {
+        tenant_release(&g_tenants[i]);
+    }
+    control_close(g_control_fd, CONTROL_SOCKET_PATH);
     log_message("========== 服务停止 ==========");
     return 0;
 }
 
 // C语言版本的执行入口，调用lib里面的cloudflare_ddns.go进行cf的dns设置和获取系统公网IP，调用public_address_detector.c进行检查
 // 编译命令
-// gcc -o main main.c -I./libs -L./libs -lpublic_address_detector -lcloudflare_ddns
+// gcc -o main main.c trace.c control.c tenant.c -I./libs -L./libs -lpublic_address_detector -lcloudflare_ddns -lpthread
 // 环境变量
 // export DYLD_LIBRARY_PATH=./libs:.
\ No newline at end of file
@@ -0,0 +1,331 @@
+#define _GNU_SOURCE  // setns
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tenant.h"
+
+#ifdef __linux__
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <pthread.h>
+#include <ifaddrs.h>
+#include <net/if.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#define TENANT_MAX_CANDIDATES 32
+#define NETNS_RUN_DIR "/var/run/netns"
+
+// 内核IPv6地址标志（ifa_flags）：临时地址、DAD失败、DAD未完成的地址不参与探测
+#define IFA_SKIP_FLAGS (0x01 | 0x08 | 0x40)
+
+// 一轮检测的共享状态，工作线程依次领取租户
+typedef struct {
+    Tenant* tenants;
+    int count;
+    int next;
+    DetectorSession* session;
+    const char* server_ip;
+    int server_port;
+    int timeout;
+} DetectRound;
+
+int tenant_init(Tenant* tenant, int index, const char* name, const char* netns, const char* host) {
+    memset(tenant, 0, sizeof(*tenant));
+    tenant->index = index;
+    tenant->ns_fd = -1;
+    tenant->status = "pending";
+    snprintf(tenant->name, sizeof(tenant->name), "%s", name);
+    snprintf(tenant->record, sizeof(tenant->record), "%s.%s", name, host);
+
+    // 不含'/'的视为ip netns创建的命名空间名
+    if (strchr(netns, '/')) {
+        snprintf(tenant->netns, sizeof(tenant->netns), "%s", netns);
+    } else {
+        snprintf(tenant->netns, sizeof(tenant->netns), "%s/%s", NETNS_RUN_DIR, netns);
+    }
+
+    tenant->ns_fd = open(tenant->netns, O_RDONLY | O_CLOEXEC);
+    if (tenant->ns_fd < 0) {
+        tenant->status = "namespace unavailable";
+        return -1;
+    }
+    return 0;
+}
+
+void tenant_release(Tenant* tenant) {
+    if (tenant->ns_fd >= 0) {
+        close(tenant->ns_fd);
+        tenant->ns_fd = -1;
+    }
+}
+
+// 读取当前线程所在命名空间中应跳过的IPv6地址（/proc/thread-self反映线程自己的命名空间）
+static int read_skipped_ipv6(struct in6_addr* skipped, int max) {
+    FILE* fp = fopen("/proc/thread-self/net/if_inet6", "r");
+    char hex[33];
+    unsigned int flags;
+    int n = 0;
+
+    if (!fp) {
+        return 0;
+    }
+    while (n < max && fscanf(fp, "%32s %*x %*x %*x %x %*s", hex, &flags) == 2) {
+        if (!(flags & IFA_SKIP_FLAGS)) {
+            continue;
+        }
+        for (int i = 0; i < 16; i++) {
+            unsigned int byte;
+            sscanf(hex + i * 2, "%2x", &byte);
+            skipped[n].s6_addr[i] = (unsigned char)byte;
+        }
+        n++;
+    }
+    fclose(fp);
+    return n;
+}
+
+// 全局单播地址才可能被服务端连到，私有、运营商NAT（100.64/10）和广播地址不发布
+static int is_candidate(const struct sockaddr* sa, const struct in6_addr* skipped, int skipped_count) {
+    if (sa->sa_family == AF_INET) {
+        uint32_t addr = ntohl(((const struct sockaddr_in*)sa)->sin_addr.s_addr);
+        return (addr >> 24) != 0 && (addr >> 24) != 127 && (addr >> 16) != 0xa9fe &&
+               (addr >> 24) != 10 && (addr >> 20) != 0xac1 && (addr >> 16) != 0xc0a8 &&
+               (addr >> 22) != (0x64400000 >> 22) && (addr >> 28) < 0xe;
+    }
+    if (sa->sa_family == AF_INET6) {
+        const struct in6_addr* a = &((const struct sockaddr_in6*)sa)->sin6_addr;
+        if (IN6_IS_ADDR_LOOPBACK(a) || IN6_IS_ADDR_LINKLOCAL(a) || IN6_IS_ADDR_MULTICAST(a) ||
+            IN6_IS_ADDR_UNSPECIFIED(a) || IN6_IS_ADDR_V4MAPPED(a)) {
+            return 0;
+        }
+        for (int i = 0; i < skipped_count; i++) {
+            if (IN6_ARE_ADDR_EQUAL(a, &skipped[i])) {
+                return 0;
+            }
+        }
+        return 1;
+    }
+    return 0;
+}
+
+// 枚举当前线程所在命名空间中的候选地址，IPv4在前
+static int collect_candidates(char out[][TENANT_ADDR_LEN], int max) {
+    struct ifaddrs* ifaddr;
+    struct in6_addr skipped[TENANT_MAX_CANDIDATES];
+    int skipped_count = read_skipped_ipv6(skipped, TENANT_MAX_CANDIDATES);
+    int n = 0;
+
+    if (getifaddrs(&ifaddr) < 0) {
+        return 0;
+    }
+    for (int family_pass = 0; family_pass < 2; family_pass++) {
+        int family = family_pass == 0 ? AF_INET : AF_INET6;
+
+        for (struct ifaddrs* ifa = ifaddr; ifa && n < max; ifa = ifa->ifa_next) {
+            if (!ifa->ifa_addr || ifa->ifa_addr->sa_family != family ||
+                !(ifa->ifa_flags & IFF_UP) || (ifa->ifa_flags & IFF_LOOPBACK) ||
+                !is_candidate(ifa->ifa_addr, skipped, skipped_count)) {
+                continue;
+            }
+
+            const void* addr = family == AF_INET
+                ? (const void*)&((const struct sockaddr_in*)ifa->ifa_addr)->sin_addr
+                : (const void*)&((const struct sockaddr_in6*)ifa->ifa_addr)->sin6_addr;
+            inet_ntop(family, addr, out[n], TENANT_ADDR_LEN);
+            n++;
+        }
+    }
+    freeifaddrs(ifaddr);
+    return n;
+}
+
+static int probe_address(const DetectRound* round, const Tenant* tenant, const char* ip) {
+    DetectionResult result;
+
+    // 会话的控制连接在主命名空间中，监听套接字由本线程创建，位于租户的命名空间
+    // 服务端启用内置DNS时发布为"租户名.客户端标识"，不覆盖主机自己或其他主机的记录
+    if (round->session) {
+        result = detector_session_probe_named(round->session, ip, tenant->record, round->timeout);
+    } else {
+        result = detect_public_address(ip, round->server_ip, round->server_port, round->timeout);
+    }
+    return result.success;
+}
+
+// 依次验证candidates[from..n)，返回第一个验证通过的下标，都失败时返回-1
+// 不经会话时在本线程中用异步检测上下文并发探测，仍按顺序取第一个通过的地址，
+// 不可达的地址不再逐个等到超时
+static int probe_candidates(const DetectRound* round, const Tenant* tenant,
+                            char candidates[][TENANT_ADDR_LEN], int from, int n) {
+    DetectorContext* ctx = round->session ? NULL
+                         : detector_ctx_create(round->server_ip, round->server_port);
+    int ids[TENANT_MAX_CANDIDATES];
+    int status[TENANT_MAX_CANDIDATES];  // -1为进行中
+    DetectorProbeResult results[TENANT_MAX_CANDIDATES];
+    int i;
+
+    if (!ctx) {
+        for (i = from; i < n; i++) {
+            if (probe_address(round, tenant, candidates[i])) {
+                return i;
+            }
+        }
+        return -1;
+    }
+
+    for (i = from; i < n; i++) {
+        ids[i] = detector_ctx_submit(ctx, candidates[i], round->timeout);
+        status[i] = ids[i] < 0 ? 0 : -1;
+    }
+    for (;;) {
+        detector_ctx_step(ctx, -1);
+        int got = detector_ctx_collect(ctx, results, TENANT_MAX_CANDIDATES);
+        for (int r = 0; r < got; r++) {
+            for (i = from; i < n; i++) {
+                if (ids[i] == results[r].id) {
+                    status[i] = results[r].success;
+                }
+            }
+        }
+
+        // 排在前面的地址都失败后才能确定结果
+        for (i = from; i < n && status[i] == 0; i++) {
+        }
+        if (i == n || status[i] == 1) {
+            break;
+        }
+    }
+    detector_ctx_destroy(ctx);
+    return i < n ? i : -1;
+}
+
+static void detect_tenant(const DetectRound* round, Tenant* tenant) {
+    char candidates[TENANT_MAX_CANDIDATES][TENANT_ADDR_LEN];
+
+    tenant->verified = 0;
+    tenant->changed = 0;
+    tenant->candidates = 0;
+
+    if (tenant->ns_fd < 0) {
+        return;
+    }
+    if (setns(tenant->ns_fd, CLONE_NEWNET) < 0) {
+        tenant->status = "setns failed";
+        return;
+    }
+
+    int n = collect_candidates(candidates, TENANT_MAX_CANDIDATES);
+    tenant->candidates = n;
+    if (n == 0) {
+        tenant->status = "no candidates";
+        return;
+    }
+
+    // 上次验证通过的地址仍在时先验证它，通常一次探测即可结束
+    for (int i = 1; i < n; i++) {
+        if (strcmp(candidates[i], tenant->address) == 0) {
+            char first[TENANT_ADDR_LEN];
+            memcpy(first, candidates[0], sizeof(first));
+            memcpy(candidates[0], candidates[i], sizeof(first));
+            memcpy(candidates[i], first, sizeof(first));
+            break;
+        }
+    }
+
+    int found = probe_address(round, tenant, candidates[0]) ? 0
+              : probe_candidates(round, tenant, candidates, 1, n);
+    if (found >= 0) {
+        tenant->verified = 1;
+        tenant->changed = strcmp(candidates[found], tenant->address) != 0;
+        tenant->last_verified = time(NULL);
+        tenant->status = "verified";
+        memcpy(tenant->address, candidates[found], TENANT_ADDR_LEN);
+        return;
+    }
+    tenant->status = "unreachable";
+}
+
+// 工作线程进入各租户的命名空间后不再返回主命名空间，本轮结束即退出
+static void* detect_worker(void* arg) {
+    DetectRound* round = arg;
+    int i;
+
+    while ((i = __atomic_fetch_add(&round->next, 1, __ATOMIC_RELAXED)) < round->count) {
+        detect_tenant(round, &round->tenants[i]);
+    }
+    return NULL;
+}
+
+void tenants_detect(Tenant* tenants, int count, DetectorSession* session,
+                    const char* server_ip, int server_port, int timeout) {
+    DetectRound round = { tenants, count, 0, session, server_ip, server_port, timeout };
+    pthread_t workers[TENANT_WORKERS];
+    int started = 0;
+
+    for (int i = 0; i < TENANT_WORKERS && i < count; i++) {
+        if (pthread_create(&workers[started], NULL, detect_worker, &round) == 0) {
+            started++;
+        }
+    }
+    // 调用线程不能切换命名空间，线程全部创建失败时本轮跳过
+    if (started == 0) {
+        for (int i = 0; i < count; i++) {
+            tenants[i].verified = 0;
+            tenants[i].changed = 0;
+            tenants[i].status = "no worker thread";
+        }
+    }
+    for (int i = 0; i < started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+}
+
+#else
+
+int tenant_init(Tenant* tenant, int index, const char* name, const char* netns, const char* host) {
+    memset(tenant, 0, sizeof(*tenant));
+    tenant->index = index;
+    tenant->ns_fd = -1;
+    tenant->status = "unsupported platform";
+    snprintf(tenant->name, sizeof(tenant->name), "%s", name);
+    snprintf(tenant->record, sizeof(tenant->record), "%s.%s", name, host);
+    snprintf(tenant->netns, sizeof(tenant->netns), "%s", netns);
+    return -1;
+}
+
+void tenant_release(Tenant* tenant) {
+    (void)tenant;
+}
+
+void tenants_detect(Tenant* tenants, int count, DetectorSession* session,
+                    const char* server_ip, int server_port, int timeout) {
+    (void)tenants; (void)count; (void)session;
+    (void)server_ip; (void)server_port; (void)timeout;
+}
+
+#endif
+
+size_t tenants_format(const Tenant* tenants, int count, char* buf, size_t len) {
+    size_t used = 0;
+
+    for (int i = 0; i < count && used < len; i++) {
+        const Tenant* t = &tenants[i];
+        char verified[20] = "-";
+
+        if (t->last_verified) {
+            strftime(verified, sizeof(verified), "%Y-%m-%d %H:%M:%S", localtime(&t->last_verified));
+        }
+        int written = snprintf(buf + used, len - used, "tenant %s: netns=%s address=%s status=%s last_verified=%s\n",
+                               t->name, t->netns, t->address[0] ? t->address : "-", t->status, verified);
+        if (written < 0) {
+            break;
+        }
+        used += (size_t)written;
+    }
+    return used < len ? used : len;
+}
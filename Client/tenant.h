@@ -0,0 +1,48 @@
+#ifndef TENANT_H
+#define TENANT_H
+
+#include <stddef.h>
+#include <time.h>
+
+#include "libs/public_address_detector.h"
+
+// 多租户：一个后台进程为多个网络命名空间（容器、VRF等）维护各自的DNS记录
+// 每轮检测由少量工作线程分担，线程通过setns进入租户的命名空间，
+// 在其中枚举地址（getifaddrs）并探测，所有租户共用同一个服务端会话和检测周期（仅Linux）
+
+#define TENANT_MAX 256
+#define TENANT_WORKERS 4        // 同时检测的租户数
+
+#define TENANT_ADDR_LEN 64
+
+typedef struct {
+    int index;                      // Go侧配置中的租户序号
+    char name[64];
+    char record[128];               // 服务端内置DNS中的记录名，挂在主机的客户端标识之下
+    char netns[256];                // 命名空间文件路径
+    int ns_fd;                      // 打开的命名空间，-1表示不可用
+    char address[TENANT_ADDR_LEN];  // 最近一次验证通过的地址
+    int changed;                    // 本轮验证通过的地址与之前不同，需要更新DNS
+    int publish_pending;            // DNS记录尚未更新成功，下一轮重试
+    int verified;                   // 本轮是否有地址验证通过
+    int candidates;                 // 本轮命名空间中的候选地址数
+    const char* status;             // 最近一轮的检测状态，用于日志和dump
+    time_t last_verified;
+} Tenant;
+
+// 初始化租户，netns为/var/run/netns/下的名字或命名空间文件路径，host为主机的客户端标识
+// 命名空间无法打开时返回-1（租户保留，检测时跳过）
+int tenant_init(Tenant* tenant, int index, const char* name, const char* netns, const char* host);
+
+// 关闭命名空间
+void tenant_release(Tenant* tenant);
+
+// 检测所有租户，结果写回各租户的address/changed/verified
+// session不为NULL时通过会话探测，否则在命名空间内直接连接服务端
+void tenants_detect(Tenant* tenants, int count, DetectorSession* session,
+                    const char* server_ip, int server_port, int timeout);
+
+// 输出各租户状态（dump命令），返回写入的字节数
+size_t tenants_format(const Tenant* tenants, int count, char* buf, size_t len);
+
+#endif // TENANT_H
@@ -0,0 +1,113 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef _WIN32
+    #include <windows.h>
+#endif
+
+#include "trace.h"
+
+typedef struct {
+    long long count;
+    long long total_us;
+    long long max_us;
+    long long buckets[TRACE_BUCKETS];
+} StageStats;
+
+static const char* stage_names[TRACE_STAGE_COUNT] = {
+    "system_ips", "reflexive", "probe", "dns_lookup", "dns_update", "detect", "ddns_cycle", "tenants"
+};
+
+static StageStats stats[TRACE_STAGE_COUNT];
+
+long long trace_now_us(void) {
+#ifdef _WIN32
+    LARGE_INTEGER freq, now;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return now.QuadPart / freq.QuadPart * 1000000 + now.QuadPart % freq.QuadPart * 1000000 / freq.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
+void trace_record(TraceStage stage, long long micros) {
+    if (stage < 0 || stage >= TRACE_STAGE_COUNT) {
+        return;
+    }
+    if (micros < 0) {
+        micros = 0;
+    }
+
+    int bucket = 0;
+    while (bucket < TRACE_BUCKETS - 1 && (micros >> bucket) > 0) {
+        bucket++;
+    }
+
+    StageStats* s = &stats[stage];
+    s->count++;
+    s->total_us += micros;
+    if (micros > s->max_us) {
+        s->max_us = micros;
+    }
+    s->buckets[bucket]++;
+}
+
+void trace_reset(void) {
+    memset(stats, 0, sizeof(stats));
+}
+
+// 估算分位数：返回累计样本数达到比例的桶上界（微秒）
+static long long percentile_bound(const StageStats* s, int percent) {
+    long long target = (s->count * percent + 99) / 100;
+    long long seen = 0;
+
+    for (int i = 0; i < TRACE_BUCKETS; i++) {
+        seen += s->buckets[i];
+        if (seen >= target) {
+            return 1LL << i;
+        }
+    }
+    return s->max_us;
+}
+
+int trace_format(char* buf, size_t len) {
+    size_t used = 0;
+
+    used += snprintf(buf + used, len - used, "%-11s %8s %10s %10s %10s %10s\n",
+                     "stage", "count", "avg_ms", "max_ms", "p50<=ms", "p99<=ms");
+
+    for (int i = 0; i < TRACE_STAGE_COUNT && used < len; i++) {
+        const StageStats* s = &stats[i];
+        if (s->count == 0) {
+            used += snprintf(buf + used, len - used, "%-11s %8d\n", stage_names[i], 0);
+            continue;
+        }
+        used += snprintf(buf + used, len - used, "%-11s %8lld %10.2f %10.2f %10.2f %10.2f\n",
+                         stage_names[i], s->count,
+                         s->total_us / 1000.0 / s->count, s->max_us / 1000.0,
+                         percentile_bound(s, 50) / 1000.0, percentile_bound(s, 99) / 1000.0);
+    }
+
+    // 非空桶明细，格式为 上界:样本数
+    for (int i = 0; i < TRACE_STAGE_COUNT && used < len; i++) {
+        const StageStats* s = &stats[i];
+        if (s->count == 0) {
+            continue;
+        }
+        used += snprintf(buf + used, len - used, "hist %s", stage_names[i]);
+        for (int b = 0; b < TRACE_BUCKETS && used < len; b++) {
+            if (s->buckets[b] > 0) {
+                used += snprintf(buf + used, len - used, " <%lldus:%lld", 1LL << b, s->buckets[b]);
+            }
+        }
+        if (used < len) {
+            used += snprintf(buf + used, len - used, "\n");
+        }
+    }
+
+    return used < len ? (int)used : (int)len - 1;
+}
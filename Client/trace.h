@@ -0,0 +1,35 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stddef.h>
+
+// 各阶段耗时统计：单调时钟计时，按log2(微秒)分桶累计直方图
+
+// 阶段编号，前几个与DDNSResult中的DDNS_STAGE_*一致
+typedef enum {
+    TRACE_SYSTEM_IPS = 0,   // 枚举本机地址
+    TRACE_REFLEXIVE,        // 查询反射地址
+    TRACE_PROBE,            // Go侧逐个地址探测
+    TRACE_DNS_LOOKUP,       // 查询Cloudflare记录
+    TRACE_DNS_UPDATE,       // 创建/更新Cloudflare记录
+    TRACE_DETECT,           // 周期检测（run_detection）
+    TRACE_DDNS_CYCLE,       // 一次完整的update_ddns_config
+    TRACE_TENANTS,          // 一轮所有租户命名空间的检测
+    TRACE_STAGE_COUNT
+} TraceStage;
+
+#define TRACE_BUCKETS 32    // 第i个桶统计耗时 < 2^i 微秒的样本
+
+// 当前单调时钟（微秒）
+long long trace_now_us(void);
+
+// 记录一个阶段耗时
+void trace_record(TraceStage stage, long long micros);
+
+// 清空统计
+void trace_reset(void);
+
+// 以文本形式输出各阶段统计，返回写入的字节数
+int trace_format(char* buf, size_t len);
+
+#endif // TRACE_H
@@ -7,7 +7,10 @@ echo "编译服务端..."
 echo "编译 server.c..."
 rm ./bin/server
 mkdir bin
-gcc -o ./bin/server server.c
+gcc -o ./bin/server server.c syn_probe.c probe_queue.c handoff.c journal.c source_pool.c tls_channel.c dns_responder.c -DDDNS_WITH_TLS -lssl -lcrypto -lpthread
+
+echo "编译探测日志读取工具..."
+gcc -o ./bin/journal_reader ../Tools/journal_reader.c journal.c -I.
 
 echo "编译完成！"
-echo "可执行文件: ./bin/server"
\ No newline at end of file
+echo "可执行文件: ./bin/server ./bin/journal_reader"
\ No newline at end of file
@@ -0,0 +1,948 @@
+#define _GNU_SOURCE  // recvmmsg/sendmmsg, in6_pktinfo
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include "dns_responder.h"
+
+#define DNS_HEADER_LEN 12
+#define DNS_BATCH 32                // 每次recvmmsg/sendmmsg的报文数
+#define DNS_QUERY_MAX 1232          // 接收的查询上限（EDNS推荐的UDP负载大小）
+#define DNS_UDP_REPLY_MAX 512       // 不支持EDNS，UDP应答超过512字节时置TC
+#define DNS_TCP_REPLY_MAX 4096
+#define DNS_TCP_CONNS 64
+#define DNS_TCP_IDLE_SEC 10
+#define DNS_UDP_RCVBUF (4 << 20)    // 突发查询的接收缓冲，实际大小受net.core.rmem_max限制
+#define DNS_CONTROL_LEN CMSG_SPACE(sizeof(struct in6_pktinfo))
+
+#define DNS_TYPE_A 1
+#define DNS_TYPE_NS 2
+#define DNS_TYPE_SOA 6
+#define DNS_TYPE_AAAA 28
+#define DNS_TYPE_ANY 255
+#define DNS_CLASS_IN 1
+#define DNS_CLASS_ANY 255
+
+#define DNS_RCODE_FORMERR 1
+#define DNS_RCODE_NXDOMAIN 3
+#define DNS_RCODE_NOTIMP 4
+#define DNS_RCODE_REFUSED 5
+
+// epoll事件标记，TCP连接为DNS_TAG_CONN + 下标
+#define DNS_TAG_UDP 0
+#define DNS_TAG_TCP 1
+#define DNS_TAG_STOP 2
+#define DNS_TAG_SAVE 3
+#define DNS_TAG_CONN 4
+
+// 记录的地址，由seq保护
+typedef struct {
+    uint8_t a[4];
+    uint8_t aaaa[16];
+    uint8_t has_a;
+    uint8_t has_aaaa;
+} dns_addrs;
+
+typedef struct {
+    int used;                               // 登记后置1，此后name不再改变
+    char name[DNS_RESPONDER_NAME_MAX + 1];  // 小写的相对名
+    unsigned int seq;                       // 奇数表示正在写入
+    dns_addrs addrs;                        // 都为空时是点分名字的父名（空非终端）
+} dns_record;
+
+typedef struct {
+    int fd;                                 // -1表示空闲
+    size_t len;
+    time_t last_active;
+    uint8_t buf[2 + DNS_QUERY_MAX];
+} dns_tcp_conn;
+
+// 一批UDP报文的收发缓冲
+typedef struct {
+    struct mmsghdr in[DNS_BATCH];
+    struct mmsghdr out[DNS_BATCH];
+    struct iovec in_iov[DNS_BATCH];
+    struct iovec out_iov[DNS_BATCH];
+    struct sockaddr_in6 peer[DNS_BATCH];
+    uint8_t in_control[DNS_BATCH][DNS_CONTROL_LEN];
+    uint8_t out_control[DNS_BATCH][DNS_CONTROL_LEN];
+    uint8_t query[DNS_BATCH][DNS_QUERY_MAX];
+    uint8_t reply[DNS_BATCH][DNS_UDP_REPLY_MAX];
+} dns_batch;
+
+struct dns_responder {
+    char zone[256];                         // 小写，不带结尾的点
+    size_t zone_len;
+    size_t zone_wire_len;                   // 区域名的线路格式长度
+    uint8_t ns_wire[256];                   // NS记录和SOA MNAME
+    size_t ns_wire_len;
+    uint8_t soa_names[512];                 // SOA的MNAME和RNAME
+    size_t soa_names_len;
+    uint32_t ttl;
+    uint32_t serial;                        // 每次记录变化加一
+
+    int udp_fd;
+    int udp_pktinfo;                        // UDP套接字回报目的地址，应答从同一地址发出
+    int tcp_fd;
+    int epoll_fd;
+    int stop_fd;
+    int save_fd;                            // 记录变化后通知应答线程重写快照（eventfd）
+    pthread_t thread;
+    int running;                            // 应答线程在运行
+
+    pthread_mutex_t write_lock;             // 串行化写入方
+    char *snapshot;                         // 快照文件，NULL表示不保存；只由应答线程写入
+    char *snapshot_tmp;                     // 按进程区分的临时文件，平滑升级时两个进程不会写同一个
+    int retired;                            // 已交给接替的进程，不再接受写入（write_lock保护）
+    int record_count;
+    dns_record *records;
+
+    dns_tcp_conn conns[DNS_TCP_CONNS];      // 仅应答线程访问
+    dns_batch *batch;
+
+    // 应答统计，由应答线程更新，STATS读取
+    unsigned long queries, answered, nodata, nxdomain, refused, malformed, truncated, tcp_queries;
+};
+
+static uint16_t get16(const uint8_t *p) {
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static void put16(uint8_t *p, uint16_t v) {
+    p[0] = (uint8_t)(v >> 8);
+    p[1] = (uint8_t)v;
+}
+
+static void put32(uint8_t *p, uint32_t v) {
+    put16(p, (uint16_t)(v >> 16));
+    put16(p + 2, (uint16_t)v);
+}
+
+// 标签中允许的字符：字母、数字、连字符和下划线
+static int is_label_char(unsigned char ch) {
+    return isalnum(ch) || ch == '-' || ch == '_';
+}
+
+// 把点分名字转换为小写并检查各标签（允许的字符见is_label_char，每段1-63字节），失败返回-1
+static int normalize_name(const char *name, char *out, size_t len) {
+    size_t n = strlen(name);
+    size_t label = 0;
+
+    if (n > 0 && name[n - 1] == '.') {
+        n--;
+    }
+    if (n == 0 || n >= len) {
+        return -1;
+    }
+    for (size_t i = 0; i < n; i++) {
+        unsigned char ch = (unsigned char)name[i];
+        if (ch == '.') {
+            if (label == 0) {
+                return -1;
+            }
+            label = 0;
+        } else if (is_label_char(ch)) {
+            if (++label > 63) {
+                return -1;
+            }
+        } else {
+            return -1;
+        }
+        out[i] = (char)tolower(ch);
+    }
+    if (label == 0) {
+        return -1;
+    }
+    out[n] = '\0';
+    return 0;
+}
+
+// 已规范化的点分名字转换为线路格式，返回长度，超出cap时返回0
+static size_t name_to_wire(const char *name, uint8_t *out, size_t cap) {
+    size_t pos = 0;
+
+    while (*name) {
+        const char *dot = strchr(name, '.');
+        size_t label = dot ? (size_t)(dot - name) : strlen(name);
+
+        if (pos + 1 + label + 1 > cap) {
+            return 0;
+        }
+        out[pos++] = (uint8_t)label;
+        memcpy(out + pos, name, label);
+        pos += label;
+        name += label + (dot ? 1 : 0);
+    }
+    out[pos++] = 0;
+    return pos;
+}
+
+static unsigned long name_hash(const char *name) {
+    unsigned long h = 5381;
+
+    for (const char *p = name; *p; p++) {
+        h = h * 33 + (unsigned char)*p;
+    }
+    return h;
+}
+
+// 查找记录，应答线程无锁调用：槽位登记后只会被写入地址，不会被移除或改名
+static const dns_record *record_find(const dns_responder *d, const char *name) {
+    unsigned long h = name_hash(name);
+
+    for (size_t i = 0; i < DNS_RESPONDER_RECORDS; i++) {
+        const dns_record *r = &d->records[(h + i) % DNS_RESPONDER_RECORDS];
+        if (!__atomic_load_n(&r->used, __ATOMIC_ACQUIRE)) {
+            return NULL;
+        }
+        if (strcmp(r->name, name) == 0) {
+            return r;
+        }
+    }
+    return NULL;
+}
+
+// 查找或登记记录，调用方持有write_lock；记录表已满时返回NULL
+static dns_record *record_claim(dns_responder *d, const char *name) {
+    unsigned long h = name_hash(name);
+
+    for (size_t i = 0; i < DNS_RESPONDER_RECORDS; i++) {
+        dns_record *r = &d->records[(h + i) % DNS_RESPONDER_RECORDS];
+        if (!r->used) {
+            if (d->record_count >= DNS_RESPONDER_RECORDS - 1) {
+                return NULL;    // 至少保留一个空槽，查找总能终止
+            }
+            snprintf(r->name, sizeof(r->name), "%s", name);
+            __atomic_store_n(&r->used, 1, __ATOMIC_RELEASE);
+            d->record_count++;
+            return r;
+        }
+        if (strcmp(r->name, name) == 0) {
+            return r;
+        }
+    }
+    return NULL;
+}
+
+// 读取地址的一致快照，写入方正在更新时重读
+static void record_read(const dns_record *r, dns_addrs *out) {
+    unsigned int begin, end;
+
+    do {
+        begin = __atomic_load_n(&r->seq, __ATOMIC_ACQUIRE);
+        memcpy(out, &r->addrs, sizeof(*out));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        end = __atomic_load_n(&r->seq, __ATOMIC_RELAXED);
+    } while ((begin & 1) || begin != end);
+}
+
+// 写入一条地址，调用方持有write_lock；返回值同dns_responder_publish
+static int record_store(dns_responder *d, const char *name, const char *ip) {
+    char lower[DNS_RESPONDER_NAME_MAX + 1];
+    uint8_t addr[16];
+    int family;
+
+    if (normalize_name(name, lower, sizeof(lower)) < 0 || strlen(lower) + 1 + d->zone_len > 253) {
+        return -1;
+    }
+    if (inet_pton(AF_INET, ip, addr) == 1) {
+        family = AF_INET;
+    } else if (inet_pton(AF_INET6, ip, addr) == 1) {
+        family = AF_INET6;
+    } else {
+        return -1;
+    }
+
+    dns_record *r = record_claim(d, lower);
+    // 点分名字的各级父名登记为空非终端，逐级查询（QNAME最小化）的解析器得到NODATA而不是NXDOMAIN
+    for (const char *p = strchr(lower, '.'); r && p; p = strchr(p + 1, '.')) {
+        record_claim(d, p + 1);
+    }
+
+    int changed = -1;
+    if (r) {
+        dns_addrs next = r->addrs;
+        if (family == AF_INET) {
+            changed = !next.has_a || memcmp(next.a, addr, 4) != 0;
+            memcpy(next.a, addr, 4);
+            next.has_a = 1;
+        } else {
+            changed = !next.has_aaaa || memcmp(next.aaaa, addr, 16) != 0;
+            memcpy(next.aaaa, addr, 16);
+            next.has_aaaa = 1;
+        }
+        if (changed) {
+            __atomic_store_n(&r->seq, r->seq + 1, __ATOMIC_RELAXED);
+            __atomic_thread_fence(__ATOMIC_RELEASE);
+            memcpy(&r->addrs, &next, sizeof(next));
+            __atomic_store_n(&r->seq, r->seq + 1, __ATOMIC_RELEASE);
+            __atomic_add_fetch(&d->serial, 1, __ATOMIC_RELAXED);
+        }
+    }
+    return changed;
+}
+
+// 整表写入快照文件（应答线程调用，与写入方一样按seqlock读取记录，不持有write_lock）：
+// 先写临时文件并落盘，再rename覆盖，每行为"名字 地址"
+static int snapshot_save(dns_responder *d) {
+    char ip[INET6_ADDRSTRLEN];
+    dns_addrs addrs;
+
+    FILE *f = fopen(d->snapshot_tmp, "w");
+    if (!f) {
+        return -1;
+    }
+    for (size_t i = 0; i < DNS_RESPONDER_RECORDS; i++) {
+        const dns_record *r = &d->records[i];
+        if (!__atomic_load_n(&r->used, __ATOMIC_ACQUIRE)) {
+            continue;
+        }
+        record_read(r, &addrs);
+        if (addrs.has_a && inet_ntop(AF_INET, addrs.a, ip, sizeof(ip))) {
+            fprintf(f, "%s %s\n", r->name, ip);
+        }
+        if (addrs.has_aaaa && inet_ntop(AF_INET6, addrs.aaaa, ip, sizeof(ip))) {
+            fprintf(f, "%s %s\n", r->name, ip);
+        }
+    }
+    if (fflush(f) != 0 || fsync(fileno(f)) < 0) {
+        fclose(f);
+        unlink(d->snapshot_tmp);
+        return -1;
+    }
+    if (fclose(f) != 0 || rename(d->snapshot_tmp, d->snapshot) < 0) {
+        unlink(d->snapshot_tmp);
+        return -1;
+    }
+    return 0;
+}
+
+// 载入快照文件，不存在时从空表开始；返回载入的地址数
+static int snapshot_load(dns_responder *d) {
+    char line[256], name[DNS_RESPONDER_NAME_MAX + 1], ip[INET6_ADDRSTRLEN];
+    int loaded = 0;
+
+    FILE *f = fopen(d->snapshot, "r");
+    if (!f) {
+        return 0;
+    }
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "%63s %45s", name, ip) == 2 && record_store(d, name, ip) >= 0) {
+            loaded++;
+        }
+    }
+    fclose(f);
+    return loaded;
+}
+
+int dns_responder_publish(dns_responder *d, const char *name, const char *ip) {
+    uint64_t one = 1;
+
+    pthread_mutex_lock(&d->write_lock);
+    int changed = d->retired ? -1 : record_store(d, name, ip);
+    pthread_mutex_unlock(&d->write_lock);
+
+    // 快照由应答线程重写，探测线程不做文件操作；连续的变化合并为一次重写
+    if (changed == 1 && d->snapshot && write(d->save_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        perror("Scheduling DNS snapshot failed");
+    }
+    return changed;
+}
+
+// 追加一条资源记录，name_ptr为指向报文中已有名字的压缩指针，空间不足时返回-1
+static int put_rr(uint8_t *out, size_t cap, size_t *pos, uint16_t name_ptr, uint16_t type,
+                  uint32_t ttl, const uint8_t *rdata, size_t rdlen) {
+    if (*pos + 12 + rdlen > cap) {
+        return -1;
+    }
+    uint8_t *p = out + *pos;
+    put16(p, (uint16_t)(0xC000 | name_ptr));
+    put16(p + 2, type);
+    put16(p + 4, DNS_CLASS_IN);
+    put32(p + 6, ttl);
+    put16(p + 10, (uint16_t)rdlen);
+    memcpy(p + 12, rdata, rdlen);
+    *pos += 12 + rdlen;
+    return 0;
+}
+
+static int put_soa(dns_responder *d, uint8_t *out, size_t cap, size_t *pos, uint16_t zone_ptr) {
+    uint8_t rdata[sizeof(d->soa_names) + 20];
+
+    memcpy(rdata, d->soa_names, d->soa_names_len);
+    uint8_t *p = rdata + d->soa_names_len;
+    put32(p, __atomic_load_n(&d->serial, __ATOMIC_RELAXED));
+    put32(p + 4, 3600);         // refresh
+    put32(p + 8, 600);          // retry
+    put32(p + 12, 1209600);     // expire
+    put32(p + 16, d->ttl);      // 否定应答缓存时间
+    return put_rr(out, cap, pos, zone_ptr, DNS_TYPE_SOA, d->ttl, rdata, d->soa_names_len + 20);
+}
+
+// 应答一个查询，返回应答长度，0表示丢弃（不是查询或过短）
+static size_t dns_answer(dns_responder *d, const uint8_t *q, size_t qlen, uint8_t *out, size_t cap) {
+    char name[256];
+    size_t nlen = 0;
+    size_t pos = DNS_HEADER_LEN;
+    int hostname = 1;
+
+    if (qlen < DNS_HEADER_LEN || (q[2] & 0x80) || cap < DNS_HEADER_LEN) {
+        return 0;
+    }
+    d->queries++;
+
+    // 应答头：回显ID、操作码和RD，不提供递归
+    memset(out, 0, DNS_HEADER_LEN);
+    out[0] = q[0];
+    out[1] = q[1];
+    out[2] = (uint8_t)(0x80 | (q[2] & 0x79));
+
+    if (((q[2] >> 3) & 0x0f) != 0) {
+        d->malformed++;
+        out[3] = DNS_RCODE_NOTIMP;
+        return DNS_HEADER_LEN;
+    }
+    if (get16(q + 4) != 1) {
+        d->malformed++;
+        out[3] = DNS_RCODE_FORMERR;
+        return DNS_HEADER_LEN;
+    }
+
+    // 问题中的名字不会使用压缩指针
+    for (;;) {
+        if (pos >= qlen) {
+            d->malformed++;
+            out[3] = DNS_RCODE_FORMERR;
+            return DNS_HEADER_LEN;
+        }
+        size_t label = q[pos++];
+        if (label == 0) {
+            break;
+        }
+        if (label > 63 || pos + label > qlen || nlen + label + 2 > sizeof(name)) {
+            d->malformed++;
+            out[3] = DNS_RCODE_FORMERR;
+            return DNS_HEADER_LEN;
+        }
+        if (nlen > 0) {
+            name[nlen++] = '.';
+        }
+        for (size_t i = 0; i < label; i++) {
+            // 标签中的'.'或NUL会让点分名字与线路格式对不上，区域名的压缩指针随之错位
+            hostname &= is_label_char(q[pos + i]);
+            name[nlen++] = (char)tolower(q[pos + i]);
+        }
+        pos += label;
+    }
+    name[nlen] = '\0';
+    if (pos + 4 > qlen || pos + 4 > cap) {
+        d->malformed++;
+        out[3] = DNS_RCODE_FORMERR;
+        return DNS_HEADER_LEN;
+    }
+    size_t qname_wire_len = pos - DNS_HEADER_LEN;
+    uint16_t qtype = get16(q + pos);
+    uint16_t qclass = get16(q + pos + 2);
+    pos += 4;
+
+    memcpy(out + DNS_HEADER_LEN, q + DNS_HEADER_LEN, pos - DNS_HEADER_LEN);
+    put16(out + 4, 1);
+    size_t question_end = pos;
+
+    // 只应答本区域内的IN查询，记录名只含主机名字符，其他名字不可能属于本区域
+    int apex = hostname && strcmp(name, d->zone) == 0;
+    int inside = hostname && nlen > d->zone_len && name[nlen - d->zone_len - 1] == '.' &&
+                 strcmp(name + nlen - d->zone_len, d->zone) == 0;
+    if ((qclass != DNS_CLASS_IN && qclass != DNS_CLASS_ANY) || (!apex && !inside)) {
+        d->refused++;
+        out[3] = DNS_RCODE_REFUSED;
+        return question_end;
+    }
+    out[2] |= 0x04;     // AA
+
+    // 问题中区域名部分的偏移，作为区域名的压缩指针
+    uint16_t zone_ptr = (uint16_t)(DNS_HEADER_LEN + qname_wire_len - d->zone_wire_len);
+    int answers = 0, overflow = 0;
+
+    if (apex) {
+        if (qtype == DNS_TYPE_SOA || qtype == DNS_TYPE_ANY) {
+            overflow |= put_soa(d, out, cap, &pos, zone_ptr);
+            answers++;
+        }
+        if (qtype == DNS_TYPE_NS || qtype == DNS_TYPE_ANY) {
+            overflow |= put_rr(out, cap, &pos, zone_ptr, DNS_TYPE_NS, d->ttl, d->ns_wire, d->ns_wire_len);
+            answers++;
+        }
+    } else {
+        name[nlen - d->zone_len - 1] = '\0';
+        const dns_record *r = record_find(d, name);
+        if (!r) {
+            out[3] = DNS_RCODE_NXDOMAIN;
+        } else {
+            dns_addrs addrs;
+            record_read(r, &addrs);
+            if (addrs.has_a && (qtype == DNS_TYPE_A || qtype == DNS_TYPE_ANY)) {
+                overflow |= put_rr(out, cap, &pos, DNS_HEADER_LEN, DNS_TYPE_A, d->ttl, addrs.a, 4);
+                answers++;
+            }
+            if (addrs.has_aaaa && (qtype == DNS_TYPE_AAAA || qtype == DNS_TYPE_ANY)) {
+                overflow |= put_rr(out, cap, &pos, DNS_HEADER_LEN, DNS_TYPE_AAAA, d->ttl, addrs.aaaa, 16);
+                answers++;
+            }
+        }
+    }
+    put16(out + 6, (uint16_t)answers);
+
+    // NODATA和NXDOMAIN在授权段附带SOA，解析器据此缓存否定应答
+    if (answers == 0) {
+        overflow |= put_soa(d, out, cap, &pos, zone_ptr);
+        put16(out + 8, 1);
+    }
+
+    if (overflow) {
+        d->truncated++;
+        out[2] |= 0x02;     // TC，客户端改用TCP重试
+        memset(out + 6, 0, 6);
+        return question_end;
+    }
+    if (answers > 0) {
+        d->answered++;
+    } else if (out[3] == DNS_RCODE_NXDOMAIN) {
+        d->nxdomain++;
+    } else {
+        d->nodata++;
+    }
+    return pos;
+}
+
+// 批量收取UDP查询并批量应答，直到套接字读空
+static void serve_udp(dns_responder *d) {
+    dns_batch *b = d->batch;
+
+    for (;;) {
+        for (int i = 0; i < DNS_BATCH; i++) {
+            b->in_iov[i].iov_base = b->query[i];
+            b->in_iov[i].iov_len = DNS_QUERY_MAX;
+            memset(&b->in[i].msg_hdr, 0, sizeof(b->in[i].msg_hdr));
+            b->in[i].msg_hdr.msg_name = &b->peer[i];
+            b->in[i].msg_hdr.msg_namelen = sizeof(b->peer[i]);
+            b->in[i].msg_hdr.msg_iov = &b->in_iov[i];
+            b->in[i].msg_hdr.msg_iovlen = 1;
+            if (d->udp_pktinfo) {
+                b->in[i].msg_hdr.msg_control = b->in_control[i];
+                b->in[i].msg_hdr.msg_controllen = DNS_CONTROL_LEN;
+            }
+        }
+
+        int n = recvmmsg(d->udp_fd, b->in, DNS_BATCH, MSG_DONTWAIT, NULL);
+        if (n <= 0) {
+            return;
+        }
+
+        int m = 0;
+        for (int i = 0; i < n; i++) {
+            size_t len = dns_answer(d, b->query[i], b->in[i].msg_len, b->reply[m], DNS_UDP_REPLY_MAX);
+            if (len == 0) {
+                continue;
+            }
+
+            struct msghdr *h = &b->out[m].msg_hdr;
+            memset(h, 0, sizeof(*h));
+            b->out_iov[m].iov_base = b->reply[m];
+            b->out_iov[m].iov_len = len;
+            h->msg_name = &b->peer[i];
+            h->msg_namelen = b->in[i].msg_hdr.msg_namelen;
+            h->msg_iov = &b->out_iov[m];
+            h->msg_iovlen = 1;
+
+            // 通配地址上的多地址主机：应答从查询的目的地址发出，否则解析器会丢弃
+            struct cmsghdr *cmsg;
+            for (cmsg = CMSG_FIRSTHDR(&b->in[i].msg_hdr); cmsg; cmsg = CMSG_NXTHDR(&b->in[i].msg_hdr, cmsg)) {
+                if (cmsg->cmsg_level == IPPROTO_IPV6 && cmsg->cmsg_type == IPV6_PKTINFO) {
+                    struct in6_pktinfo info;
+                    memcpy(&info, CMSG_DATA(cmsg), sizeof(info));
+                    info.ipi6_ifindex = 0;
+
+                    h->msg_control = b->out_control[m];
+                    h->msg_controllen = DNS_CONTROL_LEN;
+                    struct cmsghdr *reply = CMSG_FIRSTHDR(h);
+                    reply->cmsg_level = IPPROTO_IPV6;
+                    reply->cmsg_type = IPV6_PKTINFO;
+                    reply->cmsg_len = CMSG_LEN(sizeof(info));
+                    memcpy(CMSG_DATA(reply), &info, sizeof(info));
+                    break;
+                }
+            }
+            m++;
+        }
+
+        // 发送缓冲区满时丢弃剩余应答，由解析器重试
+        for (int sent = 0; sent < m; ) {
+            int r = sendmmsg(d->udp_fd, b->out + sent, (unsigned int)(m - sent), MSG_DONTWAIT);
+            if (r <= 0) {
+                break;
+            }
+            sent += r;
+        }
+
+        if (n < DNS_BATCH) {
+            return;
+        }
+    }
+}
+
+static void tcp_close(dns_responder *d, dns_tcp_conn *c) {
+    epoll_ctl(d->epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    c->fd = -1;
+}
+
+static void tcp_accept(dns_responder *d) {
+    for (;;) {
+        int fd = accept4(d->tcp_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            return;
+        }
+
+        dns_tcp_conn *c = NULL;
+        int index;
+        for (index = 0; index < DNS_TCP_CONNS; index++) {
+            if (d->conns[index].fd < 0) {
+                c = &d->conns[index];
+                break;
+            }
+        }
+        if (!c) {
+            close(fd);  // 连接数已满
+            continue;
+        }
+
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.u64 = DNS_TAG_CONN + (uint64_t)index;
+        if (epoll_ctl(d->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            close(fd);
+            continue;
+        }
+        c->fd = fd;
+        c->len = 0;
+        c->last_active = time(NULL);
+    }
+}
+
+// TCP查询以两字节长度为前缀，同一连接上可连续查询
+static void tcp_readable(dns_responder *d, dns_tcp_conn *c) {
+    uint8_t reply[2 + DNS_TCP_REPLY_MAX];
+
+    ssize_t n = recv(c->fd, c->buf + c->len, sizeof(c->buf) - c->len, 0);
+    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+        tcp_close(d, c);
+        return;
+    }
+    if (n < 0) {
+        return;
+    }
+    c->len += (size_t)n;
+    c->last_active = time(NULL);
+
+    while (c->len >= 2) {
+        size_t qlen = get16(c->buf);
+        if (2 + qlen > sizeof(c->buf)) {
+            tcp_close(d, c);
+            return;
+        }
+        if (c->len < 2 + qlen) {
+            return;
+        }
+
+        d->tcp_queries++;
+        size_t len = dns_answer(d, c->buf + 2, qlen, reply + 2, DNS_TCP_REPLY_MAX);
+        if (len == 0) {
+            tcp_close(d, c);
+            return;
+        }
+        put16(reply, (uint16_t)len);
+        if (send(c->fd, reply, len + 2, MSG_NOSIGNAL | MSG_DONTWAIT) != (ssize_t)(len + 2)) {
+            tcp_close(d, c);
+            return;
+        }
+
+        c->len -= 2 + qlen;
+        memmove(c->buf, c->buf + 2 + qlen, c->len);
+    }
+}
+
+static void *dns_thread(void *arg) {
+    dns_responder *d = arg;
+    struct epoll_event events[DNS_BATCH];
+    time_t last_sweep = time(NULL);
+
+    for (;;) {
+        int n = epoll_wait(d->epoll_fd, events, DNS_BATCH, 1000);
+        for (int i = 0; i < n; i++) {
+            uint64_t tag = events[i].data.u64;
+            if (tag == DNS_TAG_STOP) {
+                return NULL;
+            } else if (tag == DNS_TAG_SAVE) {
+                uint64_t pending;
+                // 读出计数即清零，此后的变化会再次唤醒，重写时读到的已包含之前所有变化
+                if (read(d->save_fd, &pending, sizeof(pending)) == sizeof(pending) && snapshot_save(d) < 0) {
+                    perror("Writing DNS snapshot failed");
+                }
+            } else if (tag == DNS_TAG_UDP) {
+                serve_udp(d);
+            } else if (tag == DNS_TAG_TCP) {
+                tcp_accept(d);
+            } else if (d->conns[tag - DNS_TAG_CONN].fd >= 0) {
+                tcp_readable(d, &d->conns[tag - DNS_TAG_CONN]);
+            }
+        }
+
+        // 关闭空闲的TCP连接
+        time_t now = time(NULL);
+        if (now != last_sweep) {
+            last_sweep = now;
+            for (int i = 0; i < DNS_TCP_CONNS; i++) {
+                if (d->conns[i].fd >= 0 && now - d->conns[i].last_active > DNS_TCP_IDLE_SEC) {
+                    tcp_close(d, &d->conns[i]);
+                }
+            }
+        }
+    }
+}
+
+// 创建绑定到port的套接字，优先IPv4/IPv6双栈；多个进程（平滑升级）可同时绑定，
+// 新进程绑定前已载入快照，旧进程开始排空时调用dns_responder_retire退出
+static int dns_socket(int type, int port, int *dual_stack) {
+    int opt = 1;
+    int fd = socket(AF_INET6, type | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+    if (fd >= 0) {
+        struct sockaddr_in6 addr6;
+        int v6only = 0;
+
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+        setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt));
+        setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &v6only, sizeof(v6only));
+
+        memset(&addr6, 0, sizeof(addr6));
+        addr6.sin6_family = AF_INET6;
+        addr6.sin6_addr = in6addr_any;
+        addr6.sin6_port = htons(port);
+        if (bind(fd, (struct sockaddr *)&addr6, sizeof(addr6)) == 0) {
+            *dual_stack = 1;
+            return fd;
+        }
+        close(fd);
+    }
+
+    struct sockaddr_in addr;
+
+    fd = socket(AF_INET, type | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = htons(port);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    *dual_stack = 0;
+    return fd;
+}
+
+static void dns_free(dns_responder *d) {
+    if (d->udp_fd >= 0) close(d->udp_fd);
+    if (d->tcp_fd >= 0) close(d->tcp_fd);
+    if (d->epoll_fd >= 0) close(d->epoll_fd);
+    if (d->stop_fd >= 0) close(d->stop_fd);
+    if (d->save_fd >= 0) close(d->save_fd);
+    for (int i = 0; i < DNS_TCP_CONNS; i++) {
+        if (d->conns[i].fd >= 0) {
+            close(d->conns[i].fd);
+        }
+    }
+    pthread_mutex_destroy(&d->write_lock);
+    free(d->snapshot);
+    free(d->snapshot_tmp);
+    free(d->records);
+    free(d->batch);
+    free(d);
+}
+
+static int dns_watch(dns_responder *d, int fd, uint64_t tag) {
+    struct epoll_event ev;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.u64 = tag;
+    return epoll_ctl(d->epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+dns_responder *dns_responder_start(const char *zone, const char *ns_host, int port, uint32_t ttl,
+                                   const char *snapshot) {
+    char ns[300], rname[300];
+    uint8_t zone_wire[256];
+    int dual_stack = 0;
+
+    dns_responder *d = calloc(1, sizeof(*d));
+    if (!d) {
+        return NULL;
+    }
+    d->udp_fd = d->tcp_fd = d->epoll_fd = d->stop_fd = d->save_fd = -1;
+    for (int i = 0; i < DNS_TCP_CONNS; i++) {
+        d->conns[i].fd = -1;
+    }
+    pthread_mutex_init(&d->write_lock, NULL);
+    d->ttl = ttl;
+    d->serial = (uint32_t)time(NULL);
+
+    // 区域名、NS主机名和SOA中的管理邮箱（hostmaster.<zone>）
+    if (normalize_name(zone, d->zone, sizeof(d->zone)) < 0) {
+        fprintf(stderr, "Invalid DNS zone: %s\n", zone);
+        dns_free(d);
+        return NULL;
+    }
+    d->zone_len = strlen(d->zone);
+    if (!ns_host) {
+        snprintf(ns, sizeof(ns), "ns.%s", d->zone);
+    } else if (normalize_name(ns_host, ns, sizeof(ns)) < 0) {
+        fprintf(stderr, "Invalid DNS name server: %s\n", ns_host);
+        dns_free(d);
+        return NULL;
+    }
+    snprintf(rname, sizeof(rname), "hostmaster.%s", d->zone);
+    d->zone_wire_len = name_to_wire(d->zone, zone_wire, sizeof(zone_wire));
+    d->ns_wire_len = name_to_wire(ns, d->ns_wire, sizeof(d->ns_wire));
+    size_t rname_len = name_to_wire(rname, d->soa_names + d->ns_wire_len,
+                                    sizeof(d->soa_names) - d->ns_wire_len);
+    if (d->zone_wire_len == 0 || d->zone_len > 253 - DNS_RESPONDER_NAME_MAX - 1 ||
+        d->ns_wire_len == 0 || rname_len == 0) {
+        fprintf(stderr, "DNS zone or name server name too long\n");
+        dns_free(d);
+        return NULL;
+    }
+    memcpy(d->soa_names, d->ns_wire, d->ns_wire_len);
+    d->soa_names_len = d->ns_wire_len + rname_len;
+
+    d->records = calloc(DNS_RESPONDER_RECORDS, sizeof(dns_record));
+    if (!d->records) {
+        dns_free(d);
+        return NULL;
+    }
+
+    // 先载入快照再绑定端口：与旧进程共用端口（SO_REUSEPORT）时，新进程一开始应答就有完整的记录
+    if (snapshot) {
+        size_t n = strlen(snapshot) + 32;
+        d->snapshot = strdup(snapshot);
+        d->snapshot_tmp = malloc(n);
+        if (!d->snapshot || !d->snapshot_tmp) {
+            dns_free(d);
+            return NULL;
+        }
+        snprintf(d->snapshot_tmp, n, "%s.%d.tmp", snapshot, (int)getpid());
+        pthread_mutex_lock(&d->write_lock);
+        int loaded = snapshot_load(d);
+        pthread_mutex_unlock(&d->write_lock);
+        printf("Loaded %d DNS records from %s\n", loaded, snapshot);
+    }
+
+    d->batch = calloc(1, sizeof(dns_batch));
+    d->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    d->stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    d->save_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    d->udp_fd = dns_socket(SOCK_DGRAM, port, &dual_stack);
+    if (d->udp_fd >= 0) {
+        int rcvbuf = DNS_UDP_RCVBUF;
+        setsockopt(d->udp_fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    }
+    if (d->udp_fd >= 0 && dual_stack) {
+        int on = 1;
+        d->udp_pktinfo = setsockopt(d->udp_fd, IPPROTO_IPV6, IPV6_RECVPKTINFO, &on, sizeof(on)) == 0;
+    }
+    d->tcp_fd = dns_socket(SOCK_STREAM, port, &dual_stack);
+    if (!d->batch || d->epoll_fd < 0 || d->stop_fd < 0 || d->save_fd < 0 || d->udp_fd < 0 || d->tcp_fd < 0 ||
+        listen(d->tcp_fd, 64) < 0 ||
+        dns_watch(d, d->udp_fd, DNS_TAG_UDP) < 0 || dns_watch(d, d->tcp_fd, DNS_TAG_TCP) < 0 ||
+        dns_watch(d, d->stop_fd, DNS_TAG_STOP) < 0 || dns_watch(d, d->save_fd, DNS_TAG_SAVE) < 0) {
+        perror("DNS responder setup failed");
+        dns_free(d);
+        return NULL;
+    }
+
+    if (pthread_create(&d->thread, NULL, dns_thread, d) != 0) {
+        perror("pthread_create failed");
+        dns_free(d);
+        return NULL;
+    }
+    d->running = 1;
+    return d;
+}
+
+void dns_responder_retire(dns_responder *d) {
+    if (!d || !d->running) {
+        return;
+    }
+
+    // 先拒绝写入：此后的发布失败，客户端改向接替的进程重试，未写入快照的变化不会丢在本进程
+    pthread_mutex_lock(&d->write_lock);
+    d->retired = 1;
+    pthread_mutex_unlock(&d->write_lock);
+
+    uint64_t one = 1;
+    if (write(d->stop_fd, &one, sizeof(one)) == sizeof(one)) {
+        pthread_join(d->thread, NULL);
+        d->running = 0;
+    }
+
+    // 关闭端口后查询全部由接替的进程应答
+    close(d->udp_fd);
+    close(d->tcp_fd);
+    d->udp_fd = d->tcp_fd = -1;
+    for (int i = 0; i < DNS_TCP_CONNS; i++) {
+        if (d->conns[i].fd >= 0) {
+            tcp_close(d, &d->conns[i]);
+        }
+    }
+}
+
+void dns_responder_stop(dns_responder *d) {
+    if (!d) {
+        return;
+    }
+    dns_responder_retire(d);
+    dns_free(d);
+}
+
+size_t dns_responder_format_stats(dns_responder *d, char *out, size_t len) {
+    if (!d || len == 0) {
+        return 0;
+    }
+    int written = snprintf(out, len,
+                           "DNS zone=%s records=%d serial=%u queries=%lu answered=%lu nodata=%lu nxdomain=%lu "
+                           "refused=%lu malformed=%lu truncated=%lu tcp=%lu\n",
+                           d->zone, __atomic_load_n(&d->record_count, __ATOMIC_RELAXED),
+                           __atomic_load_n(&d->serial, __ATOMIC_RELAXED),
+                           d->queries, d->answered, d->nodata, d->nxdomain,
+                           d->refused, d->malformed, d->truncated, d->tcp_queries);
+    return written < 0 ? 0 : ((size_t)written < len ? (size_t)written : len - 1);
+}
@@ -0,0 +1,40 @@
+#ifndef DNS_RESPONDER_H
+#define DNS_RESPONDER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// 内置权威DNS（-D）：服务端直接为父区域委派给它的子区域应答查询
+//
+// 会话中验证通过的地址写入内存记录表，记录名为 <客户端标识或请求中的name=>.<区域>，
+// 地址变化到可解析只隔一次探测和一个TTL，不经过外部DNS API
+// 记录表按名字开放寻址，写入方（探测工作线程）互斥，应答线程按每条记录的序列号无锁读取（seqlock）
+// UDP查询以recvmmsg/sendmmsg批量收发，TCP查询按RFC 7766的长度前缀处理，均在独立的应答线程中完成
+// 指定快照文件时记录变化后由应答线程整表重写到文件（连续的变化合并为一次），
+// 重启或平滑升级的新进程先载入快照再绑定端口，
+// 避免以空表应答NXDOMAIN而被解析器作为否定应答缓存
+
+#define DNS_RESPONDER_RECORDS 4096  // 记录表容量（名字数，含点分名字的各级父名）
+#define DNS_RESPONDER_NAME_MAX 63   // 区域内相对名的最大长度
+
+typedef struct dns_responder dns_responder;
+
+// 在port的UDP和TCP上为zone应答，ns_host为NS/SOA中的主服务器名（NULL时为ns.<zone>），
+// ttl同时用作否定应答的缓存时间，snapshot为记录快照文件（NULL时不保存）；启动应答线程，失败返回NULL
+dns_responder *dns_responder_start(const char *zone, const char *ns_host, int port, uint32_t ttl,
+                                   const char *snapshot);
+
+// 停止应答并关闭端口，此后发布失败、不再写快照（已由接替的进程负责）；记录表保留到dns_responder_stop
+void dns_responder_retire(dns_responder *d);
+
+// 停止应答线程并释放
+void dns_responder_stop(dns_responder *d);
+
+// 把name.<zone>指向ip（IPv4写A记录，IPv6写AAAA记录），name不区分大小写，可含点
+// 返回1表示记录已更新，0表示地址未变；name或ip无效、记录表已满或已retire时返回-1。可由任意线程调用
+int dns_responder_publish(dns_responder *d, const char *name, const char *ip);
+
+// 输出应答统计行，返回写入长度；d为NULL时不输出
+size_t dns_responder_format_stats(dns_responder *d, char *out, size_t len);
+
+#endif // DNS_RESPONDER_H
@@ -0,0 +1,236 @@
+#define _GNU_SOURCE  // accept4
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <time.h>
+#include <sys/un.h>
+
+#include "handoff.h"
+
+#define LISTEN_FDS_START 3   // systemd传递的第一个fd
+
+static int fill_unix_addr(const char *path, struct sockaddr_un *addr) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr->sun_path)) {
+        fprintf(stderr, "Handoff socket path too long: %s\n", path);
+        return -1;
+    }
+    strcpy(addr->sun_path, path);
+    return 0;
+}
+
+static void set_timeouts(int fd) {
+    struct timeval tv = { HANDOFF_TIMEOUT_SEC, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+// 旧进程一侧的交接状态
+enum {
+    PEER_WAIT_HANDOFF,   // 等待新进程请求
+    PEER_WAIT_READY      // 已传出监听fd，等待新进程开始accept
+};
+
+struct handoff_peer {
+    int fd;
+    int stage;
+    time_t started;
+    char buf[32];
+    size_t len;
+};
+
+int handoff_listen(const char *path) {
+    struct sockaddr_un addr;
+
+    if (fill_unix_addr(path, &addr) < 0) {
+        return -1;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("Handoff socket creation failed");
+        return -1;
+    }
+
+    // 只允许同一用户的进程接管
+    unlink(path);
+    mode_t old_mask = umask(077);
+    int ret = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+    umask(old_mask);
+
+    if (ret < 0 || listen(fd, 1) < 0) {
+        perror("Handoff socket bind failed");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+handoff_peer *handoff_accept(int handoff_fd) {
+    int fd = accept4(handoff_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    handoff_peer *p = calloc(1, sizeof(*p));
+    if (!p) {
+        close(fd);
+        return NULL;
+    }
+    p->fd = fd;
+    p->stage = PEER_WAIT_HANDOFF;
+    p->started = time(NULL);
+    return p;
+}
+
+int handoff_peer_fd(const handoff_peer *p) {
+    return p->fd;
+}
+
+static int send_listen_fd(int fd, int listen_fd) {
+    char dummy = 'F';
+    struct iovec iov = { &dummy, 1 };
+    union {
+        char buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    struct msghdr msg;
+
+    memset(&msg, 0, sizeof(msg));
+    memset(&control, 0, sizeof(control));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &listen_fd, sizeof(int));
+
+    // 新建的Unix域连接发送缓冲为空，一个字节的消息不会阻塞
+    if (sendmsg(fd, &msg, MSG_NOSIGNAL) < 0) {
+        perror("Handoff sendmsg failed");
+        return -1;
+    }
+    return 0;
+}
+
+int handoff_step(handoff_peer *p, int listen_fd) {
+    for (;;) {
+        ssize_t n = recv(p->fd, p->buf + p->len, sizeof(p->buf) - 1 - p->len, 0);
+        if (n == 0) {
+            return HANDOFF_ERROR;
+        }
+        if (n < 0) {
+            return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ? HANDOFF_WANT : HANDOFF_ERROR;
+        }
+        p->len += (size_t)n;
+
+        char *nl;
+        while ((nl = memchr(p->buf, '\n', p->len)) != NULL) {
+            *nl = '\0';
+            const char *expected = p->stage == PEER_WAIT_HANDOFF ? "HANDOFF" : "READY";
+            if (strcmp(p->buf, expected) != 0) {
+                return HANDOFF_ERROR;
+            }
+            p->len -= (size_t)(nl + 1 - p->buf);
+            memmove(p->buf, nl + 1, p->len);
+
+            if (p->stage == PEER_WAIT_READY) {
+                return HANDOFF_DONE;
+            }
+            if (send_listen_fd(p->fd, listen_fd) < 0) {
+                return HANDOFF_ERROR;
+            }
+            p->stage = PEER_WAIT_READY;
+        }
+        if (p->len >= sizeof(p->buf) - 1) {
+            return HANDOFF_ERROR;
+        }
+    }
+}
+
+int handoff_expired(const handoff_peer *p, time_t now) {
+    return now - p->started > HANDOFF_TIMEOUT_SEC;
+}
+
+void handoff_peer_free(handoff_peer *p) {
+    if (p) {
+        close(p->fd);
+        free(p);
+    }
+}
+
+int handoff_request(const char *path, int *listen_fd) {
+    struct sockaddr_un addr;
+    char dummy;
+    struct iovec iov = { &dummy, 1 };
+    union {
+        char buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    struct msghdr msg;
+
+    if (fill_unix_addr(path, &addr) < 0) {
+        return -1;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    set_timeouts(fd);
+
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        send(fd, "HANDOFF\n", 8, MSG_NOSIGNAL) != 8) {
+        close(fd);
+        return -1;
+    }
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    if (recvmsg(fd, &msg, MSG_CMSG_CLOEXEC) <= 0) {
+        close(fd);
+        return -1;
+    }
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (!cmsg || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+        close(fd);
+        return -1;
+    }
+    memcpy(listen_fd, CMSG_DATA(cmsg), sizeof(int));
+    return fd;
+}
+
+int handoff_ready(int conn_fd) {
+    int ret = send(conn_fd, "READY\n", 6, MSG_NOSIGNAL) == 6 ? 0 : -1;
+    close(conn_fd);
+    return ret;
+}
+
+int inherited_listen_fd(void) {
+    const char *pid = getenv("LISTEN_PID");
+    const char *fds = getenv("LISTEN_FDS");
+
+    if (!pid || !fds || atoi(pid) != getpid() || atoi(fds) < 1) {
+        return -1;
+    }
+
+    fcntl(LISTEN_FDS_START, F_SETFD, FD_CLOEXEC);
+    return LISTEN_FDS_START;
+}
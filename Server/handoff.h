@@ -0,0 +1,46 @@
+#ifndef HANDOFF_H
+#define HANDOFF_H
+
+// 平滑升级：新进程通过Unix域套接字（SCM_RIGHTS）从旧进程取得监听fd，
+// 监听套接字始终保持打开，升级期间客户端不会遇到connection refused
+
+#include <time.h>
+
+#define HANDOFF_TIMEOUT_SEC 10   // 等待对端消息的超时
+
+// handoff_step的返回值
+#define HANDOFF_WANT 0           // 等待新进程的下一条消息
+#define HANDOFF_DONE 1           // 新进程已开始accept
+#define HANDOFF_ERROR -1         // 交接失败，旧进程继续服务
+
+// 旧进程一侧进行中的交接，由事件循环驱动，等待新进程启动期间照常服务
+typedef struct handoff_peer handoff_peer;
+
+// 旧进程：在path上创建交接套接字，返回fd，失败返回-1
+int handoff_listen(const char *path);
+
+// 旧进程：接受一个交接连接（非阻塞），失败返回NULL
+handoff_peer *handoff_accept(int handoff_fd);
+
+// 交接连接的fd，可读时调用handoff_step
+int handoff_peer_fd(const handoff_peer *p);
+
+// 旧进程：读取新进程的消息并推进交接，收到HANDOFF后传出listen_fd，收到READY后返回HANDOFF_DONE
+int handoff_step(handoff_peer *p, int listen_fd);
+
+// 交接开始后超过HANDOFF_TIMEOUT_SEC仍未完成
+int handoff_expired(const handoff_peer *p, time_t now);
+
+// 关闭交接连接并释放
+void handoff_peer_free(handoff_peer *p);
+
+// 新进程：向path上的旧进程请求监听fd，成功时写入*listen_fd并返回与旧进程的连接（用于handoff_ready）
+int handoff_request(const char *path, int *listen_fd);
+
+// 新进程：通知旧进程已开始accept，旧进程随后停止accept并排空在途探测
+int handoff_ready(int conn_fd);
+
+// 继承的监听fd（systemd套接字激活：LISTEN_PID/LISTEN_FDS），没有返回-1
+int inherited_listen_fd(void);
+
+#endif // HANDOFF_H
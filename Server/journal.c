@@ -0,0 +1,204 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "journal.h"
+
+struct journal {
+    int fd;
+    int writable;
+    uint8_t *base;
+    size_t size;
+    journal_header *header;
+};
+
+_Static_assert(sizeof(journal_header) == 64, "journal header must be 64 bytes");
+_Static_assert(sizeof(journal_region) == 64, "journal region header must be 64 bytes");
+_Static_assert(sizeof(journal_record) == 64, "journal record must be 64 bytes");
+
+static size_t region_size(uint32_t capacity) {
+    return sizeof(journal_region) + (size_t)capacity * sizeof(journal_record);
+}
+
+static journal_region *region_at(const journal *j, uint32_t region) {
+    return (journal_region *)(j->base + sizeof(journal_header) + region * region_size(j->header->capacity));
+}
+
+static journal_record *records_of(journal_region *r) {
+    return (journal_record *)(r + 1);
+}
+
+static int header_matches(const journal_header *h, uint32_t region_count, uint32_t capacity) {
+    return memcmp(h->magic, JOURNAL_MAGIC, sizeof(h->magic)) == 0 &&
+           h->version == JOURNAL_VERSION &&
+           h->record_size == sizeof(journal_record) &&
+           h->region_count == region_count &&
+           h->capacity == capacity;
+}
+
+static journal *journal_map(int fd, size_t size, int writable) {
+    journal *j = calloc(1, sizeof(*j));
+    if (!j) {
+        return NULL;
+    }
+
+    int prot = writable ? PROT_READ | PROT_WRITE : PROT_READ;
+    j->base = mmap(NULL, size, prot, MAP_SHARED, fd, 0);
+    if (j->base == MAP_FAILED) {
+        perror("mmap journal failed");
+        free(j);
+        return NULL;
+    }
+
+    j->fd = fd;
+    j->writable = writable;
+    j->size = size;
+    j->header = (journal_header *)j->base;
+    return j;
+}
+
+journal *journal_open(const char *path, uint32_t region_count, uint32_t capacity) {
+    if (region_count == 0 || capacity == 0) {
+        return NULL;
+    }
+
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        perror("open journal failed");
+        return NULL;
+    }
+
+    // 每个区域只能有一个写入者：平滑升级时旧进程排空期间仍在写，新进程不能同时写入或截断它映射的文件
+    if (flock(fd, LOCK_EX | LOCK_NB) < 0) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return NULL;
+    }
+
+    size_t size = sizeof(journal_header) + region_count * region_size(capacity);
+    struct stat st;
+    journal_header existing;
+    int reuse = fstat(fd, &st) == 0 && (size_t)st.st_size == size &&
+                pread(fd, &existing, sizeof(existing), 0) == (ssize_t)sizeof(existing) &&
+                header_matches(&existing, region_count, capacity);
+
+    // 布局不一致时清空重建；ftruncate扩展出的部分读出为0，即空记录
+    if (!reuse && (ftruncate(fd, 0) < 0 || ftruncate(fd, (off_t)size) < 0)) {
+        perror("ftruncate journal failed");
+        close(fd);
+        return NULL;
+    }
+
+    journal *j = journal_map(fd, size, 1);
+    if (!j) {
+        close(fd);
+        return NULL;
+    }
+
+    if (!reuse) {
+        journal_header *h = j->header;
+        memcpy(h->magic, JOURNAL_MAGIC, sizeof(h->magic));
+        h->version = JOURNAL_VERSION;
+        h->record_size = sizeof(journal_record);
+        h->region_count = region_count;
+        h->capacity = capacity;
+    }
+    return j;
+}
+
+journal *journal_open_readonly(const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        perror("open journal failed");
+        return NULL;
+    }
+
+    struct stat st;
+    journal_header h;
+    if (fstat(fd, &st) < 0 || pread(fd, &h, sizeof(h), 0) != (ssize_t)sizeof(h) ||
+        !header_matches(&h, h.region_count, h.capacity) ||
+        (size_t)st.st_size != sizeof(journal_header) + h.region_count * region_size(h.capacity)) {
+        fprintf(stderr, "Not a valid journal file: %s\n", path);
+        close(fd);
+        return NULL;
+    }
+
+    journal *j = journal_map(fd, (size_t)st.st_size, 0);
+    if (!j) {
+        close(fd);
+    }
+    return j;
+}
+
+void journal_close(journal *j) {
+    if (!j) {
+        return;
+    }
+    if (j->writable) {
+        msync(j->base, j->size, MS_SYNC);
+    }
+    munmap(j->base, j->size);
+    close(j->fd);
+    free(j);
+}
+
+void journal_append(journal *j, uint32_t region, const journal_record *record) {
+    if (!j || region >= j->header->region_count) {
+        return;
+    }
+
+    journal_region *r = region_at(j, region);
+    uint64_t head = r->head;
+    journal_record *slot = &records_of(r)[head % j->header->capacity];
+
+    // 先作废旧记录，再写内容，最后写序号：读取方看到匹配的序号即说明记录完整
+    __atomic_store_n(&slot->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy((uint8_t *)slot + sizeof(slot->seq), (const uint8_t *)record + sizeof(record->seq),
+           sizeof(*record) - sizeof(record->seq));
+    __atomic_store_n(&slot->seq, (uint32_t)(head + 1), __ATOMIC_RELEASE);
+    __atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+}
+
+uint32_t journal_region_count(const journal *j) {
+    return j->header->region_count;
+}
+
+uint32_t journal_capacity(const journal *j) {
+    return j->header->capacity;
+}
+
+size_t journal_scan(const journal *j, uint32_t region,
+                    void (*callback)(const journal_record *record, void *arg), void *arg) {
+    if (region >= j->header->region_count) {
+        return 0;
+    }
+
+    journal_region *r = region_at(j, region);
+    uint32_t capacity = j->header->capacity;
+    uint64_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+    uint64_t start = head > capacity ? head - capacity : 0;
+    size_t count = 0;
+
+    for (uint64_t n = start; n < head; n++) {
+        const journal_record *slot = &records_of(r)[n % capacity];
+        journal_record copy;
+
+        memcpy(&copy, slot, sizeof(copy));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        // 复制后序号仍为期望值才说明读取期间没有被覆盖
+        if (copy.seq != (uint32_t)(n + 1) || __atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != copy.seq) {
+            continue;
+        }
+        callback(&copy, arg);
+        count++;
+    }
+    return count;
+}
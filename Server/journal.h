@@ -0,0 +1,82 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// 探测事件日志：每次探测写入一条定长二进制记录到mmap的环形文件
+// 文件按工作线程划分区域，每个区域只有一个写入者，写入无锁；
+// 记录直接写入共享映射，进程崩溃后内容仍保留在页缓存中并落盘
+//
+// 文件布局: journal_header | 区域0 | 区域1 | ...
+// 区域布局: journal_region（64字节） | capacity条journal_record
+
+#define JOURNAL_MAGIC "DDNSJRN1"
+#define JOURNAL_VERSION 1
+
+// 探测结果
+#define JOURNAL_RESULT_SUCCESS 1        // 已连接并发送随机值
+#define JOURNAL_RESULT_VERIFIED 2       // 收到SYN-ACK
+#define JOURNAL_RESULT_CONNECT_FAILED 3 // 连接失败或SYN探测无应答
+#define JOURNAL_RESULT_SEND_FAILED 4    // 连接成功但发送失败
+#define JOURNAL_RESULT_EXPIRED 5        // 超过客户端截止时间，未发起连接
+#define JOURNAL_RESULT_ERROR 6          // 服务端内部错误
+
+// 记录标志
+#define JOURNAL_FLAG_SYN 0x01           // 使用了SYN探测
+#define JOURNAL_FLAG_SESSION 0x02       // 来自长连接会话
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint32_t region_count;
+    uint32_t capacity;                  // 每个区域的记录数
+    uint8_t reserved[40];
+} journal_header;
+
+typedef struct {
+    uint64_t head;                      // 已写入的记录总数，下一条写入head % capacity
+    uint8_t reserved[56];               // 填充到缓存行，避免不同线程的区域头伪共享
+} journal_region;
+
+// 64字节定长记录，地址以IPv6形式保存（IPv4为::ffff:a.b.c.d）
+typedef struct {
+    uint32_t seq;                       // (序号+1)的低32位，最后写入，用于识别未写完的记录
+    uint32_t queue_us;                  // 排队耗时
+    uint64_t timestamp_us;              // 完成时间（Unix时间，微秒）
+    uint8_t source[16];                 // 发起请求的控制连接对端地址
+    uint8_t target[16];                 // 探测目标地址
+    uint16_t target_port;
+    uint8_t result;                     // JOURNAL_RESULT_*
+    uint8_t flags;                      // JOURNAL_FLAG_*
+    uint32_t connect_us;                // 连接或SYN探测耗时
+    uint32_t send_us;                   // 发送随机值耗时
+    uint32_t total_us;                  // 从收到请求到回复客户端
+} journal_record;
+
+typedef struct journal journal;
+
+// 打开或创建日志文件；已有文件的布局一致时继续追加，否则重新初始化
+// 写入方持有文件的排他锁直到journal_close，文件被其他进程持有时返回NULL且errno为EWOULDBLOCK
+journal *journal_open(const char *path, uint32_t region_count, uint32_t capacity);
+
+// 只读映射日志文件（供离线读取工具使用）
+journal *journal_open_readonly(const char *path);
+
+// 关闭日志并同步到磁盘
+void journal_close(journal *j);
+
+// 追加一条记录，同一region只能由一个线程调用
+void journal_append(journal *j, uint32_t region, const journal_record *record);
+
+// 区域数和每区域容量
+uint32_t journal_region_count(const journal *j);
+uint32_t journal_capacity(const journal *j);
+
+// 读取区域中仍保留的记录，按写入顺序回调，返回回调次数
+// 正在写入或已被覆盖的记录会被跳过
+size_t journal_scan(const journal *j, uint32_t region,
+                    void (*callback)(const journal_record *record, void *arg), void *arg);
+
+#endif // JOURNAL_H
@@ -0,0 +1,165 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "probe_queue.h"
+
+// 二叉最小堆实现的有界优先队列，按截止时间排序，截止时间相同时先入先出
+typedef struct {
+    probe_job job;
+    unsigned long long seq;
+} queue_entry;
+
+struct probe_queue {
+    queue_entry *entries;
+    size_t capacity;
+    size_t length;
+    unsigned long long next_seq;
+    int closed;
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+};
+
+long long probe_now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+long long probe_now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int entry_before(const queue_entry *a, const queue_entry *b) {
+    if (a->job.deadline_ms != b->job.deadline_ms) {
+        return a->job.deadline_ms < b->job.deadline_ms;
+    }
+    return a->seq < b->seq;
+}
+
+static void sift_up(probe_queue *queue, size_t i) {
+    queue_entry entry = queue->entries[i];
+
+    while (i > 0) {
+        size_t parent = (i - 1) / 2;
+        if (!entry_before(&entry, &queue->entries[parent])) {
+            break;
+        }
+        queue->entries[i] = queue->entries[parent];
+        i = parent;
+    }
+    queue->entries[i] = entry;
+}
+
+static void sift_down(probe_queue *queue, size_t i) {
+    queue_entry entry = queue->entries[i];
+
+    for (;;) {
+        size_t child = i * 2 + 1;
+        if (child >= queue->length) {
+            break;
+        }
+        if (child + 1 < queue->length && entry_before(&queue->entries[child + 1], &queue->entries[child])) {
+            child++;
+        }
+        if (!entry_before(&queue->entries[child], &entry)) {
+            break;
+        }
+        queue->entries[i] = queue->entries[child];
+        i = child;
+    }
+    queue->entries[i] = entry;
+}
+
+probe_queue *probe_queue_create(size_t capacity) {
+    probe_queue *queue = calloc(1, sizeof(*queue));
+    if (!queue) {
+        return NULL;
+    }
+
+    queue->entries = calloc(capacity, sizeof(queue_entry));
+    if (!queue->entries) {
+        free(queue);
+        return NULL;
+    }
+
+    queue->capacity = capacity;
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->not_empty, NULL);
+    return queue;
+}
+
+void probe_queue_destroy(probe_queue *queue) {
+    if (!queue) {
+        return;
+    }
+    pthread_mutex_destroy(&queue->lock);
+    pthread_cond_destroy(&queue->not_empty);
+    free(queue->entries);
+    free(queue);
+}
+
+int probe_queue_push(probe_queue *queue, const probe_job *job, long long doomed_ms, probe_job *evicted) {
+    int ret = -1;
+    int made_room = 0;
+
+    pthread_mutex_lock(&queue->lock);
+    // 堆顶截止时间最早，它都还来得及时队列中没有可移出的任务
+    if (!queue->closed && queue->length == queue->capacity && queue->length > 0 &&
+        queue->entries[0].job.deadline_ms < doomed_ms) {
+        *evicted = queue->entries[0].job;
+        queue->entries[0] = queue->entries[--queue->length];
+        sift_down(queue, 0);
+        made_room = 1;
+    }
+    if (!queue->closed && queue->length < queue->capacity) {
+        queue_entry *entry = &queue->entries[queue->length];
+        entry->job = *job;
+        entry->seq = queue->next_seq++;
+        sift_up(queue, queue->length++);
+        pthread_cond_signal(&queue->not_empty);
+        ret = made_room;
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return ret;
+}
+
+int probe_queue_pop(probe_queue *queue, probe_job *job) {
+    pthread_mutex_lock(&queue->lock);
+    while (queue->length == 0 && !queue->closed) {
+        pthread_cond_wait(&queue->not_empty, &queue->lock);
+    }
+
+    if (queue->length == 0) {
+        pthread_mutex_unlock(&queue->lock);
+        return -1;
+    }
+
+    *job = queue->entries[0].job;
+    queue->length--;
+    if (queue->length > 0) {
+        queue->entries[0] = queue->entries[queue->length];
+        sift_down(queue, 0);
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return 0;
+}
+
+void probe_queue_close(probe_queue *queue) {
+    pthread_mutex_lock(&queue->lock);
+    queue->closed = 1;
+    pthread_cond_broadcast(&queue->not_empty);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+size_t probe_queue_length(probe_queue *queue) {
+    size_t length;
+
+    pthread_mutex_lock(&queue->lock);
+    length = queue->length;
+    pthread_mutex_unlock(&queue->lock);
+    return length;
+}
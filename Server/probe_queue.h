@@ -0,0 +1,51 @@
+#ifndef PROBE_QUEUE_H
+#define PROBE_QUEUE_H
+
+#include <stddef.h>
+#include <netinet/in.h>
+
+struct conn;
+
+// 待执行的探测任务
+typedef struct probe_job {
+    struct conn *conn;             // 发起请求的控制连接（持有一个引用）
+    unsigned int tag;              // 会话请求标签，一次性连接为0
+    char ip[INET6_ADDRSTRLEN];     // 目标地址
+    int port;                      // 目标端口
+    int use_syn;                   // 客户端接受SYN-ACK确认
+    long long deadline_ms;         // 客户端停止等待的时刻（probe_now_ms时间轴）
+    long long received_us;         // 服务端收到请求的时刻（probe_now_us时间轴），用于统计排队耗时
+    char record[64];               // 验证通过后发布到内置DNS的记录名，空表示不发布
+} probe_job;
+
+// 按截止时间排序（最早截止优先）的有界任务队列
+typedef struct probe_queue probe_queue;
+
+// 单调时钟（毫秒），用于计算任务截止时间
+long long probe_now_ms(void);
+
+// 单调时钟（微秒），用于统计各阶段耗时
+long long probe_now_us(void);
+
+// 创建容量为capacity的任务队列
+probe_queue *probe_queue_create(size_t capacity);
+
+// 销毁队列
+void probe_queue_destroy(probe_queue *queue);
+
+// 入队，成功返回0，队列已满或已关闭时返回-1
+// 队列已满而截止时间最早的任务在doomed_ms之前截止（已来不及探测）时，把它移出到evicted
+// 为新任务腾出位置并返回1，由调用方答复被移出任务的客户端
+int probe_queue_push(probe_queue *queue, const probe_job *job, long long doomed_ms, probe_job *evicted);
+
+// 取出截止时间最早的任务，队列为空时阻塞；队列已关闭且为空时返回-1
+// 已过期的任务同样会被取出，由调用方在发起连接前丢弃
+int probe_queue_pop(probe_queue *queue, probe_job *job);
+
+// 关闭队列并唤醒所有等待的工作线程，已入队的任务仍可取出
+void probe_queue_close(probe_queue *queue);
+
+// 当前排队任务数
+size_t probe_queue_length(probe_queue *queue);
+
+#endif // PROBE_QUEUE_H
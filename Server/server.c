@@ -1,6 +1,9 @@
+#define _GNU_SOURCE  // accept4
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
@@ -8,21 +11,220 @@
 #include <sys/types.h>
 #include <time.h>
 #include <netdb.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/random.h>
+#include <sys/epoll.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <limits.h>
+#include <stdint.h>
+#include <poll.h>
+
+#include "syn_probe.h"
+#include "probe_queue.h"
+#include "handoff.h"
+#include "journal.h"
+#include "source_pool.h"
+#include "tls_channel.h"
+#include "dns_responder.h"
 
 #define BUFFER_SIZE 1024
 #define DEFAULT_PORT 8066
-#define MAX_CLIENTS 10
+#define MAX_CLIENTS 128          // 监听队列长度
 #define TIMEOUT_SEC 5
+#define MAX_EVENTS 64
+#define DEFAULT_WORKERS 4
+#define PROBE_QUEUE_CAPACITY 4096
+#define SESSION_IDLE_TIMEOUT 300  // 会话超过5分钟无任何消息则关闭
+#define SESSION_ID_MAX 64
+#define SESSION_TABLE_SIZE 4096
+#define SESSION_ENTRY_TTL 3600    // 会话断开后登记保留1小时，之后清除
+#define CLIENT_TOKENS_MAX 65536   // -K文件中的客户端令牌数上限
+#define SESSION_CLAIMS 16         // 每个会话中等待回传随机值的记录数
+#define CLAIM_TTL_MS 10000        // 随机值发出后等待客户端回传的时间
+#define PROOF_LEN 33              // 回连发出的随机值（含结尾0）
+#define DRAIN_TIMEOUT_SEC 30      // 停止accept后等待在途探测完成的最长时间
+#define DEFAULT_PROBE_BUDGET_MS 10000 // 请求未声明budget时客户端的默认等待时间
+#define MAX_PROBE_BUDGET_MS 60000
+#define MIN_PROBE_BUDGET_MS 50    // 剩余时间不足一次连接所需时不再探测，客户端注定等不到结果
+#define DEFAULT_JOURNAL_RECORDS 65536 // 每个工作线程的日志环容量
+#define RST_WAIT_MS 1000          // RST断开前等待客户端读取随机值并关闭连接的最长时间
+#define STATS_BUFFER_SIZE 16384
+#define DEFAULT_DNS_PORT 53
+#define DEFAULT_DNS_TTL 30
 
-void generate_random_string(char *buffer, size_t length) {
-    const char charset[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
-    size_t i;
-    
-    srand(time(NULL));
-    for (i = 0; i < length - 1; i++) {
-        buffer[i] = charset[rand() % (sizeof(charset) - 1)];
+// 控制连接状态
+enum {
+    CONN_PENDING,   // 尚未收到首个请求
+    CONN_LEGACY,    // 一次性请求，响应后关闭
+    CONN_SESSION    // 已握手的长连接会话
+};
+
+// 待发布的记录：地址与会话来源不同，客户端回传回连收到的随机值后才发布
+typedef struct {
+    unsigned int tag;
+    long long expires_ms;              // 0表示空闲（probe_now_ms时间轴）
+    char record[64];
+    char ip[INET6_ADDRSTRLEN];
+    char proof[PROOF_LEN];
+} record_claim;
+
+// 控制连接，由事件循环和排队中的探测任务共同引用
+typedef struct conn {
+    int fd;
+    int mode;
+    int closed;                        // 已断开，工作线程不再写入
+    int refs;                          // 引用计数
+    pthread_mutex_t lock;              // 串行化写入
+    struct sockaddr_storage peer;
+    char ip[INET6_ADDRSTRLEN];
+    char endpoint[INET6_ADDRSTRLEN + 8];
+    char client_id[SESSION_ID_MAX];
+    int id_verified;                   // 客户端标识经-K中该标识自己的令牌认证，可以发布DNS记录
+    tls_channel *tls;                  // TLS控制连接，明文为NULL（读写都需持有lock）
+    int tls_checked;                   // 已根据首字节判断是否为TLS
+    int finish_pending;                // 0-RTT请求已答复，握手完成后再关闭
+    record_claim claims[SESSION_CLAIMS]; // 等待客户端确认的记录（lock保护）
+    char inbuf[BUFFER_SIZE];
+    size_t inlen;
+    time_t last_active;
+    struct conn *prev, *next;          // 事件循环持有的连接链表
+} conn_t;
+
+// 客户端会话登记，用于发现同一客户端源地址变化（仅事件循环线程访问）
+typedef struct {
+    int used;
+    char id[SESSION_ID_MAX];
+    char ip[INET6_ADDRSTRLEN];
+    conn_t *conn;                      // 当前在线的会话，没有则为NULL
+    time_t last_seen;                  // 最近一次握手或断开的时间
+} session_entry;
+
+// 无状态SYN探测引擎，通过 -s 启用，不可用时为NULL（回退到connect探测）
+static syn_engine *g_syn_engine = NULL;
+
+static probe_queue *g_queue = NULL;
+static const char *g_session_token = NULL;
+static conn_t *g_conns = NULL;
+static conn_t *g_reap = NULL;          // 本批事件中被关闭、处理完这批事件后才释放的连接
+static int g_epoll_fd = -1;
+static session_entry g_sessions[SESSION_TABLE_SIZE];
+
+// 平滑升级/退出状态
+static int g_listen_fd = -1;
+static int g_handoff_fd = -1;                 // 交接套接字，未启用为-1
+static const char *g_handoff_path = NULL;
+static handoff_peer *g_handoff_peer = NULL;   // 进行中的交接，同一时间只有一个
+static int g_draining = 0;                    // 已停止accept，正在排空
+static time_t g_drain_deadline = 0;
+static int g_inflight = 0;                    // 已入队但尚未回复的探测数
+static volatile sig_atomic_t g_stop_requested = 0;
+
+// epoll事件中区分监听套接字、交接套接字和交接连接的标记
+static char g_listen_tag, g_handoff_tag, g_handoff_peer_tag;
+
+// 二进制探测日志，通过 -j 启用，每个工作线程独占一个区域
+// 文件仍被排空中的旧进程持有时为NULL，由事件循环定期重试打开（工作线程原子读取）
+static journal *g_journal = NULL;
+static const char *g_journal_path = NULL;
+static uint32_t g_journal_regions, g_journal_capacity;
+
+// 是否输出逐次探测的文本日志：未启用日志文件或指定 -v 时输出
+static int g_probe_log = 1;
+
+#define PROBE_LOG(...) do { if (g_probe_log) printf(__VA_ARGS__); } while (0)
+
+// 出站探测连接的源地址池（-b），为空时由内核选择源地址
+static source_pool *g_sources = NULL;
+
+// 探测连接以RST断开（-R），服务端不进入TIME_WAIT
+static int g_rst_teardown = 0;
+
+// 控制连接TLS（-t/-T），g_tls_required时拒绝明文连接（-X）
+static int g_tls_enabled = 0;
+static int g_tls_required = 0;
+
+// 内置权威DNS（-D），会话中验证通过的地址直接发布，未启用为NULL
+static dns_responder *g_dns = NULL;
+
+// 每个客户端标识各自的令牌（-K），按标识排序以便二分查找
+typedef struct {
+    char id[SESSION_ID_MAX];
+    char token[128];
+} client_token;
+
+static client_token *g_client_tokens = NULL;
+static size_t g_client_token_count = 0;
+
+#define TOKEN_POOL_SIZE 4096
+
+// base62编码表：字节值0-247映射到字符集（62*4=248，无取模偏差），248-255为0表示丢弃重取
+static const char base62_table[257] =
+    "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789"
+    "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789"
+    "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789"
+    "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789"
+    "\0\0\0\0\0\0\0\0";
+
+// 每线程随机字节池，批量从内核CSPRNG填充，生成令牌时无需加锁
+static __thread unsigned char token_pool[TOKEN_POOL_SIZE];
+static __thread size_t token_pool_pos = TOKEN_POOL_SIZE;
+
+static int refill_token_pool(void) {
+    size_t filled = 0;
+
+    while (filled < TOKEN_POOL_SIZE) {
+        ssize_t n = getrandom(token_pool + filled, TOKEN_POOL_SIZE - filled, 0);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        filled += (size_t)n;
+    }
+
+    // 内核不支持getrandom()时退回/dev/urandom
+    if (filled < TOKEN_POOL_SIZE) {
+        int fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return -1;
+        }
+        while (filled < TOKEN_POOL_SIZE) {
+            ssize_t n = read(fd, token_pool + filled, TOKEN_POOL_SIZE - filled);
+            if (n <= 0) {
+                if (n < 0 && errno == EINTR) {
+                    continue;
+                }
+                close(fd);
+                return -1;
+            }
+            filled += (size_t)n;
+        }
+        close(fd);
+    }
+
+    token_pool_pos = 0;
+    return 0;
+}
+
+int generate_random_string(char *buffer, size_t length) {
+    size_t i = 0;
+
+    while (i < length - 1) {
+        if (token_pool_pos == TOKEN_POOL_SIZE && refill_token_pool() < 0) {
+            return -1;
+        }
+        char c = base62_table[token_pool[token_pool_pos++]];
+        if (c != '\0') {
+            buffer[i++] = c;
+        }
     }
     buffer[length - 1] = '\0';
+    return 0;
 }
 
 int is_valid_ipv6(const char *ip) {
@@ -40,7 +242,7 @@ int parse_client_address(const char *input, char *ip, int *port) {
     strncpy(buffer, input, BUFFER_SIZE - 1);
     buffer[BUFFER_SIZE - 1] = '\0';
     
-    printf("Parsing address: %s\n", buffer);
+    PROBE_LOG("Parsing address: %s\n", buffer);
     
     // 检查是否是IPv6地址（包含中括号）
     if (buffer[0] == '[') {
@@ -65,7 +267,7 @@ int parse_client_address(const char *input, char *ip, int *port) {
         // 提取端口号
         *port = atoi(close_bracket + 2);
         
-        printf("Parsed IPv6: %s, port: %d\n", ip, *port);
+        PROBE_LOG("Parsed IPv6: %s, port: %d\n", ip, *port);
     } else {
         // IPv4地址格式: ip:port
         char *colon = strrchr(buffer, ':');
@@ -84,175 +286,1681 @@ int parse_client_address(const char *input, char *ip, int *port) {
         // 提取端口号
         *port = atoi(colon + 1);
         
-        printf("Parsed IPv4: %s, port: %d\n", ip, *port);
+        PROBE_LOG("Parsed IPv4: %s, port: %d\n", ip, *port);
     }
     
     return 0;
 }
 
-int connect_to_client(const char *ip, int port) {
-    int sockfd;
+// 从源地址池中选择源地址连接addr，某个源地址不可用或临时端口耗尽（EADDRNOTAVAIL）时换用下一个
+int connect_from_pool(const struct addrinfo *addr, int timeout_ms) {
+    int attempts = source_pool_count(g_sources, addr->ai_family);
+    int index = source_pool_pick(g_sources, addr->ai_family, -1);
+
+    for (int attempt = 0; attempt < (attempts > 0 ? attempts : 1); attempt++) {
+        int sockfd = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
+        if (sockfd == -1) {
+            return -1;
+        }
+
+        // 设置超时
+        struct timeval timeout;
+        timeout.tv_sec = timeout_ms / 1000;
+        timeout.tv_usec = (timeout_ms % 1000) * 1000;
+        setsockopt(sockfd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+        // 源地址已从本机移除时bind失败（IP_BIND_ADDRESS_NO_PORT下为EADDRNOTAVAIL），同样换用下一个
+        int bound = source_pool_bind(g_sources, index, sockfd) == 0;
+        int err = bound ? 0 : errno;
+        if (!bound) {
+            perror("Bind probe source address failed");
+        } else if (connect(sockfd, addr->ai_addr, addr->ai_addrlen) != 0) {
+            err = errno;
+        }
+        source_pool_record(g_sources, index, err);
+        if (err == 0) {
+            return sockfd;
+        }
+        close(sockfd);
+
+        if ((bound && err != EADDRNOTAVAIL) || index < 0) {
+            break;
+        }
+        index = source_pool_pick(g_sources, addr->ai_family, index);
+    }
+    return -1;
+}
+
+// 连接客户端指定的地址，timeout_ms为连接超时
+int connect_to_client(const char *ip, int port, int timeout_ms) {
+    int sockfd = -1;
     struct addrinfo hints, *result, *rp;
     char port_str[10];
     
-    printf("Attempting to connect to %s:%d\n", ip, port);
+    PROBE_LOG("Attempting to connect to %s:%d\n", ip, port);
     
     snprintf(port_str, sizeof(port_str), "%d", port);
     
     memset(&hints, 0, sizeof(hints));
     hints.ai_family = AF_UNSPEC;    // 支持IPv4和IPv6
     hints.ai_socktype = SOCK_STREAM;
-    hints.ai_flags = 0;
+    hints.ai_flags = AI_NUMERICHOST;
     hints.ai_protocol = IPPROTO_TCP;
     
     int ret = getaddrinfo(ip, port_str, &hints, &result);
     if (ret != 0) {
-        printf("getaddrinfo error: %s\n", gai_strerror(ret));
+        PROBE_LOG("getaddrinfo error: %s\n", gai_strerror(ret));
         return -1;
     }
     
     // 尝试所有返回的地址
     for (rp = result; rp != NULL; rp = rp->ai_next) {
-        sockfd = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
-        if (sockfd == -1) {
-            continue;
-        }
-        
-        // 设置超时
-        struct timeval timeout;
-        timeout.tv_sec = TIMEOUT_SEC;
-        timeout.tv_usec = 0;
-        setsockopt(sockfd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
-        
-        if (connect(sockfd, rp->ai_addr, rp->ai_addrlen) != -1) {
+        sockfd = connect_from_pool(rp, timeout_ms);
+        if (sockfd >= 0) {
             break; // 连接成功
         }
-        
-        close(sockfd);
     }
     
     freeaddrinfo(result);
     
     if (rp == NULL) {
-        printf("Could not connect to any address\n");
+        PROBE_LOG("Could not connect to any address\n");
         return -1;
     }
     
-    printf("Successfully connected to %s:%d\n", ip, port);
+    PROBE_LOG("Successfully connected to %s:%d\n", ip, port);
     return sockfd;
 }
 
-int main() {
-    int server_fd, client_fd;
-    struct sockaddr_in server_addr, client_addr;
-    socklen_t client_len = sizeof(client_addr);
-    char buffer[BUFFER_SIZE];
-    
-    // 初始化随机数种子
-    srand(time(NULL));
-    
-    // 创建socket
-    server_fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (server_fd < 0) {
+// 关闭探测连接。启用RST断开时先等客户端读完随机值并关闭（最多wait_ms），
+// 再以SO_LINGER 0发送RST，服务端既不主动发FIN也不进入TIME_WAIT
+void close_probe_connection(int fd, int wait_ms) {
+    if (g_rst_teardown) {
+        if (wait_ms > 0) {
+            struct pollfd pfd = { .fd = fd, .events = POLLIN | POLLRDHUP };
+            poll(&pfd, 1, wait_ms < RST_WAIT_MS ? wait_ms : RST_WAIT_MS);
+        }
+        struct linger lg = { 1, 0 };
+        setsockopt(fd, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg));
+    }
+    close(fd);
+}
+
+// 提取对端IP字符串，IPv4映射地址还原为IPv4
+void format_peer_ip(const struct sockaddr_storage *addr, char *ip, size_t ip_len) {
+    if (addr->ss_family == AF_INET6) {
+        const struct sockaddr_in6 *sin6 = (const struct sockaddr_in6 *)addr;
+        if (IN6_IS_ADDR_V4MAPPED(&sin6->sin6_addr)) {
+            inet_ntop(AF_INET, &sin6->sin6_addr.s6_addr[12], ip, ip_len);
+        } else {
+            inet_ntop(AF_INET6, &sin6->sin6_addr, ip, ip_len);
+        }
+    } else {
+        inet_ntop(AF_INET, &((const struct sockaddr_in *)addr)->sin_addr, ip, ip_len);
+    }
+}
+
+// 格式化对端地址为 ip:port 或 [ipv6]:port
+void format_endpoint(const struct sockaddr_storage *addr, char *out, size_t out_len) {
+    char ip[INET6_ADDRSTRLEN];
+    int port;
+
+    format_peer_ip(addr, ip, sizeof(ip));
+    if (addr->ss_family == AF_INET6) {
+        port = ntohs(((const struct sockaddr_in6 *)addr)->sin6_port);
+    } else {
+        port = ntohs(((const struct sockaddr_in *)addr)->sin_port);
+    }
+
+    if (strchr(ip, ':')) {
+        snprintf(out, out_len, "[%s]:%d", ip, port);
+    } else {
+        snprintf(out, out_len, "%s:%d", ip, port);
+    }
+}
+
+// 创建监听socket，优先使用IPv6双栈以便IPv6客户端也能连接，不支持IPv6时回退到IPv4
+int create_server_socket(int port) {
+    int fd = socket(AF_INET6, SOCK_STREAM, 0);
+    int opt = 1;
+
+    if (fd >= 0) {
+        struct sockaddr_in6 addr6;
+        int v6only = 0;
+
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+        setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &v6only, sizeof(v6only));
+
+        memset(&addr6, 0, sizeof(addr6));
+        addr6.sin6_family = AF_INET6;
+        addr6.sin6_addr = in6addr_any;
+        addr6.sin6_port = htons(port);
+
+        if (bind(fd, (struct sockaddr *)&addr6, sizeof(addr6)) == 0 && listen(fd, MAX_CLIENTS) == 0) {
+            return fd;
+        }
+        close(fd);
+    }
+
+    struct sockaddr_in addr;
+
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
         perror("Socket creation failed");
-        exit(EXIT_FAILURE);
+        return -1;
     }
-    
-    // 配置服务器地址
-    memset(&server_addr, 0, sizeof(server_addr));
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_addr.s_addr = INADDR_ANY;
-    server_addr.sin_port = htons(DEFAULT_PORT);
-    
+
     // 设置SO_REUSEADDR选项
-    int opt = 1;
-    if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) {
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) {
         perror("setsockopt failed");
-        close(server_fd);
-        exit(EXIT_FAILURE);
+        close(fd);
+        return -1;
     }
-    
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = htons(port);
+
     // 绑定socket
-    if (bind(server_fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
         perror("Bind failed");
-        close(server_fd);
-        exit(EXIT_FAILURE);
+        close(fd);
+        return -1;
     }
-    
+
     // 监听连接
-    if (listen(server_fd, MAX_CLIENTS) < 0) {
+    if (listen(fd, MAX_CLIENTS) < 0) {
         perror("Listen failed");
-        close(server_fd);
-        exit(EXIT_FAILURE);
+        close(fd);
+        return -1;
     }
-    
-    printf("Server listening on port %d\n", DEFAULT_PORT);
-    printf("Waiting for client connections...\n\n");
-    
-    while (1) {
-        // 接受客户端连接
-        client_fd = accept(server_fd, (struct sockaddr *)&client_addr, &client_len);
-        if (client_fd < 0) {
-            perror("Accept failed");
-            continue;
+
+    return fd;
+}
+
+// 检查请求中地址之后是否带有指定选项，如 "1.2.3.4:5678 syn"
+int request_has_option(const char *request, const char *option) {
+    const char *p = strchr(request, ' ');
+    size_t len = strlen(option);
+
+    while (p) {
+        while (*p == ' ') {
+            p++;
         }
-        
-        char client_ip[INET_ADDRSTRLEN];
-        inet_ntop(AF_INET, &client_addr.sin_addr, client_ip, INET_ADDRSTRLEN);
-        printf("Client connected from: %s:%d\n", client_ip, ntohs(client_addr.sin_port));
-        
-        // 接收客户端发送的IP和端口
-        memset(buffer, 0, BUFFER_SIZE);
-        int bytes_received = recv(client_fd, buffer, BUFFER_SIZE - 1, 0);
-        
-        if (bytes_received > 0) {
-            buffer[bytes_received] = '\0';
-            printf("Received from client: %s\n", buffer);
-            
-            // 解析客户端地址和端口
-            char client_target_ip[INET6_ADDRSTRLEN];
-            int client_target_port;
-            
-            if (parse_client_address(buffer, client_target_ip, &client_target_port) < 0) {
-                printf("Failed to parse client address\n");
-                send(client_fd, "ERROR: Invalid address format", 28, 0);
-            } else {
-                // 尝试连接客户端指定的地址
-                int target_fd = connect_to_client(client_target_ip, client_target_port);
-                
-                if (target_fd >= 0) {
-                    printf("Successfully connected to client's address\n");
-                    
-                    // 生成并发送随机值
-                    char random_value[33];
-                    generate_random_string(random_value, sizeof(random_value));
-                    printf("Sending random value: %s\n", random_value);
-                    
-                    if (send(target_fd, random_value, strlen(random_value), 0) < 0) {
-                        perror("Send to target failed");
-                        send(client_fd, "ERROR: Failed to send random value", 34, 0);
-                    } else {
-                        send(client_fd, "SUCCESS: Random value sent", 26, 0);
-                    }
-                    
-                    close(target_fd);
-                } else {
-                    printf("Failed to connect to client's address\n");
-                    send(client_fd, "ERROR: Cannot connect to specified address", 42, 0);
-                }
+        if (strncmp(p, option, len) == 0 && (p[len] == ' ' || p[len] == '\0')) {
+            return 1;
+        }
+        p = strchr(p, ' ');
+    }
+    return 0;
+}
+
+// 读取请求中 "name=value" 形式的整数选项，如 "1.2.3.4:5678 syn budget=3000"
+// 不存在或无效时返回default_value
+int request_int_option(const char *request, const char *name, int default_value) {
+    const char *p = strchr(request, ' ');
+    size_t len = strlen(name);
+
+    while (p) {
+        while (*p == ' ') {
+            p++;
+        }
+        if (strncmp(p, name, len) == 0 && p[len] == '=') {
+            char *end;
+            long value = strtol(p + len + 1, &end, 10);
+            if (end != p + len + 1 && (*end == ' ' || *end == '\0') && value > 0 && value <= INT_MAX) {
+                return (int)value;
+            }
+            return default_value;
+        }
+        p = strchr(p, ' ');
+    }
+    return default_value;
+}
+
+// 读取请求中 "name=value" 形式的字符串选项，如 "1.2.3.4:5678 name=web"，不存在或为空时返回-1
+int request_str_option(const char *request, const char *name, char *out, size_t out_len) {
+    const char *p = strchr(request, ' ');
+    size_t len = strlen(name);
+
+    while (p) {
+        while (*p == ' ') {
+            p++;
+        }
+        if (strncmp(p, name, len) == 0 && p[len] == '=') {
+            size_t value_len = strcspn(p + len + 1, " ");
+            if (value_len == 0 || value_len >= out_len) {
+                return -1;
             }
+            memcpy(out, p + len + 1, value_len);
+            out[value_len] = '\0';
+            return 0;
+        }
+        p = strchr(p, ' ');
+    }
+    return -1;
+}
+
+// 通过原始套接字SYN探测客户端地址，返回SYN_PROBE_*结果
+int syn_probe_client(const char *ip, int port, int timeout_ms) {
+    struct sockaddr_storage target;
+    memset(&target, 0, sizeof(target));
+
+    if (is_valid_ipv4(ip)) {
+        struct sockaddr_in *sin = (struct sockaddr_in *)&target;
+        sin->sin_family = AF_INET;
+        sin->sin_port = htons(port);
+        inet_pton(AF_INET, ip, &sin->sin_addr);
+    } else if (is_valid_ipv6(ip)) {
+        struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)&target;
+        sin6->sin6_family = AF_INET6;
+        sin6->sin6_port = htons(port);
+        inet_pton(AF_INET6, ip, &sin6->sin6_addr);
+    } else {
+        return SYN_PROBE_ERROR;
+    }
+
+    PROBE_LOG("SYN probing %s:%d\n", ip, port);
+    return syn_engine_probe(g_syn_engine, &target, timeout_ms);
+}
+
+// 运行一次探测，把给客户端的响应写入response，结果和各阶段耗时写入rec
+// remaining_ms为距客户端截止时间的剩余时间，连接超时不会超过它；proof为回连发出的随机值，未发出时为空
+void run_probe(const probe_job *job, int remaining_ms, char proof[PROOF_LEN],
+               char *response, size_t response_len, journal_record *rec) {
+    int timeout_ms = remaining_ms < TIMEOUT_SEC * 1000 ? remaining_ms : TIMEOUT_SEC * 1000;
+    long long stage_start = probe_now_us();
+
+    // 客户端声明支持时优先使用SYN探测，引擎发送失败则回退到connect
+    int syn_result = SYN_PROBE_ERROR;
+    if (g_syn_engine && job->use_syn) {
+        syn_result = syn_probe_client(job->ip, job->port, timeout_ms);
+    }
+
+    if (syn_result != SYN_PROBE_ERROR) {
+        rec->flags |= JOURNAL_FLAG_SYN;
+        rec->connect_us = (uint32_t)(probe_now_us() - stage_start);
+    }
+    if (syn_result == SYN_PROBE_OPEN) {
+        PROBE_LOG("SYN-ACK received from %s:%d\n", job->ip, job->port);
+        rec->result = JOURNAL_RESULT_VERIFIED;
+        snprintf(response, response_len, "VERIFIED: Port reachable");
+        return;
+    }
+    if (syn_result != SYN_PROBE_ERROR) {
+        PROBE_LOG("No SYN-ACK from %s:%d\n", job->ip, job->port);
+        rec->result = JOURNAL_RESULT_CONNECT_FAILED;
+        snprintf(response, response_len, "ERROR: Cannot connect to specified address");
+        return;
+    }
+
+    // 尝试连接客户端指定的地址
+    stage_start = probe_now_us();
+    int target_fd = connect_to_client(job->ip, job->port, timeout_ms);
+    rec->connect_us = (uint32_t)(probe_now_us() - stage_start);
+    if (target_fd < 0) {
+        PROBE_LOG("Failed to connect to client's address\n");
+        rec->result = JOURNAL_RESULT_CONNECT_FAILED;
+        snprintf(response, response_len, "ERROR: Cannot connect to specified address");
+        return;
+    }
+
+    PROBE_LOG("Successfully connected to client's address\n");
+
+    // 生成并发送随机值，发送成功时关闭前等待客户端读取
+    char random_value[PROOF_LEN];
+    int close_wait_ms = 0;
+    if (generate_random_string(random_value, sizeof(random_value)) < 0) {
+        perror("Random value generation failed");
+        rec->result = JOURNAL_RESULT_ERROR;
+        snprintf(response, response_len, "ERROR: Failed to generate random value");
+    } else {
+        PROBE_LOG("Sending random value: %s\n", random_value);
+
+        stage_start = probe_now_us();
+        ssize_t sent = send(target_fd, random_value, strlen(random_value), MSG_NOSIGNAL);
+        rec->send_us = (uint32_t)(probe_now_us() - stage_start);
+        if (sent < 0) {
+            perror("Send to target failed");
+            rec->result = JOURNAL_RESULT_SEND_FAILED;
+            snprintf(response, response_len, "ERROR: Failed to send random value");
         } else {
-            printf("No data received from client\n");
+            rec->result = JOURNAL_RESULT_SUCCESS;
+            snprintf(response, response_len, "SUCCESS: Random value sent");
+            memcpy(proof, random_value, PROOF_LEN);
+            close_wait_ms = remaining_ms;
         }
-        
-        close(client_fd);
-        printf("Connection closed\n\n");
     }
-    
-    close(server_fd);
+
+    close_probe_connection(target_fd, close_wait_ms);
+}
+
+// 把地址转换为日志中的16字节形式，IPv4映射为::ffff:a.b.c.d
+void journal_address(const char *ip, uint8_t out[16]) {
+    struct in_addr v4;
+
+    memset(out, 0, 16);
+    if (inet_pton(AF_INET, ip, &v4) == 1) {
+        out[10] = 0xff;
+        out[11] = 0xff;
+        memcpy(out + 12, &v4, 4);
+    } else {
+        inet_pton(AF_INET6, ip, out);
+    }
+}
+
+void journal_peer_address(const struct sockaddr_storage *addr, uint8_t out[16]) {
+    memset(out, 0, 16);
+    if (addr->ss_family == AF_INET) {
+        out[10] = 0xff;
+        out[11] = 0xff;
+        memcpy(out + 12, &((const struct sockaddr_in *)addr)->sin_addr, 4);
+    } else if (addr->ss_family == AF_INET6) {
+        memcpy(out, &((const struct sockaddr_in6 *)addr)->sin6_addr, 16);
+    }
+}
+
+void conn_release(conn_t *c) {
+    if (__atomic_sub_fetch(&c->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        tls_channel_free(c->tls);
+        close(c->fd);
+        pthread_mutex_destroy(&c->lock);
+        free(c);
+    }
+}
+
+// 向控制连接发送一条消息，连接已关闭或发送失败时返回-1
+int conn_send(conn_t *c, const char *msg, size_t len) {
+    int ret = -1;
+
+    pthread_mutex_lock(&c->lock);
+    if (!c->closed) {
+        ssize_t n = c->tls ? tls_channel_send(c->tls, msg, len) : send(c->fd, msg, len, MSG_NOSIGNAL);
+        ret = n == (ssize_t)len ? 0 : -1;
+    }
+    pthread_mutex_unlock(&c->lock);
+    return ret;
+}
+
+// 结束一次性连接：发送完响应后关闭双向，事件循环随后收到HUP并回收
+void conn_finish(conn_t *c) {
+    pthread_mutex_lock(&c->lock);
+    if (!c->closed && c->tls && !tls_channel_established(c->tls)) {
+        // 0-RTT请求在客户端Finished到达前已答复，等握手完成、新票据签发后再关闭
+        c->finish_pending = 1;
+    } else if (!c->closed) {
+        if (c->tls) {
+            tls_channel_shutdown(c->tls);
+        }
+        shutdown(c->fd, SHUT_RDWR);
+    }
+    pthread_mutex_unlock(&c->lock);
+}
+
+// 把探测结果交回发起请求的连接
+void deliver_response(conn_t *c, unsigned int tag, const char *response) {
+    if (c->mode == CONN_SESSION) {
+        char line[BUFFER_SIZE + 32];
+        int len = snprintf(line, sizeof(line), "RESULT %u %s\n", tag, response);
+        conn_send(c, line, len);
+    } else {
+        conn_send(c, response, strlen(response));
+        conn_finish(c);
+    }
+}
+
+// 探测的地址是否就是控制连接的来源地址，此时服务端已从握手得知客户端在该地址上
+int is_peer_address(const conn_t *c, const char *ip) {
+    uint8_t target[16], peer[16];
+
+    journal_address(ip, target);
+    journal_peer_address(&c->peer, peer);
+    return memcmp(target, peer, 16) == 0;
+}
+
+// 写入内置DNS，写入失败（如本进程已交接）时返回-1
+int publish_record(const char *record, const char *ip) {
+    int published = dns_responder_publish(g_dns, record, ip);
+    if (published == 1) {
+        printf("DNS record %s updated to %s\n", record, ip);
+    }
+    return published < 0 ? -1 : 0;
+}
+
+// 登记等待客户端确认的记录，槽位用尽时覆盖最早过期的一条
+void claim_add(conn_t *c, const probe_job *job, const char *proof) {
+    long long now = probe_now_ms();
+
+    pthread_mutex_lock(&c->lock);
+    record_claim *slot = &c->claims[0];
+    for (int i = 0; i < SESSION_CLAIMS; i++) {
+        if (c->claims[i].expires_ms <= now) {
+            slot = &c->claims[i];
+            break;
+        }
+        if (c->claims[i].expires_ms < slot->expires_ms) {
+            slot = &c->claims[i];
+        }
+    }
+    slot->tag = job->tag;
+    slot->expires_ms = now + CLAIM_TTL_MS;
+    snprintf(slot->record, sizeof(slot->record), "%s", job->record);
+    snprintf(slot->ip, sizeof(slot->ip), "%s", job->ip);
+    memcpy(slot->proof, proof, PROOF_LEN);
+    pthread_mutex_unlock(&c->lock);
+}
+
+// 取出标签对应且未过期的记录，没有时返回-1
+int claim_take(conn_t *c, unsigned int tag, record_claim *out) {
+    long long now = probe_now_ms();
+    int ret = -1;
+
+    pthread_mutex_lock(&c->lock);
+    for (int i = 0; i < SESSION_CLAIMS; i++) {
+        if (c->claims[i].expires_ms > now && c->claims[i].tag == tag) {
+            *out = c->claims[i];
+            c->claims[i].expires_ms = 0;
+            ret = 0;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&c->lock);
+    return ret;
+}
+
+// 工作线程，arg为线程序号，对应日志中的区域
+void *probe_worker(void *arg) {
+    uint32_t region = (uint32_t)(intptr_t)arg;
+    probe_job job;
+    journal_record rec;
+    char response[BUFFER_SIZE];
+    char proof[PROOF_LEN];
+
+    while (probe_queue_pop(g_queue, &job) == 0) {
+        memset(&rec, 0, sizeof(rec));
+        proof[0] = '\0';
+        rec.queue_us = (uint32_t)(probe_now_us() - job.received_us);
+
+        // 客户端已不再等待或剩余时间不够完成连接的任务在发起连接前直接丢弃
+        long long remaining = job.deadline_ms - probe_now_ms();
+        if (remaining < MIN_PROBE_BUDGET_MS) {
+            PROBE_LOG("Dropping expired probe for %s:%d (%lld ms left)\n", job.ip, job.port, remaining);
+            rec.result = JOURNAL_RESULT_EXPIRED;
+            snprintf(response, sizeof(response), "ERROR: Deadline expired");
+        } else {
+            run_probe(&job, (int)remaining, proof, response, sizeof(response), &rec);
+        }
+
+        // 地址就是会话来源时，验证通过的地址在回复客户端前写入记录表，客户端收到结果时记录已可解析；
+        // 其他地址只证明了端口可达，要等客户端在会话中回传回连收到的随机值（CONFIRM）后才发布
+        // 写入失败（如本进程已交接）时回复错误，客户端重试时由接替的进程发布
+        if (g_dns && job.record[0] &&
+            (rec.result == JOURNAL_RESULT_VERIFIED || rec.result == JOURNAL_RESULT_SUCCESS)) {
+            if (is_peer_address(job.conn, job.ip)) {
+                if (publish_record(job.record, job.ip) < 0) {
+                    snprintf(response, sizeof(response), "ERROR: DNS record not published");
+                }
+            } else if (proof[0]) {
+                claim_add(job.conn, &job, proof);
+                snprintf(response, sizeof(response), "SUCCESS: Random value sent, CONFIRM to publish");
+            }
+        }
+        deliver_response(job.conn, job.tag, response);
+
+        journal *jr = __atomic_load_n(&g_journal, __ATOMIC_ACQUIRE);
+        if (jr) {
+            struct timespec now;
+            clock_gettime(CLOCK_REALTIME, &now);
+            rec.timestamp_us = (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+            rec.total_us = (uint32_t)(probe_now_us() - job.received_us);
+            journal_peer_address(&job.conn->peer, rec.source);
+            journal_address(job.ip, rec.target);
+            rec.target_port = (uint16_t)job.port;
+            if (job.conn->mode == CONN_SESSION) {
+                rec.flags |= JOURNAL_FLAG_SESSION;
+            }
+            journal_append(jr, region, &rec);
+        }
+        conn_release(job.conn);
+        __atomic_sub_fetch(&g_inflight, 1, __ATOMIC_ACQ_REL);
+    }
+    return NULL;
+}
+
+static int client_token_compare(const void *a, const void *b) {
+    return strcmp(((const client_token *)a)->id, ((const client_token *)b)->id);
+}
+
+// 读取-K文件，每行"<客户端标识> <令牌>"，#开头为注释；失败返回-1
+int load_client_tokens(const char *path) {
+    char line[256];
+    size_t capacity = 0;
+
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        return -1;
+    }
+    while (fgets(line, sizeof(line), f)) {
+        client_token entry;
+        if (line[0] == '#' || sscanf(line, "%63s %127s", entry.id, entry.token) != 2) {
+            continue;
+        }
+        if (g_client_token_count == capacity) {
+            size_t next = capacity ? capacity * 2 : 64;
+            client_token *grown = next <= CLIENT_TOKENS_MAX
+                                ? realloc(g_client_tokens, next * sizeof(client_token)) : NULL;
+            if (!grown) {
+                fclose(f);
+                return -1;
+            }
+            g_client_tokens = grown;
+            capacity = next;
+        }
+        g_client_tokens[g_client_token_count++] = entry;
+    }
+    fclose(f);
+    qsort(g_client_tokens, g_client_token_count, sizeof(client_token), client_token_compare);
+    return 0;
+}
+
+// 查找客户端标识自己的令牌，不在-K文件中时返回NULL
+const char *client_token_lookup(const char *id) {
+    client_token key;
+
+    if (g_client_token_count == 0) {
+        return NULL;
+    }
+    snprintf(key.id, sizeof(key.id), "%s", id);
+    const client_token *found = bsearch(&key, g_client_tokens, g_client_token_count,
+                                        sizeof(client_token), client_token_compare);
+    return found ? found->token : NULL;
+}
+
+// 记录名是否为客户端标识之下的名字（"<标签>.<客户端标识>"，不区分大小写）
+int record_under_client(const char *name, const char *client_id) {
+    size_t name_len = strlen(name);
+    size_t id_len = strlen(client_id);
+
+    return name_len > id_len + 1 && name[name_len - id_len - 1] == '.' &&
+           strcasecmp(name + name_len - id_len, client_id) == 0;
+}
+
+// 解析探测请求并交给工作线程，失败时把错误响应写入error
+int submit_probe(conn_t *c, unsigned int tag, const char *request, char *error, size_t error_len) {
+    probe_job job;
+
+    memset(&job, 0, sizeof(job));
+    if (parse_client_address(request, job.ip, &job.port) < 0) {
+        PROBE_LOG("Failed to parse client address\n");
+        snprintf(error, error_len, "ERROR: Invalid address format");
+        return -1;
+    }
+
+    job.conn = c;
+    job.tag = tag;
+    job.use_syn = request_has_option(request, "syn");
+
+    // 经-K认证的会话中的探测验证通过后发布到内置DNS，记录名默认为客户端标识，
+    // name=只能指定客户端标识之下的名字（如租户），不能写入其他客户端的记录
+    if (g_dns && c->mode == CONN_SESSION && c->id_verified) {
+        if (request_str_option(request, "name", job.record, sizeof(job.record)) < 0) {
+            snprintf(job.record, sizeof(job.record), "%s", c->client_id);
+        } else if (!record_under_client(job.record, c->client_id)) {
+            snprintf(error, error_len, "ERROR: Record name must be under %s", c->client_id);
+            return -1;
+        }
+        // 单凭SYN-ACK不能证明客户端在该地址上，会话来源以外的地址改用回连发送随机值
+        if (!is_peer_address(c, job.ip)) {
+            job.use_syn = 0;
+        }
+    }
+
+    // 截止时间按服务端收到请求的时刻加上客户端声明的等待时间计算，不依赖双方时钟同步
+    int budget = request_int_option(request, "budget", DEFAULT_PROBE_BUDGET_MS);
+    if (budget > MAX_PROBE_BUDGET_MS) {
+        budget = MAX_PROBE_BUDGET_MS;
+    }
+    job.deadline_ms = probe_now_ms() + budget;
+    job.received_us = probe_now_us();
+
+    __atomic_add_fetch(&c->refs, 1, __ATOMIC_ACQ_REL);
+    __atomic_add_fetch(&g_inflight, 1, __ATOMIC_ACQ_REL);
+
+    // 队列满时先移出已来不及探测的任务，只有全部任务都还有效时才拒绝新请求
+    probe_job evicted;
+    int pushed = probe_queue_push(g_queue, &job, probe_now_ms() + MIN_PROBE_BUDGET_MS, &evicted);
+    if (pushed < 0) {
+        __atomic_sub_fetch(&g_inflight, 1, __ATOMIC_ACQ_REL);
+        conn_release(c);
+        printf("Probe queue full, rejecting request\n");
+        snprintf(error, error_len, "ERROR: Server busy");
+        return -1;
+    }
+    if (pushed == 1) {
+        PROBE_LOG("Evicting expired probe for %s:%d from full queue\n", evicted.ip, evicted.port);
+        deliver_response(evicted.conn, evicted.tag, "ERROR: Deadline expired");
+        conn_release(evicted.conn);
+        __atomic_sub_fetch(&g_inflight, 1, __ATOMIC_ACQ_REL);
+    }
+    return 0;
+}
+
+session_entry *session_lookup(const char *id, int create) {
+    unsigned long h = 5381;
+    const char *p;
+
+    for (p = id; *p; p++) {
+        h = h * 33 + (unsigned char)*p;
+    }
+
+    for (size_t i = 0; i < SESSION_TABLE_SIZE; i++) {
+        session_entry *e = &g_sessions[(h + i) % SESSION_TABLE_SIZE];
+        if (!e->used) {
+            if (!create) {
+                return NULL;
+            }
+            snprintf(e->id, sizeof(e->id), "%s", id);
+            return e;
+        }
+        if (strcmp(e->id, id) == 0) {
+            return e;
+        }
+    }
+    if (create) {
+        printf("Session table full, not tracking %s\n", id);
+    }
+    return NULL;
+}
+
+// 清除断开超过SESSION_ENTRY_TTL的登记，有清除时重建整张表，使线性探测链保持短小
+void session_sweep(time_t now) {
+    static session_entry live[SESSION_TABLE_SIZE];
+    size_t count = 0;
+    size_t dropped = 0;
+
+    for (size_t i = 0; i < SESSION_TABLE_SIZE; i++) {
+        session_entry *e = &g_sessions[i];
+        if (!e->used) {
+            continue;
+        }
+        if (!e->conn && now - e->last_seen > SESSION_ENTRY_TTL) {
+            dropped++;
+        } else {
+            live[count++] = *e;
+        }
+    }
+    if (dropped == 0) {
+        return;
+    }
+
+    memset(g_sessions, 0, sizeof(g_sessions));
+    for (size_t i = 0; i < count; i++) {
+        *session_lookup(live[i].id, 1) = live[i];
+    }
+}
+
+void conn_close(conn_t *c);
+void conn_close_deferred(conn_t *c);
+
+// 登记会话，返回1表示同一客户端这次的源地址与上次不同，需要客户端重新验证
+// 标识正被另一地址的在线会话使用、而本会话未经该标识自己的令牌认证时返回-1，不取代它
+int session_register(conn_t *c) {
+    session_entry *e = session_lookup(c->client_id, 1);
+    int changed = 0;
+
+    if (!e) {
+        return 0;
+    }
+
+    // 只持有共用令牌的客户端不能借同一标识把别人的会话挤掉
+    if (e->conn && e->conn != c && !c->id_verified && strcmp(e->conn->ip, c->ip) != 0) {
+        return -1;
+    }
+
+    if (e->used && strcmp(e->ip, c->ip) != 0) {
+        changed = 1;
+    }
+
+    // 同一客户端的旧会话被新会话取代
+    if (e->conn && e->conn != c) {
+        conn_t *old = e->conn;
+        e->conn = NULL;
+        printf("Session %s superseded by new connection from %s\n", c->client_id, c->endpoint);
+        conn_close_deferred(old);
+    }
+
+    e->used = 1;
+    snprintf(e->ip, sizeof(e->ip), "%s", c->ip);
+    e->conn = c;
+    e->last_seen = time(NULL);
+    return changed;
+}
+
+void session_forget(conn_t *c) {
+    session_entry *e = session_lookup(c->client_id, 0);
+    if (e && e->conn == c) {
+        e->conn = NULL;
+        e->last_seen = time(NULL);
+    }
+}
+
+// 比较令牌，耗时与内容无关
+int token_equal(const char *given, const char *expected) {
+    size_t given_len = strlen(given);
+    size_t expected_len = strlen(expected);
+    unsigned char diff = given_len != expected_len;
+
+    for (size_t i = 0; i < expected_len; i++) {
+        diff |= (unsigned char)(expected[i] ^ (i < given_len ? given[i] : 0));
+    }
+    return diff == 0;
+}
+
+void send_line(conn_t *c, const char *fmt, ...) {
+    char line[BUFFER_SIZE];
+    va_list args;
+
+    va_start(args, fmt);
+    int len = vsnprintf(line, sizeof(line), fmt, args);
+    va_end(args);
+
+    if (len > 0) {
+        conn_send(c, line, (size_t)len < sizeof(line) ? (size_t)len : sizeof(line) - 1);
+    }
+}
+
+// 会话握手: SESSION <client-id> [token]
+void handle_session_hello(conn_t *c, const char *line) {
+    char id[SESSION_ID_MAX] = "";
+    char token[128] = "";
+
+    sscanf(line + 7, "%63s %127s", id, token);
+
+    if (id[0] == '\0') {
+        send_line(c, "ERROR Missing client id\n");
+        c->mode = CONN_LEGACY;
+        conn_finish(c);
+        return;
+    }
+
+    // -K中列出的标识只接受它自己的令牌，其余标识使用共用令牌（-k）
+    const char *expected = client_token_lookup(id);
+    if (expected ? !token_equal(token, expected) : (g_session_token && !token_equal(token, g_session_token))) {
+        printf("Session authentication failed for %s from %s\n", id, c->endpoint);
+        send_line(c, "ERROR Authentication failed\n");
+        c->mode = CONN_LEGACY;
+        conn_finish(c);
+        return;
+    }
+
+    snprintf(c->client_id, sizeof(c->client_id), "%s", id);
+    c->id_verified = expected != NULL;
+    c->mode = CONN_SESSION;
+    int changed = session_register(c);
+    if (changed < 0) {
+        printf("Session %s from %s refused: id in use from another address\n", id, c->endpoint);
+        send_line(c, "ERROR Client id in use\n");
+        c->mode = CONN_LEGACY;
+        conn_finish(c);
+        return;
+    }
+
+    printf("Session %s established from %s\n", c->client_id, c->endpoint);
+    send_line(c, "OK SESSION %s\n", c->endpoint);
+
+    // 客户端源地址变化，推送重新验证
+    if (changed) {
+        printf("Session %s source address changed, requesting re-verify\n", c->client_id);
+        send_line(c, "REVERIFY %s\n", c->endpoint);
+    }
+}
+
+// 发送出站端口占用统计（STATS命令）
+void send_stats(conn_t *c) {
+    char *stats = malloc(STATS_BUFFER_SIZE);
+    if (!stats) {
+        send_line(c, "ERROR Out of memory\n");
+        return;
+    }
+    size_t len = source_pool_format_stats(g_sources, stats, STATS_BUFFER_SIZE);
+    len += tls_channel_format_stats(stats + len, STATS_BUFFER_SIZE - len);
+    len += dns_responder_format_stats(g_dns, stats + len, STATS_BUFFER_SIZE - len);
+    conn_send(c, stats, len);
+    free(stats);
+}
+
+// 是否来自本机的连接，未认证连接的STATS只对本机开放
+int is_loopback_peer(const conn_t *c) {
+    if (c->peer.ss_family == AF_INET) {
+        return (ntohl(((const struct sockaddr_in *)&c->peer)->sin_addr.s_addr) >> 24) == 127;
+    }
+    const struct in6_addr *a = &((const struct sockaddr_in6 *)&c->peer)->sin6_addr;
+    return IN6_IS_ADDR_LOOPBACK(a) || (IN6_IS_ADDR_V4MAPPED(a) && a->s6_addr[12] == 127);
+}
+
+// CONFIRM <tag> <随机值>：客户端回传回连收到的随机值，证明它在探测的地址上，随后发布该记录
+void confirm_claim(conn_t *c, const char *args) {
+    record_claim claim;
+    char proof[PROOF_LEN] = "";
+    char *end;
+    unsigned long tag = strtoul(args, &end, 10);
+
+    sscanf(end, " %32s", proof);
+    if (end == args || claim_take(c, (unsigned int)tag, &claim) < 0) {
+        send_line(c, "RESULT %lu ERROR: No pending record\n", tag);
+    } else if (!token_equal(proof, claim.proof)) {
+        printf("Session %s failed to confirm %s for %s\n", c->client_id, claim.ip, claim.record);
+        send_line(c, "RESULT %lu ERROR: Proof mismatch\n", tag);
+    } else if (publish_record(claim.record, claim.ip) < 0) {
+        send_line(c, "RESULT %lu ERROR: DNS record not published\n", tag);
+    } else {
+        send_line(c, "RESULT %lu PUBLISHED\n", tag);
+    }
+}
+
+void handle_session_line(conn_t *c, const char *line) {
+    char error[BUFFER_SIZE];
+
+    if (strncmp(line, "PROBE ", 6) == 0) {
+        char *end;
+        unsigned long tag = strtoul(line + 6, &end, 10);
+        if (end == line + 6 || *end != ' ') {
+            send_line(c, "ERROR Malformed probe request\n");
+            return;
+        }
+        PROBE_LOG("Session %s probe %lu: %s\n", c->client_id, tag, end + 1);
+        if (submit_probe(c, (unsigned int)tag, end + 1, error, sizeof(error)) < 0) {
+            send_line(c, "RESULT %lu %s\n", tag, error);
+        }
+    } else if (strncmp(line, "CONFIRM ", 8) == 0) {
+        confirm_claim(c, line + 8);
+    } else if (strcmp(line, "PING") == 0) {
+        send_line(c, "PONG\n");
+    } else if (strcmp(line, "WHOAMI") == 0) {
+        send_line(c, "REFLEXIVE: %s\n", c->endpoint);
+    } else if (strcmp(line, "STATS") == 0) {
+        // 未设置-k时会话不经认证，与一次性连接一样只对本机开放
+        if (g_session_token || is_loopback_peer(c)) {
+            send_stats(c);
+        } else {
+            send_line(c, "ERROR Permission denied\n");
+        }
+    } else if (strcmp(line, "QUIT") == 0) {
+        conn_finish(c);
+    } else if (line[0] != '\0') {
+        send_line(c, "ERROR Unknown command\n");
+    }
+}
+
+// 一次性请求：整段数据即为请求（与旧版单次recv的语义一致）
+void handle_legacy_request(conn_t *c) {
+    char error[BUFFER_SIZE];
+
+    PROBE_LOG("Received from client: %s\n", c->inbuf);
+    c->mode = CONN_LEGACY;
+
+    // 反射地址查询：返回服务端观察到的控制连接源地址和端口（类似STUN）
+    if (strncmp(c->inbuf, "WHOAMI", 6) == 0) {
+        send_line(c, "REFLEXIVE: %s", c->endpoint);
+        conn_finish(c);
+        return;
+    }
+
+    // 端口占用统计，供本机监控采集
+    if (strncmp(c->inbuf, "STATS", 5) == 0 && is_loopback_peer(c)) {
+        send_stats(c);
+        conn_finish(c);
+        return;
+    }
+
+    if (submit_probe(c, 0, c->inbuf, error, sizeof(error)) < 0) {
+        conn_send(c, error, strlen(error));
+        conn_finish(c);
+    }
+}
+
+void process_session_lines(conn_t *c) {
+    char *start = c->inbuf;
+    char *nl;
+
+    while ((nl = memchr(start, '\n', c->inlen - (size_t)(start - c->inbuf))) != NULL) {
+        *nl = '\0';
+        if (nl > start && nl[-1] == '\r') {
+            nl[-1] = '\0';
+        }
+
+        if (c->mode == CONN_PENDING) {
+            handle_session_hello(c, start);
+        } else if (c->mode == CONN_SESSION) {
+            handle_session_line(c, start);
+        }
+        start = nl + 1;
+    }
+
+    c->inlen -= (size_t)(start - c->inbuf);
+    memmove(c->inbuf, start, c->inlen);
+}
+
+// 根据首字节判断是否为TLS连接（ClientHello以握手记录0x16开头）
+// 返回1继续读取，0等待数据，-1关闭连接
+int conn_detect_tls(conn_t *c) {
+    unsigned char first;
+
+    ssize_t n = recv(c->fd, &first, 1, MSG_PEEK);
+    if (n == 0) {
+        return -1;
+    }
+    if (n < 0) {
+        return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+    }
+    c->tls_checked = 1;
+
+    if (first != TLS_RECORD_HANDSHAKE) {
+        if (g_tls_required) {
+            printf("Rejecting cleartext connection from %s\n", c->endpoint);
+            return -1;
+        }
+        return 1;
+    }
+    c->tls = tls_channel_new(c->fd);
+    return c->tls ? 1 : -1;
+}
+
+// 推进TLS握手，早期数据（0-RTT请求）追加到输入缓冲以便立即处理
+// 返回1握手已完成，0仍在握手，-1失败
+int conn_tls_handshake(conn_t *c) {
+    size_t got = 0;
+
+    pthread_mutex_lock(&c->lock);
+    int ret = tls_channel_handshake(c->tls, c->inbuf + c->inlen, sizeof(c->inbuf) - 1 - c->inlen, &got);
+    int finish = ret == TLS_CHANNEL_DONE && c->finish_pending;
+    pthread_mutex_unlock(&c->lock);
+    c->inlen += got;
+
+    if (ret == TLS_CHANNEL_ERROR) {
+        printf("TLS handshake failed from %s\n", c->endpoint);
+        return -1;
+    }
+    if (ret == TLS_CHANNEL_DONE) {
+        char desc[128];
+        tls_channel_describe(c->tls, desc, sizeof(desc));
+        PROBE_LOG("TLS established from %s: %s\n", c->endpoint, desc);
+        if (finish) {
+            conn_finish(c);
+        }
+        return 1;
+    }
+    return 0;
+}
+
+// 从控制连接读取明文，TLS连接与工作线程的写入共用同一个SSL对象，需持锁
+ssize_t conn_recv(conn_t *c, void *buf, size_t len) {
+    if (!c->tls) {
+        return recv(c->fd, buf, len, 0);
+    }
+
+    pthread_mutex_lock(&c->lock);
+    ssize_t n = tls_channel_recv(c->tls, buf, len);
+    int saved_errno = errno;
+    pthread_mutex_unlock(&c->lock);
+    errno = saved_errno;
+    return n;
+}
+
+// 读取控制连接上的数据，连接应被关闭时返回-1
+int handle_readable(conn_t *c) {
+    int eof = 0;
+    int readable = 1;
+
+    if (g_tls_enabled && !c->tls_checked) {
+        readable = conn_detect_tls(c);
+        if (readable <= 0) {
+            return readable;
+        }
+    }
+    if (c->tls && !tls_channel_established(c->tls)) {
+        readable = conn_tls_handshake(c);
+        if (readable < 0) {
+            return -1;
+        }
+    }
+
+    while (readable) {
+        if (c->inlen >= sizeof(c->inbuf) - 1) {
+            if (c->mode == CONN_LEGACY) {
+                c->inlen = 0;
+            } else if (c->mode == CONN_SESSION || strncmp(c->inbuf, "SESSION", 7) == 0) {
+                printf("Line too long from %s\n", c->endpoint);
+                return -1;
+            } else {
+                break;
+            }
+        }
+
+        ssize_t n = conn_recv(c, c->inbuf + c->inlen, sizeof(c->inbuf) - 1 - c->inlen);
+        if (n > 0) {
+            c->inlen += (size_t)n;
+            continue;
+        }
+        if (n == 0) {
+            eof = 1;
+            break;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            break;
+        }
+        return -1;
+    }
+
+    c->inbuf[c->inlen] = '\0';
+    c->last_active = time(NULL);
+
+    if (c->inlen > 0) {
+        if (c->mode == CONN_LEGACY) {
+            c->inlen = 0;
+        } else if (c->mode == CONN_SESSION || strncmp(c->inbuf, "SESSION", 7) == 0) {
+            process_session_lines(c);
+        } else if (c->mode == CONN_PENDING) {
+            handle_legacy_request(c);
+            c->inlen = 0;
+        }
+    }
+
+    return eof ? -1 : 0;
+}
+
+void conn_close(conn_t *c) {
+    pthread_mutex_lock(&c->lock);
+    c->closed = 1;
+    pthread_mutex_unlock(&c->lock);
+
+    epoll_ctl(g_epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+    if (c->prev) {
+        c->prev->next = c->next;
+    } else {
+        g_conns = c->next;
+    }
+    if (c->next) {
+        c->next->prev = c->prev;
+    }
+
+    if (c->mode == CONN_SESSION) {
+        session_forget(c);
+        printf("Session %s disconnected (%s)\n\n", c->client_id, c->endpoint);
+    } else {
+        PROBE_LOG("Connection closed\n\n");
+    }
+    conn_release(c);
+}
+
+// 在处理一批epoll事件的中途关闭另一个连接：同一批中可能还有它的事件，
+// 先多持有一个引用放入g_reap，这批事件处理完后再释放，期间它的事件因closed被跳过
+void conn_close_deferred(conn_t *c) {
+    __atomic_add_fetch(&c->refs, 1, __ATOMIC_ACQ_REL);
+    conn_close(c);
+    c->next = g_reap;
+    g_reap = c;
+}
+
+void accept_connections(int server_fd) {
+    for (;;) {
+        struct sockaddr_storage addr;
+        socklen_t addr_len = sizeof(addr);
+
+        int fd = accept4(server_fd, (struct sockaddr *)&addr, &addr_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                perror("Accept failed");
+            }
+            return;
+        }
+
+        conn_t *c = calloc(1, sizeof(*c));
+        if (!c) {
+            close(fd);
+            continue;
+        }
+        c->fd = fd;
+        c->refs = 1;
+        c->mode = CONN_PENDING;
+        c->last_active = time(NULL);
+        memcpy(&c->peer, &addr, sizeof(addr));
+        pthread_mutex_init(&c->lock, NULL);
+        format_peer_ip(&addr, c->ip, sizeof(c->ip));
+        format_endpoint(&addr, c->endpoint, sizeof(c->endpoint));
+
+        PROBE_LOG("Client connected from: %s\n", c->endpoint);
+
+        // 长连接会话依赖TCP保活及时发现对端消失
+        int on = 1, idle = 60, interval = 10, count = 3;
+        setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &on, sizeof(on));
+        setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof(idle));
+        setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &interval, sizeof(interval));
+        setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, &count, sizeof(count));
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLRDHUP;
+        ev.data.ptr = c;
+        if (epoll_ctl(g_epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            perror("epoll_ctl failed");
+            conn_release(c);
+            continue;
+        }
+
+        c->next = g_conns;
+        if (g_conns) {
+            g_conns->prev = c;
+        }
+        g_conns = c;
+    }
+}
+
+// 关闭空闲会话和迟迟不发请求的连接
+void sweep_idle_connections(void) {
+    time_t now = time(NULL);
+    conn_t *c = g_conns;
+
+    while (c) {
+        conn_t *next = c->next;
+        if ((c->mode == CONN_SESSION && now - c->last_active > SESSION_IDLE_TIMEOUT) ||
+            (c->mode == CONN_PENDING && now - c->last_active > TIMEOUT_SEC)) {
+            printf("Closing idle connection from %s\n", c->endpoint);
+            conn_close(c);
+        }
+        c = next;
+    }
+}
+
+void handle_stop_signal(int sig) {
+    (void)sig;
+    g_stop_requested = 1;
+}
+
+// 平滑升级后旧进程排空退出时释放日志文件，之后由本进程接着写入
+void retry_journal(void) {
+    if (!g_journal_path || g_journal) {
+        return;
+    }
+    journal *j = journal_open(g_journal_path, g_journal_regions, g_journal_capacity);
+    if (j) {
+        __atomic_store_n(&g_journal, j, __ATOMIC_RELEASE);
+        printf("Journaling probes to %s (%u records per worker)\n", g_journal_path, g_journal_capacity);
+    } else if (errno != EWOULDBLOCK) {
+        perror("Reopening journal failed");
+        g_journal_path = NULL;
+    }
+}
+
+// 结束进行中的交接（已完成、失败或超时）
+void end_handoff(void) {
+    if (g_handoff_peer) {
+        epoll_ctl(g_epoll_fd, EPOLL_CTL_DEL, handoff_peer_fd(g_handoff_peer), NULL);
+        handoff_peer_free(g_handoff_peer);
+        g_handoff_peer = NULL;
+    }
+}
+
+// 交接套接字可读：接受新进程的连接，之后的消息交换由事件循环驱动
+void start_handoff(void) {
+    handoff_peer *p = handoff_accept(g_handoff_fd);
+    if (!p) {
+        return;
+    }
+    if (g_handoff_peer || g_draining) {
+        printf("Handoff already in progress, rejecting another request\n");
+        handoff_peer_free(p);
+        return;
+    }
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLRDHUP;
+    ev.data.ptr = &g_handoff_peer_tag;
+    if (epoll_ctl(g_epoll_fd, EPOLL_CTL_ADD, handoff_peer_fd(p), &ev) < 0) {
+        perror("epoll_ctl failed");
+        handoff_peer_free(p);
+        return;
+    }
+    g_handoff_peer = p;
+}
+
+// 停止accept并开始排空：监听套接字若已交给新进程则由新进程继续accept
+void begin_drain(const char *reason) {
+    if (g_draining) {
+        return;
+    }
+    g_draining = 1;
+    g_drain_deadline = time(NULL) + DRAIN_TIMEOUT_SEC;
+    end_handoff();
+    // 排空期间不再应答DNS，避免以过时的记录表与新进程分摊查询
+    dns_responder_retire(g_dns);
+    printf("Draining (%s): no longer accepting, %d probes in flight\n",
+           reason, __atomic_load_n(&g_inflight, __ATOMIC_ACQUIRE));
+
+    epoll_ctl(g_epoll_fd, EPOLL_CTL_DEL, g_listen_fd, NULL);
+    close(g_listen_fd);
+    g_listen_fd = -1;
+
+    if (g_handoff_fd >= 0) {
+        epoll_ctl(g_epoll_fd, EPOLL_CTL_DEL, g_handoff_fd, NULL);
+        close(g_handoff_fd);
+        g_handoff_fd = -1;
+    }
+}
+
+// 排空中：关闭已没有在途探测的会话（客户端会重连到新进程），全部完成后返回1
+int drain_progress(void) {
+    conn_t *c = g_conns;
+
+    while (c) {
+        conn_t *next = c->next;
+        if (c->mode == CONN_SESSION && __atomic_load_n(&c->refs, __ATOMIC_ACQUIRE) == 1) {
+            conn_close(c);
+        }
+        c = next;
+    }
+
+    if (!g_conns && __atomic_load_n(&g_inflight, __ATOMIC_ACQUIRE) == 0) {
+        printf("Drain complete\n");
+        return 1;
+    }
+    if (time(NULL) >= g_drain_deadline) {
+        printf("Drain timeout, %d probes still in flight\n", __atomic_load_n(&g_inflight, __ATOMIC_ACQUIRE));
+        return 1;
+    }
+    return 0;
+}
+
+void event_loop(void) {
+    struct epoll_event ev, events[MAX_EVENTS];
+    time_t last_sweep = time(NULL);
+
+    ev.events = EPOLLIN;
+    ev.data.ptr = &g_listen_tag;
+    if (epoll_ctl(g_epoll_fd, EPOLL_CTL_ADD, g_listen_fd, &ev) < 0) {
+        perror("epoll_ctl failed");
+        return;
+    }
+
+    if (g_handoff_fd >= 0) {
+        ev.events = EPOLLIN;
+        ev.data.ptr = &g_handoff_tag;
+        epoll_ctl(g_epoll_fd, EPOLL_CTL_ADD, g_handoff_fd, &ev);
+    }
+
+    while (1) {
+        int n = epoll_wait(g_epoll_fd, events, MAX_EVENTS, g_draining ? 100 : 1000);
+        if (n < 0) {
+            if (errno != EINTR) {
+                perror("epoll_wait failed");
+                return;
+            }
+            n = 0;
+        }
+
+        for (int i = 0; i < n; i++) {
+            void *ptr = events[i].data.ptr;
+
+            if (ptr == &g_listen_tag) {
+                if (!g_draining) {
+                    accept_connections(g_listen_fd);
+                }
+                continue;
+            }
+
+            if (ptr == &g_handoff_tag) {
+                start_handoff();
+                continue;
+            }
+
+            if (ptr == &g_handoff_peer_tag) {
+                // 新进程接管监听套接字后本进程只负责收尾
+                int step = g_handoff_peer ? handoff_step(g_handoff_peer, g_listen_fd) : HANDOFF_ERROR;
+                if (step == HANDOFF_DONE) {
+                    begin_drain("handed off to new process");
+                } else if (step == HANDOFF_ERROR) {
+                    printf("Handoff aborted, continuing to serve\n");
+                    end_handoff();
+                }
+                continue;
+            }
+
+            conn_t *c = ptr;
+            int alive = 1;
+            if (c->closed) {
+                continue;
+            }
+            if (events[i].events & (EPOLLIN | EPOLLRDHUP)) {
+                alive = handle_readable(c) == 0;
+            }
+            if (!alive || (events[i].events & (EPOLLHUP | EPOLLERR))) {
+                conn_close(c);
+            }
+        }
+        while (g_reap) {
+            conn_t *c = g_reap;
+            g_reap = c->next;
+            conn_release(c);
+        }
+
+        if (g_stop_requested && !g_draining) {
+            // 没有接替进程，交接套接字路径不再有效
+            if (g_handoff_path && g_handoff_fd >= 0) {
+                unlink(g_handoff_path);
+            }
+            begin_drain("stop signal");
+        }
+
+        if (g_draining && drain_progress()) {
+            return;
+        }
+
+        time_t now = time(NULL);
+        if (now != last_sweep) {
+            sweep_idle_connections();
+            session_sweep(now);
+            retry_journal();
+            if (g_handoff_peer && handoff_expired(g_handoff_peer, now)) {
+                printf("Handoff timed out, continuing to serve\n");
+                end_handoff();
+            }
+            last_sweep = now;
+        }
+    }
+}
+
+// 取得监听套接字：平滑升级时从旧进程接管，其次使用继承的fd，最后自行创建
+// 接管成功时*handoff_conn为与旧进程的连接，开始accept后需调用handoff_ready
+int acquire_listen_socket(int takeover, int *handoff_conn) {
+    int fd = -1;
+
+    *handoff_conn = -1;
+    if (takeover && g_handoff_path) {
+        *handoff_conn = handoff_request(g_handoff_path, &fd);
+        if (*handoff_conn >= 0) {
+            printf("Took over listening socket from running server via %s\n", g_handoff_path);
+            return fd;
+        }
+        printf("Takeover via %s failed, binding a new socket\n", g_handoff_path);
+    }
+
+    fd = inherited_listen_fd();
+    if (fd >= 0) {
+        printf("Using inherited listening socket (fd %d)\n", fd);
+        return fd;
+    }
+
+    // 创建监听socket（优先IPv4/IPv6双栈）
+    return create_server_socket(DEFAULT_PORT);
+}
+
+void print_usage(const char *prog) {
+    printf("Usage: %s [-s] [-w workers] [-k token] [-K tokens-file] [-u handoff-socket [-U]] [-j journal [-J records]] [-v] [-b addr[,addr...]] [-R] [-t cert [-T key] [-X]] [-D zone [-N ns-host] [-P port] [-L ttl] [-S snapshot]]\n", prog);
+    printf("  -s          使用原始套接字无状态SYN探测（需要CAP_NET_RAW，不可用时回退到connect）\n");
+    printf("  -w workers  探测工作线程数（默认%d）\n", DEFAULT_WORKERS);
+    printf("  -k token    长连接会话的认证令牌，客户端需在SESSION握手中提供\n");
+    printf("  -K path     每个客户端标识各自的令牌，每行\"<客户端标识> <令牌>\"，列出的标识只接受自己的令牌\n");
+    printf("  -u path     平滑升级用的Unix域交接套接字路径\n");
+    printf("  -U          从-u指定的运行中服务端接管监听套接字，旧进程随后排空退出\n");
+    printf("  -j path     把每次探测写入二进制日志文件（mmap环形缓冲，用journal_reader读取）\n");
+    printf("  -J records  每个工作线程保留的日志记录数（默认%d）\n", DEFAULT_JOURNAL_RECORDS);
+    printf("  -v          启用日志文件时仍输出逐次探测的文本日志\n");
+    printf("  -b addrs    探测连接轮流使用的源地址（逗号分隔，可重复指定），每个源地址各有一套临时端口\n");
+    printf("  -R          探测连接以RST断开，服务端不产生TIME_WAIT\n");
+    printf("  -t cert     控制连接启用TLS 1.3（PEM证书链），支持会话票据恢复和0-RTT请求\n");
+    printf("  -T key      PEM私钥（默认从证书文件读取）\n");
+    printf("  -X          只接受TLS控制连接，拒绝明文请求\n");
+    printf("  -D zone     为委派的子区域应答DNS查询，经-K认证的会话中验证通过的地址发布为<客户端标识>.<zone>（需要-K）\n");
+    printf("  -N ns-host  NS/SOA记录中本服务器的名字（默认ns.<zone>）\n");
+    printf("  -P port     DNS端口，UDP和TCP（默认%d）\n", DEFAULT_DNS_PORT);
+    printf("  -L ttl      DNS记录TTL秒数，同时用于否定应答（默认%d）\n", DEFAULT_DNS_TTL);
+    printf("  -S path     DNS记录快照文件，记录变化时重写，重启或平滑升级后先载入再开始应答\n");
+}
+
+int main(int argc, char *argv[]) {
+    int server_fd;
+    int use_syn_probe = 0;
+    int worker_count = DEFAULT_WORKERS;
+    int takeover = 0;
+    int handoff_conn;
+    const char *journal_path = NULL;
+    long journal_records = DEFAULT_JOURNAL_RECORDS;
+    int verbose = 0;
+    const char *tls_cert = NULL;
+    const char *tls_key = NULL;
+    const char *dns_zone = NULL;
+    const char *dns_ns_host = NULL;
+    int dns_port = DEFAULT_DNS_PORT;
+    long dns_ttl = DEFAULT_DNS_TTL;
+    const char *dns_snapshot = NULL;
+    int opt;
+
+    g_sources = source_pool_create();
+    if (!g_sources) {
+        fprintf(stderr, "Failed to allocate source pool\n");
+        exit(EXIT_FAILURE);
+    }
+
+    while ((opt = getopt(argc, argv, "sw:k:K:u:Uj:J:vb:Rt:T:XD:N:P:L:S:h")) != -1) {
+        switch (opt) {
+            case 's':
+                use_syn_probe = 1;
+                break;
+            case 'w':
+                worker_count = atoi(optarg);
+                if (worker_count < 1) {
+                    worker_count = 1;
+                }
+                break;
+            case 'k':
+                g_session_token = optarg;
+                break;
+            case 'K':
+                if (load_client_tokens(optarg) < 0) {
+                    fprintf(stderr, "Failed to load client tokens from %s\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'u':
+                g_handoff_path = optarg;
+                break;
+            case 'U':
+                takeover = 1;
+                break;
+            case 'j':
+                journal_path = optarg;
+                break;
+            case 'J':
+                journal_records = atol(optarg);
+                if (journal_records < 1 || journal_records > UINT32_MAX) {
+                    journal_records = DEFAULT_JOURNAL_RECORDS;
+                }
+                break;
+            case 'v':
+                verbose = 1;
+                break;
+            case 'b':
+                for (char *addr = strtok(optarg, ","); addr; addr = strtok(NULL, ",")) {
+                    if (source_pool_add(g_sources, addr) < 0) {
+                        fprintf(stderr, "Invalid or too many source addresses: %s\n", addr);
+                        exit(EXIT_FAILURE);
+                    }
+                }
+                break;
+            case 'R':
+                g_rst_teardown = 1;
+                break;
+            case 't':
+                tls_cert = optarg;
+                break;
+            case 'T':
+                tls_key = optarg;
+                break;
+            case 'X':
+                g_tls_required = 1;
+                break;
+            case 'D':
+                dns_zone = optarg;
+                break;
+            case 'N':
+                dns_ns_host = optarg;
+                break;
+            case 'P':
+                dns_port = atoi(optarg);
+                if (dns_port < 1 || dns_port > 65535) {
+                    dns_port = DEFAULT_DNS_PORT;
+                }
+                break;
+            case 'L':
+                dns_ttl = atol(optarg);
+                if (dns_ttl < 0 || dns_ttl > 86400) {
+                    dns_ttl = DEFAULT_DNS_TTL;
+                }
+                break;
+            case 'S':
+                dns_snapshot = optarg;
+                break;
+            default:
+                print_usage(argv[0]);
+                exit(opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+    }
+
+    // 客户端提前断开时写入不能终止整个服务
+    signal(SIGPIPE, SIG_IGN);
+
+    // SIGTERM/SIGINT：停止accept，排空在途探测后退出
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handle_stop_signal;
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGINT, &sa, NULL);
+
+    if (use_syn_probe) {
+        g_syn_engine = syn_engine_create();
+        if (g_syn_engine) {
+            printf("SYN probe engine enabled (source port %d)\n", SYN_SOURCE_PORT);
+        } else {
+            printf("SYN probe engine unavailable, falling back to connect probes\n");
+        }
+    }
+    
+    // 日志文件按工作线程数划分区域，每个线程无锁写入自己的区域
+    if (journal_path) {
+        g_journal_path = journal_path;
+        g_journal_regions = (uint32_t)worker_count;
+        g_journal_capacity = (uint32_t)journal_records;
+        g_journal = journal_open(journal_path, g_journal_regions, g_journal_capacity);
+        if (g_journal) {
+            printf("Journaling probes to %s (%ld records per worker)\n", journal_path, journal_records);
+        } else if (errno == EWOULDBLOCK) {
+            printf("Journal %s is held by another server, journaling starts when it exits\n", journal_path);
+        } else {
+            fprintf(stderr, "Failed to open journal %s\n", journal_path);
+            exit(EXIT_FAILURE);
+        }
+        g_probe_log = verbose;
+    }
+
+    if (tls_cert) {
+        if (tls_channel_setup(tls_cert, tls_key) < 0) {
+            fprintf(stderr, "Failed to set up TLS with %s\n", tls_cert);
+            exit(EXIT_FAILURE);
+        }
+        g_tls_enabled = 1;
+        printf("TLS 1.3 control channel enabled%s\n", g_tls_required ? " (cleartext rejected)" : "");
+    } else if (g_tls_required) {
+        fprintf(stderr, "-X requires a TLS certificate (-t)\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // 记录只由经自己令牌认证的客户端标识发布，持有共用令牌的客户端可以冒用任意标识
+    if (dns_zone) {
+        if (g_client_token_count == 0) {
+            fprintf(stderr, "-D requires per-client tokens (-K)\n");
+            exit(EXIT_FAILURE);
+        }
+        g_dns = dns_responder_start(dns_zone, dns_ns_host, dns_port, (uint32_t)dns_ttl, dns_snapshot);
+        if (!g_dns) {
+            fprintf(stderr, "Failed to start DNS responder for %s on port %d\n", dns_zone, dns_port);
+            exit(EXIT_FAILURE);
+        }
+        printf("Authoritative DNS for %s on port %d (TTL %lds)\n", dns_zone, dns_port, dns_ttl);
+    }
+
+    server_fd = acquire_listen_socket(takeover, &handoff_conn);
+    if (server_fd < 0) {
+        exit(EXIT_FAILURE);
+    }
+    fcntl(server_fd, F_SETFL, fcntl(server_fd, F_GETFL) | O_NONBLOCK);
+    g_listen_fd = server_fd;
+
+    g_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (g_epoll_fd < 0) {
+        perror("epoll_create1 failed");
+        exit(EXIT_FAILURE);
+    }
+
+    g_queue = probe_queue_create(PROBE_QUEUE_CAPACITY);
+    pthread_t *workers = calloc((size_t)worker_count, sizeof(pthread_t));
+    if (!g_queue || !workers) {
+        fprintf(stderr, "Failed to allocate probe workers\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < worker_count; i++) {
+        if (pthread_create(&workers[i], NULL, probe_worker, (void *)(intptr_t)i) != 0) {
+            perror("pthread_create failed");
+            exit(EXIT_FAILURE);
+        }
+    }
+    
+    // 旧进程确认后才创建自己的交接套接字，避免与旧进程的路径冲突
+    if (handoff_conn >= 0 && handoff_ready(handoff_conn) < 0) {
+        printf("Old server did not acknowledge takeover\n");
+    }
+    if (g_handoff_path) {
+        g_handoff_fd = handoff_listen(g_handoff_path);
+    }
+
+    printf("Server listening on port %d (%d probe workers)\n", DEFAULT_PORT, worker_count);
+    if (source_pool_count(g_sources, AF_INET) + source_pool_count(g_sources, AF_INET6) > 0) {
+        printf("Probe source addresses: %d IPv4, %d IPv6\n",
+               source_pool_count(g_sources, AF_INET), source_pool_count(g_sources, AF_INET6));
+    }
+    printf("Waiting for client connections...\n\n");
+    
+    event_loop();
+
+    probe_queue_close(g_queue);
+    for (int i = 0; i < worker_count; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    free(workers);
+    probe_queue_destroy(g_queue);
+    journal_close(g_journal);
+    dns_responder_stop(g_dns);
+    source_pool_destroy(g_sources);
+    if (g_listen_fd >= 0) {
+        close(g_listen_fd);
+    }
+    close(g_epoll_fd);
+    syn_engine_destroy(g_syn_engine);
     return 0;
 }
 
 // DEFAULT_PORT监听端口
 // 编译命令
-// gcc -o server server.c
+// gcc -o server server.c syn_probe.c probe_queue.c handoff.c journal.c source_pool.c tls_channel.c dns_responder.c -DDDNS_WITH_TLS -lssl -lcrypto -lpthread
+// 不需要TLS时去掉 -DDDNS_WITH_TLS -lssl -lcrypto
+// 平滑升级: ./server -u /run/ddns-server.sock 运行中，启动新版本 ./server -u /run/ddns-server.sock -U
+// 启用SYN探测: sudo ./server -s  (或 setcap cap_net_raw+ep ./server)
+// 多源地址: ./server -b 192.0.2.10,192.0.2.11 -R，端口占用: echo STATS | nc 127.0.0.1 8066
+// TLS控制连接: ./server -t /etc/ddns/server.pem -X
+// 内置DNS: ./server -k secret -D dyn.example.com -N ns1.example.com，父区域把dyn.example.com委派给ns1.example.com
+// 探测日志: ./server -j /var/lib/ddns/probes.jrn，离线分析: journal_reader -a /var/lib/ddns/probes.jrn
@@ -0,0 +1,320 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include "source_pool.h"
+
+#ifndef IP_BIND_ADDRESS_NO_PORT
+#define IP_BIND_ADDRESS_NO_PORT 24   // Linux 4.2+，旧版libc头文件中没有定义
+#endif
+
+#define TCP_STATE_ESTABLISHED 0x01
+#define TCP_STATE_TIME_WAIT 0x06
+#define TCP_STATE_LISTEN 0x0A
+
+typedef struct {
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    uint8_t mapped[16];               // 统计时比较用的16字节形式，IPv4为::ffff:a.b.c.d
+    char text[INET6_ADDRSTRLEN];
+    unsigned long connects;
+    unsigned long addr_unavailable;   // connect返回EADDRNOTAVAIL的次数
+} source_entry;
+
+struct source_pool {
+    source_entry entries[SOURCE_POOL_MAX];
+    int count;
+    unsigned int next_v4, next_v6;    // 轮询位置
+    unsigned long connects;           // 未绑定源地址的探测
+    unsigned long addr_unavailable;
+};
+
+// /proc/net/tcp中的一个连接
+typedef struct {
+    uint8_t local[16];
+    uint8_t remote[16];
+    uint16_t remote_port;
+    uint8_t state;
+} tcp_socket;
+
+typedef struct {
+    uint8_t addr[16];
+    uint16_t port;
+} tcp_target;
+
+source_pool *source_pool_create(void) {
+    return calloc(1, sizeof(source_pool));
+}
+
+void source_pool_destroy(source_pool *pool) {
+    free(pool);
+}
+
+int source_pool_add(source_pool *pool, const char *addr) {
+    if (pool->count >= SOURCE_POOL_MAX) {
+        return -1;
+    }
+
+    source_entry *e = &pool->entries[pool->count];
+    memset(e, 0, sizeof(*e));
+
+    struct sockaddr_in *sin = (struct sockaddr_in *)&e->addr;
+    struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)&e->addr;
+    if (inet_pton(AF_INET, addr, &sin->sin_addr) == 1) {
+        sin->sin_family = AF_INET;
+        e->addr_len = sizeof(*sin);
+        e->mapped[10] = 0xff;
+        e->mapped[11] = 0xff;
+        memcpy(e->mapped + 12, &sin->sin_addr, 4);
+    } else if (inet_pton(AF_INET6, addr, &sin6->sin6_addr) == 1) {
+        sin6->sin6_family = AF_INET6;
+        e->addr_len = sizeof(*sin6);
+        memcpy(e->mapped, &sin6->sin6_addr, 16);
+    } else {
+        return -1;
+    }
+
+    snprintf(e->text, sizeof(e->text), "%s", addr);
+    pool->count++;
+    return 0;
+}
+
+int source_pool_count(const source_pool *pool, int family) {
+    int n = 0;
+    for (int i = 0; i < pool->count; i++) {
+        n += pool->entries[i].addr.ss_family == family;
+    }
+    return n;
+}
+
+int source_pool_pick(source_pool *pool, int family, int previous) {
+    int n = source_pool_count(pool, family);
+    if (n == 0) {
+        return -1;
+    }
+
+    // 在同族地址中的序号，轮询计数器由所有工作线程共享
+    int k;
+    if (previous < 0) {
+        unsigned int *next = family == AF_INET ? &pool->next_v4 : &pool->next_v6;
+        k = (int)(__atomic_fetch_add(next, 1, __ATOMIC_RELAXED) % (unsigned int)n);
+    } else {
+        k = 0;
+        for (int i = 0; i < previous; i++) {
+            k += pool->entries[i].addr.ss_family == family;
+        }
+        k = (k + 1) % n;
+    }
+
+    for (int i = 0; i < pool->count; i++) {
+        if (pool->entries[i].addr.ss_family == family && k-- == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int source_pool_bind(source_pool *pool, int index, int fd) {
+    if (index < 0) {
+        return 0;
+    }
+
+    // 只绑定地址，端口推迟到connect时按完整四元组选择，否则bind会为每个源地址独占一个端口
+    int on = 1;
+    setsockopt(fd, IPPROTO_IP, IP_BIND_ADDRESS_NO_PORT, &on, sizeof(on));
+
+    source_entry *e = &pool->entries[index];
+    return bind(fd, (struct sockaddr *)&e->addr, e->addr_len);
+}
+
+void source_pool_record(source_pool *pool, int index, int err) {
+    unsigned long *connects = index < 0 ? &pool->connects : &pool->entries[index].connects;
+    unsigned long *unavailable = index < 0 ? &pool->addr_unavailable : &pool->entries[index].addr_unavailable;
+
+    __atomic_add_fetch(connects, 1, __ATOMIC_RELAXED);
+    if (err == EADDRNOTAVAIL) {
+        __atomic_add_fetch(unavailable, 1, __ATOMIC_RELAXED);
+    }
+}
+
+// /proc中的地址按32位字逐个以主机字节序的十六进制输出
+static int parse_proc_address(const char *hex, uint8_t out[16]) {
+    size_t words = strlen(hex) / 8;
+    uint32_t w[4];
+
+    if (words != 1 && words != 4) {
+        return -1;
+    }
+    for (size_t i = 0; i < words; i++) {
+        char buf[9];
+        memcpy(buf, hex + i * 8, 8);
+        buf[8] = '\0';
+        w[i] = (uint32_t)strtoul(buf, NULL, 16);
+    }
+
+    memset(out, 0, 16);
+    if (words == 1) {
+        out[10] = 0xff;
+        out[11] = 0xff;
+        memcpy(out + 12, &w[0], 4);
+    } else {
+        memcpy(out, w, 16);
+    }
+    return 0;
+}
+
+// 读取path中本地端口位于[lo, hi]的非监听连接，追加到*sockets
+static void read_proc_tcp(const char *path, int lo, int hi, tcp_socket **sockets, size_t *count, size_t *cap) {
+    FILE *fp = fopen(path, "r");
+    char line[512];
+
+    if (!fp) {
+        return;
+    }
+    if (!fgets(line, sizeof(line), fp)) {   // 跳过表头
+        fclose(fp);
+        return;
+    }
+
+    while (fgets(line, sizeof(line), fp)) {
+        char local[33], remote[33];
+        unsigned int local_port, remote_port, state;
+        tcp_socket s;
+
+        if (sscanf(line, " %*d: %32[0-9A-Fa-f]:%x %32[0-9A-Fa-f]:%x %x",
+                   local, &local_port, remote, &remote_port, &state) != 5) {
+            continue;
+        }
+        if (state == TCP_STATE_LISTEN || (int)local_port < lo || (int)local_port > hi) {
+            continue;
+        }
+        if (parse_proc_address(local, s.local) < 0 || parse_proc_address(remote, s.remote) < 0) {
+            continue;
+        }
+        s.remote_port = (uint16_t)remote_port;
+        s.state = (uint8_t)state;
+
+        if (*count == *cap) {
+            size_t grown_cap = *cap ? *cap * 2 : 1024;
+            tcp_socket *grown = realloc(*sockets, grown_cap * sizeof(*grown));
+            if (!grown) {
+                break;
+            }
+            *sockets = grown;
+            *cap = grown_cap;
+        }
+        (*sockets)[(*count)++] = s;
+    }
+    fclose(fp);
+}
+
+static int compare_target(const void *a, const void *b) {
+    const tcp_target *x = a, *y = b;
+    int c = memcmp(x->addr, y->addr, 16);
+    return c ? c : (x->port > y->port) - (x->port < y->port);
+}
+
+static void format_mapped(const uint8_t addr[16], char *out, size_t len) {
+    static const uint8_t v4_prefix[12] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff};
+
+    if (memcmp(addr, v4_prefix, sizeof(v4_prefix)) == 0) {
+        inet_ntop(AF_INET, addr + 12, out, len);
+    } else {
+        inet_ntop(AF_INET6, addr, out, len);
+    }
+}
+
+// 输出一个源地址（source为NULL表示所有本地地址）的统计行
+static size_t format_source(const tcp_socket *sockets, size_t count, const uint8_t *source,
+                            const char *name, unsigned long connects, unsigned long unavailable,
+                            int ports, tcp_target *targets, char *out, size_t len) {
+    size_t total = 0, established = 0, time_wait = 0, n = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        if (source && memcmp(sockets[i].local, source, 16) != 0) {
+            continue;
+        }
+        total++;
+        established += sockets[i].state == TCP_STATE_ESTABLISHED;
+        time_wait += sockets[i].state == TCP_STATE_TIME_WAIT;
+        memcpy(targets[n].addr, sockets[i].remote, 16);
+        targets[n].port = sockets[i].remote_port;
+        n++;
+    }
+
+    // 同一源地址到同一目标的连接共用一套临时端口，占用最多的目标决定离耗尽还有多远
+    size_t busiest = 0, busiest_at = 0;
+    qsort(targets, n, sizeof(tcp_target), compare_target);
+    for (size_t i = 0, run = 0; i < n; i++) {
+        run = (i > 0 && compare_target(&targets[i - 1], &targets[i]) == 0) ? run + 1 : 1;
+        if (run > busiest) {
+            busiest = run;
+            busiest_at = i;
+        }
+    }
+
+    char target[INET6_ADDRSTRLEN + 8] = "-";
+    if (busiest > 0) {
+        char ip[INET6_ADDRSTRLEN];
+        format_mapped(targets[busiest_at].addr, ip, sizeof(ip));
+        snprintf(target, sizeof(target), strchr(ip, ':') ? "[%s]:%u" : "%s:%u", ip, targets[busiest_at].port);
+    }
+
+    int written = snprintf(out, len,
+                           "SOURCE %s connects=%lu eaddrnotavail=%lu sockets=%zu established=%zu time_wait=%zu "
+                           "busiest=%s busiest_sockets=%zu pressure=%.1f%%\n",
+                           name, connects, unavailable, total, established, time_wait,
+                           target, busiest, ports > 0 ? busiest * 100.0 / ports : 0.0);
+    return written < 0 ? 0 : ((size_t)written < len ? (size_t)written : len - 1);
+}
+
+size_t source_pool_format_stats(source_pool *pool, char *out, size_t len) {
+    int lo = 32768, hi = 60999;
+    FILE *fp = fopen("/proc/sys/net/ipv4/ip_local_port_range", "r");
+    if (fp) {
+        if (fscanf(fp, "%d %d", &lo, &hi) != 2) {
+            lo = 32768;
+            hi = 60999;
+        }
+        fclose(fp);
+    }
+    int ports = hi - lo + 1;
+
+    tcp_socket *sockets = NULL;
+    size_t count = 0, cap = 0;
+    read_proc_tcp("/proc/net/tcp", lo, hi, &sockets, &count, &cap);
+    read_proc_tcp("/proc/net/tcp6", lo, hi, &sockets, &count, &cap);
+
+    size_t used = 0;
+    int written = snprintf(out, len, "STATS port_range=%d-%d ports=%d sources=%d sockets=%zu\n",
+                           lo, hi, ports, pool->count, count);
+    if (written > 0) {
+        used = (size_t)written < len ? (size_t)written : len - 1;
+    }
+
+    tcp_target *targets = malloc((count ? count : 1) * sizeof(tcp_target));
+    if (targets) {
+        // 未配置地址池时统计所有本地地址，否则按源地址分别统计
+        if (pool->count == 0) {
+            used += format_source(sockets, count, NULL, "*",
+                                  __atomic_load_n(&pool->connects, __ATOMIC_RELAXED),
+                                  __atomic_load_n(&pool->addr_unavailable, __ATOMIC_RELAXED),
+                                  ports, targets, out + used, len - used);
+        }
+        for (int i = 0; i < pool->count; i++) {
+            source_entry *e = &pool->entries[i];
+            used += format_source(sockets, count, e->mapped, e->text,
+                                  __atomic_load_n(&e->connects, __ATOMIC_RELAXED),
+                                  __atomic_load_n(&e->addr_unavailable, __ATOMIC_RELAXED),
+                                  ports, targets, out + used, len - used);
+        }
+        free(targets);
+    }
+
+    free(sockets);
+    return used;
+}
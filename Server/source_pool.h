@@ -0,0 +1,43 @@
+#ifndef SOURCE_POOL_H
+#define SOURCE_POOL_H
+
+#include <stddef.h>
+#include <sys/socket.h>
+
+// 出站探测的源地址池：探测连接轮流绑定到不同的源地址，
+// 每个源地址各有一套临时端口，出站容量随源地址数量线性增长
+//
+// 绑定时设置IP_BIND_ADDRESS_NO_PORT，端口推迟到connect时按四元组分配，
+// 同一源地址的端口可以复用于不同的目标地址
+
+#define SOURCE_POOL_MAX 64
+
+typedef struct source_pool source_pool;
+
+// 创建空地址池，不添加地址时探测连接不绑定源地址
+source_pool *source_pool_create(void);
+
+void source_pool_destroy(source_pool *pool);
+
+// 添加源地址（IPv4或IPv6字面量），地址无效或池已满时返回-1
+int source_pool_add(source_pool *pool, const char *addr);
+
+// 地址池中family（AF_INET/AF_INET6）的地址数
+int source_pool_count(const source_pool *pool, int family);
+
+// 选择一个family的源地址，返回索引；没有该族的地址时返回-1
+// previous为-1时轮流选择，否则返回previous之后的下一个同族地址（当前地址端口耗尽时换用）
+int source_pool_pick(source_pool *pool, int family, int previous);
+
+// 把fd绑定到index对应的源地址（端口在connect时分配），index为-1时不做任何事
+int source_pool_bind(source_pool *pool, int index, int fd);
+
+// 记录一次connect结果，err为connect失败时的errno，成功为0
+void source_pool_record(source_pool *pool, int index, int err);
+
+// 输出端口占用情况（读取/proc/net/tcp与tcp6），每行一条，返回写入长度
+// 对每个源地址统计本机临时端口范围内的连接及TIME_WAIT数，
+// 以及连向同一目标的最大连接数占临时端口范围的比例（该比例到100%时connect返回EADDRNOTAVAIL）
+size_t source_pool_format_stats(source_pool *pool, char *out, size_t len);
+
+#endif // SOURCE_POOL_H
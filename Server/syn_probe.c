@@ -0,0 +1,593 @@
+#define _GNU_SOURCE  // struct in6_pktinfo
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/random.h>
+#include <linux/filter.h>
+
+#include "syn_probe.h"
+
+#define SYN_PACKET_SIZE 24       // TCP头20字节 + MSS选项4字节
+#define SYN_RECV_BUFFER 2048
+#define SYN_RETRANSMIT_MS 1000   // 未收到应答时每秒重发一次SYN
+
+#define SYN_RECEIVER_POLL_MS 200  // 接收线程检查退出标志的间隔
+
+// 应答回调：target为应答来源，result为SYN_PROBE_OPEN或SYN_PROBE_CLOSED
+typedef void (*syn_reply_cb)(const struct sockaddr_storage *target, int result, void *arg);
+
+// 正在等待应答的探测（仅存在于用户态，线上报文本身无状态）
+typedef struct syn_waiter {
+    struct sockaddr_storage target;
+    int result;
+    struct syn_waiter *next;
+} syn_waiter;
+
+struct syn_engine {
+    int raw4;                    // IPv4原始套接字，不可用时为-1
+    int raw6;                    // IPv6原始套接字，不可用时为-1
+    int route4;                  // 用于选路确定源地址的UDP套接字
+    int route6;
+    pthread_mutex_t route_lock;  // 选路套接字会被重复connect，需要串行化
+    uint64_t key[2];             // cookie密钥
+    uint16_t sport;
+    pthread_t receiver;          // 应答接收线程
+    int running;
+    pthread_mutex_t wait_lock;   // 保护waiters
+    pthread_cond_t wait_cond;    // 有应答到达时广播
+    syn_waiter *waiters;
+};
+
+// SipHash-2-4，用于从连接四元组计算序列号cookie
+#define ROTL64(x, b) (uint64_t)(((x) << (b)) | ((x) >> (64 - (b))))
+#define SIPROUND do { \
+        v0 += v1; v1 = ROTL64(v1, 13); v1 ^= v0; v0 = ROTL64(v0, 32); \
+        v2 += v3; v3 = ROTL64(v3, 16); v3 ^= v2; \
+        v0 += v3; v3 = ROTL64(v3, 21); v3 ^= v0; \
+        v2 += v1; v1 = ROTL64(v1, 17); v1 ^= v2; v2 = ROTL64(v2, 32); \
+    } while (0)
+
+static uint64_t siphash24(const uint64_t key[2], const unsigned char *in, size_t len) {
+    uint64_t v0 = 0x736f6d6570736575ULL ^ key[0];
+    uint64_t v1 = 0x646f72616e646f6dULL ^ key[1];
+    uint64_t v2 = 0x6c7967656e657261ULL ^ key[0];
+    uint64_t v3 = 0x7465646279746573ULL ^ key[1];
+    uint64_t b = ((uint64_t)len) << 56;
+    size_t blocks = len & ~(size_t)7;
+    size_t i;
+
+    for (i = 0; i < blocks; i += 8) {
+        uint64_t m = 0;
+        size_t j;
+        for (j = 0; j < 8; j++) {
+            m |= (uint64_t)in[i + j] << (8 * j);
+        }
+        v3 ^= m;
+        SIPROUND;
+        SIPROUND;
+        v0 ^= m;
+    }
+    for (i = 0; i < (len & 7); i++) {
+        b |= (uint64_t)in[blocks + i] << (8 * i);
+    }
+
+    v3 ^= b;
+    SIPROUND;
+    SIPROUND;
+    v0 ^= b;
+    v2 ^= 0xff;
+    SIPROUND;
+    SIPROUND;
+    SIPROUND;
+    SIPROUND;
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+
+// 地址的原始字节及长度
+static const unsigned char *addr_bytes(const struct sockaddr_storage *ss, size_t *len) {
+    if (ss->ss_family == AF_INET) {
+        *len = 4;
+        return (const unsigned char *)&((const struct sockaddr_in *)ss)->sin_addr;
+    }
+    *len = 16;
+    return (const unsigned char *)&((const struct sockaddr_in6 *)ss)->sin6_addr;
+}
+
+static uint16_t addr_port(const struct sockaddr_storage *ss) {
+    if (ss->ss_family == AF_INET) {
+        return ntohs(((const struct sockaddr_in *)ss)->sin_port);
+    }
+    return ntohs(((const struct sockaddr_in6 *)ss)->sin6_port);
+}
+
+static uint32_t syn_cookie(const syn_engine *engine, int family,
+                           const unsigned char *local, const unsigned char *remote,
+                           uint16_t sport, uint16_t dport) {
+    unsigned char buf[37];
+    size_t alen = family == AF_INET ? 4 : 16;
+
+    buf[0] = (unsigned char)family;
+    buf[1] = (unsigned char)(sport >> 8);
+    buf[2] = (unsigned char)sport;
+    buf[3] = (unsigned char)(dport >> 8);
+    buf[4] = (unsigned char)dport;
+    memcpy(buf + 5, local, alen);
+    memcpy(buf + 5 + alen, remote, alen);
+    return (uint32_t)siphash24(engine->key, buf, 5 + 2 * alen);
+}
+
+static uint32_t checksum_add(uint32_t sum, const unsigned char *data, size_t len) {
+    while (len > 1) {
+        sum += ((uint32_t)data[0] << 8) | data[1];
+        data += 2;
+        len -= 2;
+    }
+    if (len) {
+        sum += (uint32_t)data[0] << 8;
+    }
+    return sum;
+}
+
+static uint16_t checksum_fold(uint32_t sum) {
+    while (sum >> 16) {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+    return (uint16_t)~sum;
+}
+
+// 通过connect一个UDP套接字让内核选路，得到发往目标时使用的源地址（不发送任何报文）
+static int select_source(syn_engine *engine, const struct sockaddr_storage *target,
+                         struct sockaddr_storage *source) {
+    int fd = target->ss_family == AF_INET ? engine->route4 : engine->route6;
+    socklen_t len = target->ss_family == AF_INET ? sizeof(struct sockaddr_in)
+                                                 : sizeof(struct sockaddr_in6);
+    int ret = -1;
+
+    if (fd < 0) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&engine->route_lock);
+    if (connect(fd, (const struct sockaddr *)target, len) == 0) {
+        socklen_t slen = sizeof(*source);
+        if (getsockname(fd, (struct sockaddr *)source, &slen) == 0) {
+            ret = 0;
+        }
+    }
+    pthread_mutex_unlock(&engine->route_lock);
+    return ret;
+}
+
+static void attach_filter(int fd, struct sock_filter *code, unsigned short len) {
+    struct sock_fprog prog = { len, code };
+
+    if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog)) < 0) {
+        perror("SYN engine: attach filter failed");
+    }
+}
+
+// 只接收目的端口为引擎源端口的IPv4 TCP报文，避免把整机流量拷贝到用户态
+static void attach_ipv4_filter(int fd, uint16_t sport) {
+    struct sock_filter code[] = {
+        BPF_STMT(BPF_LDX | BPF_B | BPF_MSH, 0),
+        BPF_STMT(BPF_LD | BPF_H | BPF_IND, 2),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, sport, 0, 1),
+        BPF_STMT(BPF_RET | BPF_K, 0xffff),
+        BPF_STMT(BPF_RET | BPF_K, 0),
+    };
+    attach_filter(fd, code, sizeof(code) / sizeof(code[0]));
+}
+
+// IPv6原始套接字收到的数据从TCP头开始，目的端口直接在偏移2处
+static void attach_ipv6_filter(int fd, uint16_t sport) {
+    struct sock_filter code[] = {
+        BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 2),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, sport, 0, 1),
+        BPF_STMT(BPF_RET | BPF_K, 0xffff),
+        BPF_STMT(BPF_RET | BPF_K, 0),
+    };
+    attach_filter(fd, code, sizeof(code) / sizeof(code[0]));
+}
+
+int syn_engine_send(syn_engine *engine, const struct sockaddr_storage *target) {
+    struct sockaddr_storage source, dest;
+    unsigned char packet[SYN_PACKET_SIZE];
+    unsigned char pseudo[40];
+    const unsigned char *local, *remote;
+    size_t alen, plen;
+    uint16_t dport = addr_port(target);
+    int fd = target->ss_family == AF_INET ? engine->raw4 : engine->raw6;
+
+    if (fd < 0 || select_source(engine, target, &source) < 0) {
+        return -1;
+    }
+
+    local = addr_bytes(&source, &alen);
+    remote = addr_bytes(target, &alen);
+    uint32_t seq = syn_cookie(engine, target->ss_family, local, remote, engine->sport, dport);
+
+    memset(packet, 0, sizeof(packet));
+    packet[0] = (unsigned char)(engine->sport >> 8);
+    packet[1] = (unsigned char)engine->sport;
+    packet[2] = (unsigned char)(dport >> 8);
+    packet[3] = (unsigned char)dport;
+    packet[4] = (unsigned char)(seq >> 24);
+    packet[5] = (unsigned char)(seq >> 16);
+    packet[6] = (unsigned char)(seq >> 8);
+    packet[7] = (unsigned char)seq;
+    packet[12] = (SYN_PACKET_SIZE / 4) << 4;   // 数据偏移
+    packet[13] = 0x02;                         // SYN
+    packet[14] = 0xff;                         // 窗口 65535
+    packet[15] = 0xff;
+    packet[20] = 2;                            // MSS选项
+    packet[21] = 4;
+    packet[22] = 0x05;                         // 1460
+    packet[23] = 0xb4;
+
+    // 伪首部校验和
+    memcpy(pseudo, local, alen);
+    memcpy(pseudo + alen, remote, alen);
+    plen = 2 * alen;
+    if (target->ss_family == AF_INET) {
+        pseudo[plen++] = 0;
+        pseudo[plen++] = IPPROTO_TCP;
+        pseudo[plen++] = 0;
+        pseudo[plen++] = SYN_PACKET_SIZE;
+    } else {
+        pseudo[plen++] = 0;
+        pseudo[plen++] = 0;
+        pseudo[plen++] = 0;
+        pseudo[plen++] = SYN_PACKET_SIZE;
+        pseudo[plen++] = 0;
+        pseudo[plen++] = 0;
+        pseudo[plen++] = 0;
+        pseudo[plen++] = IPPROTO_TCP;
+    }
+    uint16_t sum = checksum_fold(checksum_add(checksum_add(0, pseudo, plen), packet, sizeof(packet)));
+    packet[16] = (unsigned char)(sum >> 8);
+    packet[17] = (unsigned char)sum;
+
+    // 原始套接字的目的端口必须为0
+    memcpy(&dest, target, sizeof(dest));
+    socklen_t dlen;
+    if (dest.ss_family == AF_INET) {
+        ((struct sockaddr_in *)&dest)->sin_port = 0;
+        dlen = sizeof(struct sockaddr_in);
+    } else {
+        ((struct sockaddr_in6 *)&dest)->sin6_port = 0;
+        dlen = sizeof(struct sockaddr_in6);
+    }
+
+    if (sendto(fd, packet, sizeof(packet), 0, (struct sockaddr *)&dest, dlen) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+// 校验TCP应答，返回SYN_PROBE_OPEN/SYN_PROBE_CLOSED，不属于本引擎的报文返回SYN_PROBE_ERROR
+static int check_reply(const syn_engine *engine, int family,
+                       const unsigned char *remote, const unsigned char *local,
+                       const unsigned char *tcp, size_t len, uint16_t *remote_port) {
+    if (len < 20) {
+        return SYN_PROBE_ERROR;
+    }
+
+    uint16_t sport = ((uint16_t)tcp[0] << 8) | tcp[1];
+    uint16_t dport = ((uint16_t)tcp[2] << 8) | tcp[3];
+    uint32_t ack = ((uint32_t)tcp[8] << 24) | ((uint32_t)tcp[9] << 16) |
+                   ((uint32_t)tcp[10] << 8) | tcp[11];
+    unsigned char flags = tcp[13];
+
+    if (dport != engine->sport || !(flags & 0x10)) {
+        return SYN_PROBE_ERROR;
+    }
+    if (ack - 1 != syn_cookie(engine, family, local, remote, engine->sport, sport)) {
+        return SYN_PROBE_ERROR;
+    }
+
+    *remote_port = sport;
+    if ((flags & 0x12) == 0x12) {
+        return SYN_PROBE_OPEN;
+    }
+    if (flags & 0x04) {
+        return SYN_PROBE_CLOSED;
+    }
+    return SYN_PROBE_ERROR;
+}
+
+static int drain_ipv4(syn_engine *engine, syn_reply_cb cb, void *arg) {
+    unsigned char buf[SYN_RECV_BUFFER];
+    int handled = 0;
+
+    for (;;) {
+        ssize_t n = recv(engine->raw4, buf, sizeof(buf), 0);
+        if (n < 0) {
+            return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? handled : -1;
+        }
+
+        size_t ihl = (size_t)(buf[0] & 0x0f) * 4;
+        if ((size_t)n < ihl + 20 || buf[9] != IPPROTO_TCP) {
+            continue;
+        }
+
+        uint16_t rport;
+        int result = check_reply(engine, AF_INET, buf + 12, buf + 16, buf + ihl, (size_t)n - ihl, &rport);
+        if (result == SYN_PROBE_ERROR) {
+            continue;
+        }
+
+        struct sockaddr_storage target;
+        struct sockaddr_in *sin = (struct sockaddr_in *)&target;
+        memset(&target, 0, sizeof(target));
+        sin->sin_family = AF_INET;
+        sin->sin_port = htons(rport);
+        memcpy(&sin->sin_addr, buf + 12, 4);
+        cb(&target, result, arg);
+        handled++;
+    }
+}
+
+static int drain_ipv6(syn_engine *engine, syn_reply_cb cb, void *arg) {
+    unsigned char buf[SYN_RECV_BUFFER];
+    unsigned char control[CMSG_SPACE(sizeof(struct in6_pktinfo))];
+    int handled = 0;
+
+    for (;;) {
+        struct sockaddr_in6 from;
+        struct iovec iov = { buf, sizeof(buf) };
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_name = &from;
+        msg.msg_namelen = sizeof(from);
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        ssize_t n = recvmsg(engine->raw6, &msg, 0);
+        if (n < 0) {
+            return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? handled : -1;
+        }
+
+        // IPv6原始套接字不包含IP头，目的地址从IPV6_PKTINFO获取
+        const unsigned char *local = NULL;
+        struct cmsghdr *cmsg;
+        for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (cmsg->cmsg_level == IPPROTO_IPV6 && cmsg->cmsg_type == IPV6_PKTINFO) {
+                local = (const unsigned char *)&((struct in6_pktinfo *)CMSG_DATA(cmsg))->ipi6_addr;
+            }
+        }
+        if (!local) {
+            continue;
+        }
+
+        uint16_t rport;
+        int result = check_reply(engine, AF_INET6, (const unsigned char *)&from.sin6_addr,
+                                 local, buf, (size_t)n, &rport);
+        if (result == SYN_PROBE_ERROR) {
+            continue;
+        }
+
+        struct sockaddr_storage target;
+        memset(&target, 0, sizeof(target));
+        memcpy(&target, &from, sizeof(from));
+        ((struct sockaddr_in6 *)&target)->sin6_port = htons(rport);
+        cb(&target, result, arg);
+        handled++;
+    }
+}
+
+// 读取并校验应答，每个通过cookie校验的应答调用一次cb，返回处理的应答数
+static int syn_engine_poll(syn_engine *engine, int timeout_ms, syn_reply_cb cb, void *arg) {
+    struct pollfd fds[2];
+    int nfds = 0, handled = 0;
+
+    if (engine->raw4 >= 0) {
+        fds[nfds].fd = engine->raw4;
+        fds[nfds].events = POLLIN;
+        nfds++;
+    }
+    if (engine->raw6 >= 0) {
+        fds[nfds].fd = engine->raw6;
+        fds[nfds].events = POLLIN;
+        nfds++;
+    }
+
+    int ready = poll(fds, nfds, timeout_ms);
+    if (ready < 0) {
+        return errno == EINTR ? 0 : -1;
+    }
+
+    for (int i = 0; i < nfds && ready > 0; i++) {
+        if (!(fds[i].revents & POLLIN)) {
+            continue;
+        }
+        int n = fds[i].fd == engine->raw4 ? drain_ipv4(engine, cb, arg)
+                                          : drain_ipv6(engine, cb, arg);
+        if (n > 0) {
+            handled += n;
+        }
+    }
+    return handled;
+}
+
+static int same_endpoint(const struct sockaddr_storage *a, const struct sockaddr_storage *b) {
+    size_t alen, blen;
+    const unsigned char *ab = addr_bytes(a, &alen);
+    const unsigned char *bb = addr_bytes(b, &blen);
+
+    return a->ss_family == b->ss_family && alen == blen &&
+           memcmp(ab, bb, alen) == 0 && addr_port(a) == addr_port(b);
+}
+
+// 把通过校验的应答交给等待该目标的探测
+static void dispatch_reply(const struct sockaddr_storage *target, int result, void *arg) {
+    syn_engine *engine = arg;
+    syn_waiter *w;
+
+    pthread_mutex_lock(&engine->wait_lock);
+    for (w = engine->waiters; w; w = w->next) {
+        if (w->result == SYN_PROBE_TIMEOUT && same_endpoint(target, &w->target)) {
+            w->result = result;
+        }
+    }
+    pthread_cond_broadcast(&engine->wait_cond);
+    pthread_mutex_unlock(&engine->wait_lock);
+}
+
+static void *receiver_main(void *arg) {
+    syn_engine *engine = arg;
+
+    while (__atomic_load_n(&engine->running, __ATOMIC_ACQUIRE)) {
+        if (syn_engine_poll(engine, SYN_RECEIVER_POLL_MS, dispatch_reply, engine) < 0) {
+            perror("SYN engine: receive failed");
+            usleep(SYN_RECEIVER_POLL_MS * 1000);
+        }
+    }
+    return NULL;
+}
+
+static void deadline_after(struct timespec *ts, long long ms) {
+    clock_gettime(CLOCK_MONOTONIC, ts);
+    ts->tv_sec += ms / 1000;
+    ts->tv_nsec += (ms % 1000) * 1000000;
+    if (ts->tv_nsec >= 1000000000) {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000;
+    }
+}
+
+static int timespec_before(const struct timespec *a, const struct timespec *b) {
+    return a->tv_sec < b->tv_sec || (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+syn_engine *syn_engine_create(void) {
+    syn_engine *engine = calloc(1, sizeof(*engine));
+    if (!engine) {
+        return NULL;
+    }
+
+    engine->sport = SYN_SOURCE_PORT;
+    engine->raw4 = socket(AF_INET, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_TCP);
+    engine->raw6 = socket(AF_INET6, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_TCP);
+
+    if (engine->raw4 < 0 && engine->raw6 < 0) {
+        perror("SYN engine: raw socket unavailable (CAP_NET_RAW required)");
+        free(engine);
+        return NULL;
+    }
+
+    if (engine->raw4 >= 0) {
+        attach_ipv4_filter(engine->raw4, engine->sport);
+    }
+    if (engine->raw6 >= 0) {
+        int on = 1;
+        attach_ipv6_filter(engine->raw6, engine->sport);
+        setsockopt(engine->raw6, IPPROTO_IPV6, IPV6_RECVPKTINFO, &on, sizeof(on));
+    }
+
+    engine->route4 = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    engine->route6 = socket(AF_INET6, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    pthread_mutex_init(&engine->route_lock, NULL);
+    pthread_mutex_init(&engine->wait_lock, NULL);
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&engine->wait_cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    if (getrandom(engine->key, sizeof(engine->key), 0) != sizeof(engine->key)) {
+        perror("SYN engine: getrandom failed");
+        syn_engine_destroy(engine);
+        return NULL;
+    }
+
+    engine->running = 1;
+    if (pthread_create(&engine->receiver, NULL, receiver_main, engine) != 0) {
+        perror("SYN engine: receiver thread failed");
+        engine->running = 0;
+        syn_engine_destroy(engine);
+        return NULL;
+    }
+
+    return engine;
+}
+
+void syn_engine_destroy(syn_engine *engine) {
+    if (!engine) {
+        return;
+    }
+    if (__atomic_exchange_n(&engine->running, 0, __ATOMIC_SEQ_CST)) {
+        pthread_join(engine->receiver, NULL);
+    }
+    if (engine->raw4 >= 0) close(engine->raw4);
+    if (engine->raw6 >= 0) close(engine->raw6);
+    if (engine->route4 >= 0) close(engine->route4);
+    if (engine->route6 >= 0) close(engine->route6);
+    pthread_mutex_destroy(&engine->route_lock);
+    pthread_mutex_destroy(&engine->wait_lock);
+    pthread_cond_destroy(&engine->wait_cond);
+    free(engine);
+}
+
+int syn_engine_probe(syn_engine *engine, const struct sockaddr_storage *target, int timeout_ms) {
+    syn_waiter waiter;
+    syn_waiter **pp;
+    struct timespec deadline, next_send, now;
+    int result;
+
+    memset(&waiter, 0, sizeof(waiter));
+    memcpy(&waiter.target, target, sizeof(waiter.target));
+    waiter.result = SYN_PROBE_TIMEOUT;
+    deadline_after(&deadline, timeout_ms);
+
+    pthread_mutex_lock(&engine->wait_lock);
+    waiter.next = engine->waiters;
+    engine->waiters = &waiter;
+
+    for (;;) {
+        if (waiter.result != SYN_PROBE_TIMEOUT) {
+            break;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (!timespec_before(&now, &deadline)) {
+            break;
+        }
+
+        // 发送（或重发）SYN，发送期间释放锁以免阻塞接收线程
+        pthread_mutex_unlock(&engine->wait_lock);
+        int sent = syn_engine_send(engine, target);
+        pthread_mutex_lock(&engine->wait_lock);
+        if (sent < 0) {
+            waiter.result = SYN_PROBE_ERROR;
+            break;
+        }
+
+        deadline_after(&next_send, SYN_RETRANSMIT_MS);
+        const struct timespec *wake = timespec_before(&next_send, &deadline) ? &next_send : &deadline;
+        while (waiter.result == SYN_PROBE_TIMEOUT &&
+               pthread_cond_timedwait(&engine->wait_cond, &engine->wait_lock, wake) == 0) {
+        }
+    }
+
+    for (pp = &engine->waiters; *pp; pp = &(*pp)->next) {
+        if (*pp == &waiter) {
+            *pp = waiter.next;
+            break;
+        }
+    }
+    result = waiter.result;
+    pthread_mutex_unlock(&engine->wait_lock);
+    return result;
+}
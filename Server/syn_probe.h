@@ -0,0 +1,32 @@
+#ifndef SYN_PROBE_H
+#define SYN_PROBE_H
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+// 无状态SYN探测引擎（需要CAP_NET_RAW）
+// 通过原始套接字发送SYN，序列号中编码cookie，收到SYN-ACK即判定端口可达
+// 每次探测不占用内核套接字、不消耗临时端口、不产生TIME_WAIT
+
+#define SYN_PROBE_OPEN 1      // 收到SYN-ACK，端口可达
+#define SYN_PROBE_CLOSED 0    // 收到RST，主机可达但端口关闭
+#define SYN_PROBE_TIMEOUT -1  // 超时无应答
+#define SYN_PROBE_ERROR -2    // 发送失败
+
+#define SYN_SOURCE_PORT 61000 // 默认源端口，位于Linux默认临时端口范围之外
+
+typedef struct syn_engine syn_engine;
+
+// 创建引擎并启动应答接收线程，没有权限或平台不支持时返回NULL
+syn_engine *syn_engine_create(void);
+
+// 销毁引擎
+void syn_engine_destroy(syn_engine *engine);
+
+// 向目标发送一个SYN，成功返回0
+int syn_engine_send(syn_engine *engine, const struct sockaddr_storage *target);
+
+// 同步探测单个目标，返回SYN_PROBE_*结果，可被多个线程并发调用
+int syn_engine_probe(syn_engine *engine, const struct sockaddr_storage *target, int timeout_ms);
+
+#endif // SYN_PROBE_H
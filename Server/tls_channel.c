@@ -0,0 +1,249 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "tls_channel.h"
+
+#ifdef DDNS_WITH_TLS
+
+#include <stdlib.h>
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+
+struct tls_channel {
+    SSL *ssl;
+    int early_done;     // 早期数据阶段已结束
+    int established;
+};
+
+static SSL_CTX *g_ctx = NULL;
+
+// 握手统计，由事件循环更新，STATS读取
+static unsigned long g_handshakes, g_resumed, g_early_accepted, g_ktls_tx, g_ktls_rx, g_failed;
+
+int tls_channel_setup(const char *cert_file, const char *key_file) {
+    SSL_CTX *ctx = SSL_CTX_new(TLS_server_method());
+    if (!ctx) {
+        return -1;
+    }
+
+    SSL_CTX_set_min_proto_version(ctx, TLS1_3_VERSION);
+    // 握手完成后由OpenSSL安装TCP_ULP "tls"并把会话密钥交给内核；客户端不发close_notify就断开不算错误
+    SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS | SSL_OP_IGNORE_UNEXPECTED_EOF);
+    // 票据恢复依赖服务端会话缓存实现防重放，同一票据的早期数据只接受一次
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+    SSL_CTX_set_session_id_context(ctx, (const unsigned char *)"ddns", 4);
+    SSL_CTX_set_max_early_data(ctx, TLS_CHANNEL_EARLY_DATA);
+
+    if (SSL_CTX_use_certificate_chain_file(ctx, cert_file) != 1 ||
+        SSL_CTX_use_PrivateKey_file(ctx, key_file ? key_file : cert_file, SSL_FILETYPE_PEM) != 1 ||
+        SSL_CTX_check_private_key(ctx) != 1) {
+        ERR_print_errors_fp(stderr);
+        SSL_CTX_free(ctx);
+        return -1;
+    }
+
+    g_ctx = ctx;
+    return 0;
+}
+
+tls_channel *tls_channel_new(int fd) {
+    if (!g_ctx) {
+        return NULL;
+    }
+
+    tls_channel *t = calloc(1, sizeof(*t));
+    if (!t) {
+        return NULL;
+    }
+    t->ssl = SSL_new(g_ctx);
+    if (!t->ssl || SSL_set_fd(t->ssl, fd) != 1) {
+        SSL_free(t->ssl);
+        free(t);
+        return NULL;
+    }
+    SSL_set_accept_state(t->ssl);
+    return t;
+}
+
+void tls_channel_free(tls_channel *t) {
+    if (t) {
+        // 未发出close_notify就释放的连接会被视为异常中断，OpenSSL会把其会话逐出缓存，
+        // 连接上签发的票据随之失效；客户端先断开的会话连接属于正常结束
+        if (t->established) {
+            SSL_set_shutdown(t->ssl, SSL_SENT_SHUTDOWN | SSL_RECEIVED_SHUTDOWN);
+        }
+        SSL_free(t->ssl);
+        free(t);
+    }
+}
+
+static int want_io(SSL *ssl, int ret) {
+    int err = SSL_get_error(ssl, ret);
+    return err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE;
+}
+
+static void record_established(tls_channel *t) {
+    t->established = 1;
+    g_handshakes++;
+    g_resumed += SSL_session_reused(t->ssl) != 0;
+    g_early_accepted += SSL_get_early_data_status(t->ssl) == SSL_EARLY_DATA_ACCEPTED;
+    g_ktls_tx += BIO_get_ktls_send(SSL_get_wbio(t->ssl)) > 0;
+    g_ktls_rx += BIO_get_ktls_recv(SSL_get_rbio(t->ssl)) > 0;
+}
+
+int tls_channel_handshake(tls_channel *t, char *buf, size_t cap, size_t *got) {
+    *got = 0;
+    ERR_clear_error();
+
+    // 早期数据随ClientHello到达，读出后交给调用方立即处理
+    while (!t->early_done && *got < cap) {
+        size_t n = 0;
+        int ret = SSL_read_early_data(t->ssl, buf + *got, cap - *got, &n);
+
+        *got += n;
+        if (ret == SSL_READ_EARLY_DATA_FINISH) {
+            t->early_done = 1;
+        } else if (ret == SSL_READ_EARLY_DATA_ERROR) {
+            if (!want_io(t->ssl, 0)) {
+                g_failed++;
+                return TLS_CHANNEL_ERROR;
+            }
+            return TLS_CHANNEL_WANT;
+        }
+    }
+    if (!t->early_done) {
+        return TLS_CHANNEL_WANT;
+    }
+
+    int ret = SSL_do_handshake(t->ssl);
+    if (ret == 1) {
+        record_established(t);
+        return TLS_CHANNEL_DONE;
+    }
+    if (want_io(t->ssl, ret)) {
+        return TLS_CHANNEL_WANT;
+    }
+    g_failed++;
+    return TLS_CHANNEL_ERROR;
+}
+
+int tls_channel_established(const tls_channel *t) {
+    return t->established;
+}
+
+ssize_t tls_channel_recv(tls_channel *t, void *buf, size_t len) {
+    size_t n = 0;
+
+    ERR_clear_error();
+    int ret = SSL_read_ex(t->ssl, buf, len, &n);
+    if (ret == 1) {
+        return (ssize_t)n;
+    }
+
+    int err = SSL_get_error(t->ssl, ret);
+    if (err == SSL_ERROR_ZERO_RETURN) {
+        return 0;
+    }
+    errno = (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) ? EAGAIN : EIO;
+    return -1;
+}
+
+ssize_t tls_channel_send(tls_channel *t, const void *buf, size_t len) {
+    size_t n = 0;
+    int ret;
+
+    ERR_clear_error();
+    // 客户端Finished尚未到达时以0.5-RTT数据回复早期数据中的请求
+    if (t->established) {
+        ret = SSL_write_ex(t->ssl, buf, len, &n);
+    } else {
+        ret = SSL_write_early_data(t->ssl, buf, len, &n);
+    }
+    if (ret == 1) {
+        return (ssize_t)n;
+    }
+    errno = want_io(t->ssl, ret) ? EAGAIN : EIO;
+    return -1;
+}
+
+void tls_channel_shutdown(tls_channel *t) {
+    ERR_clear_error();
+    SSL_shutdown(t->ssl);
+}
+
+void tls_channel_describe(const tls_channel *t, char *out, size_t len) {
+    snprintf(out, len, "%s%s%s%s%s",
+             SSL_get_version(t->ssl),
+             SSL_session_reused(t->ssl) ? " resumed" : " full-handshake",
+             SSL_get_early_data_status(t->ssl) == SSL_EARLY_DATA_ACCEPTED ? " 0-RTT" : "",
+             BIO_get_ktls_send(SSL_get_wbio(t->ssl)) > 0 ? " ktls-tx" : "",
+             BIO_get_ktls_recv(SSL_get_rbio(t->ssl)) > 0 ? " ktls-rx" : "");
+}
+
+size_t tls_channel_format_stats(char *out, size_t len) {
+    if (!g_ctx) {
+        return 0;
+    }
+    int written = snprintf(out, len, "TLS handshakes=%lu resumed=%lu early_data=%lu ktls_tx=%lu ktls_rx=%lu failed=%lu\n",
+                           g_handshakes, g_resumed, g_early_accepted, g_ktls_tx, g_ktls_rx, g_failed);
+    return written < 0 ? 0 : ((size_t)written < len ? (size_t)written : len - 1);
+}
+
+#else
+
+// 未编译TLS支持：只接受明文控制连接
+
+int tls_channel_setup(const char *cert_file, const char *key_file) {
+    (void)cert_file; (void)key_file;
+    fprintf(stderr, "Server was built without TLS support (compile with -DDDNS_WITH_TLS -lssl -lcrypto)\n");
+    return -1;
+}
+
+tls_channel *tls_channel_new(int fd) {
+    (void)fd;
+    return NULL;
+}
+
+void tls_channel_free(tls_channel *t) {
+    (void)t;
+}
+
+int tls_channel_handshake(tls_channel *t, char *buf, size_t cap, size_t *got) {
+    (void)t; (void)buf; (void)cap;
+    *got = 0;
+    return TLS_CHANNEL_ERROR;
+}
+
+int tls_channel_established(const tls_channel *t) {
+    (void)t;
+    return 0;
+}
+
+ssize_t tls_channel_recv(tls_channel *t, void *buf, size_t len) {
+    (void)t; (void)buf; (void)len;
+    errno = EIO;
+    return -1;
+}
+
+ssize_t tls_channel_send(tls_channel *t, const void *buf, size_t len) {
+    (void)t; (void)buf; (void)len;
+    errno = EIO;
+    return -1;
+}
+
+void tls_channel_shutdown(tls_channel *t) {
+    (void)t;
+}
+
+void tls_channel_describe(const tls_channel *t, char *out, size_t len) {
+    (void)t;
+    snprintf(out, len, "-");
+}
+
+size_t tls_channel_format_stats(char *out, size_t len) {
+    (void)out; (void)len;
+    return 0;
+}
+
+#endif
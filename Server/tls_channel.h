@@ -0,0 +1,51 @@
+#ifndef TLS_CHANNEL_H
+#define TLS_CHANNEL_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+// 控制连接的TLS 1.3通道（以 -DDDNS_WITH_TLS 编译并链接 -lssl -lcrypto）
+//
+// 重复连接的客户端凭会话票据恢复会话，跳过证书签名和密钥交换；
+// 首条请求可作为0-RTT早期数据随ClientHello到达，服务端立即处理，
+// 响应在握手完成前以0.5-RTT数据发出。票据单次有效（会话缓存防重放）
+// 握手完成后记录加解密交给内核TLS（TCP_ULP "tls"），内核不支持时由OpenSSL在用户态处理
+
+#define TLS_RECORD_HANDSHAKE 0x16   // 连接首字节，用于区分TLS与明文请求
+#define TLS_CHANNEL_EARLY_DATA 4096 // 接受的0-RTT早期数据上限
+
+// tls_channel_handshake的返回值
+#define TLS_CHANNEL_ERROR -1
+#define TLS_CHANNEL_WANT 0          // 等待更多数据
+#define TLS_CHANNEL_DONE 1          // 握手完成
+
+typedef struct tls_channel tls_channel;
+
+// 加载证书和私钥（key_file为NULL时从cert_file读取），失败或未编译TLS支持时返回-1
+int tls_channel_setup(const char *cert_file, const char *key_file);
+
+// 为已accept的非阻塞连接创建TLS通道，未调用setup时返回NULL
+tls_channel *tls_channel_new(int fd);
+
+void tls_channel_free(tls_channel *t);
+
+// 推进握手，期间收到的早期数据写入buf，*got为写入的字节数（可在握手完成前处理）
+int tls_channel_handshake(tls_channel *t, char *buf, size_t cap, size_t *got);
+
+int tls_channel_established(const tls_channel *t);
+
+// 与recv/send语义一致，无数据可读时返回-1且errno为EAGAIN
+// 同一通道的调用需由调用方串行化
+ssize_t tls_channel_recv(tls_channel *t, void *buf, size_t len);
+ssize_t tls_channel_send(tls_channel *t, const void *buf, size_t len);
+
+// 发送close_notify
+void tls_channel_shutdown(tls_channel *t);
+
+// 描述握手结果（版本、是否恢复会话、早期数据、内核TLS）
+void tls_channel_describe(const tls_channel *t, char *out, size_t len);
+
+// 输出握手统计行，返回写入长度；未启用TLS时不输出
+size_t tls_channel_format_stats(char *out, size_t len);
+
+#endif // TLS_CHANNEL_H
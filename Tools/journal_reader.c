@@ -0,0 +1,233 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+#include "journal.h"
+
+// 探测日志读取工具：离线读取服务端 -j 写入的二进制日志，按条件过滤后逐条输出或汇总
+//
+// 用法: journal_reader [-a] [-r 结果] [-t 目标IP] [-s 来源IP] [-S 起始时间戳] [-L 最近秒数] <日志文件>
+//   -a  汇总模式：按结果计数，并输出排队/连接/发送/总耗时的分位数
+//   -r  只保留指定结果: success verified connect_failed send_failed expired error
+// 逐条输出格式（按完成时间排序）:
+//   2026-01-02T03:04:05.123456Z source target port result flags queue_us connect_us send_us total_us
+
+typedef struct {
+    int result;
+    int has_target, has_source;
+    uint8_t target[16], source[16];
+    uint64_t since_us;
+} filter;
+
+typedef struct {
+    filter f;
+    journal_record *records;
+    size_t count, cap;
+} collector;
+
+static const char *result_names[] = {
+    "unknown", "success", "verified", "connect_failed", "send_failed", "expired", "error"
+};
+#define RESULT_COUNT (sizeof(result_names) / sizeof(result_names[0]))
+
+static const char *result_name(uint8_t result) {
+    return result < RESULT_COUNT ? result_names[result] : "unknown";
+}
+
+static int parse_result(const char *name) {
+    for (size_t i = 1; i < RESULT_COUNT; i++) {
+        if (strcmp(name, result_names[i]) == 0) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+// 与服务端一致：IPv4映射为::ffff:a.b.c.d
+static int parse_address(const char *ip, uint8_t out[16]) {
+    struct in_addr v4;
+
+    memset(out, 0, 16);
+    if (inet_pton(AF_INET, ip, &v4) == 1) {
+        out[10] = 0xff;
+        out[11] = 0xff;
+        memcpy(out + 12, &v4, 4);
+        return 0;
+    }
+    return inet_pton(AF_INET6, ip, out) == 1 ? 0 : -1;
+}
+
+static void format_address(const uint8_t addr[16], char *out, size_t len) {
+    static const uint8_t v4_prefix[12] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff};
+
+    if (memcmp(addr, v4_prefix, sizeof(v4_prefix)) == 0) {
+        inet_ntop(AF_INET, addr + 12, out, len);
+    } else {
+        inet_ntop(AF_INET6, addr, out, len);
+    }
+}
+
+static void collect(const journal_record *rec, void *arg) {
+    collector *c = arg;
+
+    if ((c->f.result && rec->result != c->f.result) ||
+        (c->f.has_target && memcmp(rec->target, c->f.target, 16) != 0) ||
+        (c->f.has_source && memcmp(rec->source, c->f.source, 16) != 0) ||
+        rec->timestamp_us < c->f.since_us) {
+        return;
+    }
+
+    if (c->count == c->cap) {
+        size_t cap = c->cap ? c->cap * 2 : 4096;
+        journal_record *grown = realloc(c->records, cap * sizeof(*grown));
+        if (!grown) {
+            return;
+        }
+        c->records = grown;
+        c->cap = cap;
+    }
+    c->records[c->count++] = *rec;
+}
+
+static int compare_timestamp(const void *a, const void *b) {
+    uint64_t x = ((const journal_record *)a)->timestamp_us;
+    uint64_t y = ((const journal_record *)b)->timestamp_us;
+    return (x > y) - (x < y);
+}
+
+static int compare_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+static void print_record(const journal_record *rec) {
+    char source[INET6_ADDRSTRLEN], target[INET6_ADDRSTRLEN], when[32];
+    time_t sec = (time_t)(rec->timestamp_us / 1000000);
+    struct tm tm;
+
+    gmtime_r(&sec, &tm);
+    strftime(when, sizeof(when), "%Y-%m-%dT%H:%M:%S", &tm);
+    format_address(rec->source, source, sizeof(source));
+    format_address(rec->target, target, sizeof(target));
+
+    printf("%s.%06uZ %s %s %u %s %s%s %u %u %u %u\n",
+           when, (unsigned)(rec->timestamp_us % 1000000), source, target, rec->target_port,
+           result_name(rec->result),
+           rec->flags & JOURNAL_FLAG_SYN ? "S" : "-", rec->flags & JOURNAL_FLAG_SESSION ? "P" : "-",
+           rec->queue_us, rec->connect_us, rec->send_us, rec->total_us);
+}
+
+// 输出一列耗时的分位数，values会被排序
+static void print_percentiles(const char *name, uint32_t *values, size_t n) {
+    qsort(values, n, sizeof(uint32_t), compare_u32);
+    printf("%-10s p50=%-10u p90=%-10u p99=%-10u max=%u\n", name,
+           values[(n - 1) / 2], values[(n * 90 - 1) / 100], values[(n * 99 - 1) / 100], values[n - 1]);
+}
+
+static void print_summary(const journal_record *records, size_t n) {
+    size_t counts[RESULT_COUNT] = {0};
+
+    for (size_t i = 0; i < n; i++) {
+        counts[records[i].result < RESULT_COUNT ? records[i].result : 0]++;
+    }
+
+    printf("records    %zu\n", n);
+    for (size_t i = 0; i < RESULT_COUNT; i++) {
+        if (counts[i]) {
+            printf("%-14s %zu (%.1f%%)\n", result_names[i], counts[i], counts[i] * 100.0 / n);
+        }
+    }
+    if (n == 0) {
+        return;
+    }
+
+    // 耗时单位为微秒
+    uint32_t *values = malloc(n * sizeof(uint32_t));
+    if (!values) {
+        return;
+    }
+    printf("latency (us)\n");
+    for (size_t i = 0; i < n; i++) values[i] = records[i].queue_us;
+    print_percentiles("queue", values, n);
+    for (size_t i = 0; i < n; i++) values[i] = records[i].connect_us;
+    print_percentiles("connect", values, n);
+    for (size_t i = 0; i < n; i++) values[i] = records[i].send_us;
+    print_percentiles("send", values, n);
+    for (size_t i = 0; i < n; i++) values[i] = records[i].total_us;
+    print_percentiles("total", values, n);
+    free(values);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-a] [-r result] [-t target-ip] [-s source-ip] [-S unix-seconds] [-L seconds] <journal>\n", prog);
+    fprintf(stderr, "  results: success verified connect_failed send_failed expired error\n");
+}
+
+int main(int argc, char **argv) {
+    collector c;
+    int aggregate = 0;
+    int opt;
+
+    memset(&c, 0, sizeof(c));
+    while ((opt = getopt(argc, argv, "ar:t:s:S:L:h")) != -1) {
+        switch (opt) {
+            case 'a':
+                aggregate = 1;
+                break;
+            case 'r':
+                c.f.result = parse_result(optarg);
+                if (c.f.result < 0) {
+                    fprintf(stderr, "Unknown result: %s\n", optarg);
+                    return 2;
+                }
+                break;
+            case 't':
+            case 's':
+                if (parse_address(optarg, opt == 't' ? c.f.target : c.f.source) < 0) {
+                    fprintf(stderr, "Invalid address: %s\n", optarg);
+                    return 2;
+                }
+                *(opt == 't' ? &c.f.has_target : &c.f.has_source) = 1;
+                break;
+            case 'S':
+                c.f.since_us = strtoull(optarg, NULL, 10) * 1000000;
+                break;
+            case 'L':
+                c.f.since_us = ((uint64_t)time(NULL) - strtoull(optarg, NULL, 10)) * 1000000;
+                break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? 0 : 2;
+        }
+    }
+    if (optind != argc - 1) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    journal *j = journal_open_readonly(argv[optind]);
+    if (!j) {
+        return 1;
+    }
+    for (uint32_t region = 0; region < journal_region_count(j); region++) {
+        journal_scan(j, region, collect, &c);
+    }
+    journal_close(j);
+
+    // 各工作线程的区域独立写入，合并后按完成时间排序
+    qsort(c.records, c.count, sizeof(journal_record), compare_timestamp);
+    if (aggregate) {
+        print_summary(c.records, c.count);
+    } else {
+        for (size_t i = 0; i < c.count; i++) {
+            print_record(&c.records[i]);
+        }
+    }
+    free(c.records);
+    return 0;
+}
+
+// gcc -o journal_reader journal_reader.c ../Server/journal.c -I../Server
@@ -0,0 +1,205 @@
+#!/bin/bash
+#
+# 网络命名空间端到端测试：在单台Linux主机上模拟公网、NAT、防火墙和纯IPv6客户端，
+# 运行真实的服务端和检测库，报告每种拓扑的检测耗时与结果是否正确
+#
+# 需要root、iproute2；NAT和防火墙拓扑需要nftables（nft），缺失时跳过
+#
+# 用法: sudo bash Tools/netns_e2e.sh
+# 环境变量:
+#   RUNS=5           每种拓扑的探测次数
+#   TIMEOUT=3        客户端超时（秒）
+#   SERVER_ARGS=     传给服务端的额外参数，如 "-s" 测试SYN探测
+#
+# 拓扑（服务端命名空间内的网桥充当"公网"，198.51.100.0/24 与 2001:db8:100::/64）:
+#   public    客户端地址直接位于公网网段              期望: 可达
+#   nat       客户端在路由器后，路由器做nft masquerade   期望: 不可达
+#   firewall  公网地址，但nft丢弃所有入站新连接        期望: 不可达
+#   ipv6only  只有IPv6地址                          期望: 可达
+
+set -u
+
+RUNS=${RUNS:-5}
+TIMEOUT=${TIMEOUT:-3}
+SERVER_ARGS=${SERVER_ARGS:-}
+PORT=8066
+PREFIX=e2e
+ROOT_DIR=$(cd "$(dirname "$0")/.." && pwd)
+WORK=$(mktemp -d /tmp/ddns-e2e.XXXXXX)
+
+SRV_NS=$PREFIX-srv
+SRV_V4=198.51.100.1
+SRV_V6=2001:db8:100::1
+
+HAVE_NFT=0
+command -v nft > /dev/null && HAVE_NFT=1
+
+SERVER_PID=
+
+cleanup() {
+    [ -n "$SERVER_PID" ] && kill "$SERVER_PID" 2> /dev/null && wait "$SERVER_PID" 2> /dev/null
+    for ns in $(ip netns list | awk '{print $1}' | grep "^$PREFIX-"); do
+        ip netns del "$ns"
+    done
+    rm -rf "$WORK"
+}
+trap cleanup EXIT
+
+fail() {
+    echo "错误: $*" >&2
+    exit 1
+}
+
+[ "$(id -u)" -eq 0 ] || fail "需要root权限"
+command -v ip > /dev/null || fail "需要iproute2"
+
+# 编译服务端和探测驱动（服务端目录下的所有.c共同组成服务端）
+echo "编译服务端和探测驱动..."
+gcc -O2 -o "$WORK/server" "$ROOT_DIR"/Server/*.c -lpthread || fail "服务端编译失败"
+gcc -O2 -o "$WORK/probe_driver" "$ROOT_DIR/Tools/probe_driver.c" \
+    "$ROOT_DIR/Client/libs/public_address_detector.c" -I"$ROOT_DIR/Client/libs" -lpthread \
+    || fail "探测驱动编译失败"
+
+in_ns() {
+    local ns=$1
+    shift
+    ip netns exec "$ns" "$@"
+}
+
+# 新建命名空间并启用环回
+new_ns() {
+    ip netns add "$1"
+    in_ns "$1" ip link set lo up
+}
+
+# 把命名空间ns通过veth接入服务端网桥，ns内的接口名为ifname
+attach_to_internet() {
+    local ns=$1 ifname=$2 peer=$3
+    ip link add "$ifname" netns "$ns" type veth peer name "$peer" netns "$SRV_NS"
+    in_ns "$SRV_NS" ip link set "$peer" master br0 up
+    in_ns "$ns" ip link set "$ifname" up
+}
+
+setup_internet() {
+    new_ns "$SRV_NS"
+    in_ns "$SRV_NS" ip link add br0 type bridge
+    in_ns "$SRV_NS" ip link set br0 up
+    in_ns "$SRV_NS" ip addr add "$SRV_V4/24" dev br0
+    in_ns "$SRV_NS" ip addr add "$SRV_V6/64" dev br0 nodad
+}
+
+setup_public() {
+    local ns=$PREFIX-public
+    new_ns "$ns"
+    attach_to_internet "$ns" eth0 pub-br
+    in_ns "$ns" ip addr add 198.51.100.10/24 dev eth0
+}
+
+setup_nat() {
+    local rtr=$PREFIX-rtr ns=$PREFIX-nat
+    new_ns "$rtr"
+    new_ns "$ns"
+    attach_to_internet "$rtr" wan0 rtr-br
+    in_ns "$rtr" ip addr add 198.51.100.20/24 dev wan0
+
+    ip link add lan0 netns "$rtr" type veth peer name eth0 netns "$ns"
+    in_ns "$rtr" ip addr add 10.0.0.1/24 dev lan0
+    in_ns "$rtr" ip link set lan0 up
+    in_ns "$rtr" sysctl -qw net.ipv4.ip_forward=1
+    in_ns "$rtr" nft -f - << 'EOF'
+table ip nat {
+    chain postrouting {
+        type nat hook postrouting priority srcnat;
+        oifname "wan0" masquerade
+    }
+}
+EOF
+
+    in_ns "$ns" ip addr add 10.0.0.2/24 dev eth0
+    in_ns "$ns" ip link set eth0 up
+    in_ns "$ns" ip route add default via 10.0.0.1
+}
+
+setup_firewall() {
+    local ns=$PREFIX-firewall
+    new_ns "$ns"
+    attach_to_internet "$ns" eth0 fw-br
+    in_ns "$ns" ip addr add 198.51.100.30/24 dev eth0
+    in_ns "$ns" nft -f - << 'EOF'
+table inet filter {
+    chain input {
+        type filter hook input priority filter; policy drop;
+        iifname "lo" accept
+        ct state established,related accept
+    }
+}
+EOF
+}
+
+setup_ipv6only() {
+    local ns=$PREFIX-ipv6only
+    new_ns "$ns"
+    attach_to_internet "$ns" eth0 v6-br
+    in_ns "$ns" ip addr add 2001:db8:100::40/64 dev eth0 nodad
+}
+
+# 在命名空间中运行探测驱动并输出一行结果
+# 参数: 拓扑名 命名空间 客户端地址 服务端地址 期望(1可达/0不可达)
+run_case() {
+    local name=$1 ns=$2 client_ip=$3 server_ip=$4 expect=$5
+    local out summary success runs p50 max verdict wrong
+
+    out=$(in_ns "$ns" "$WORK/probe_driver" "$client_ip" "$server_ip" "$PORT" "$TIMEOUT" "$RUNS" 2> /dev/null)
+    summary=$(echo "$out" | grep '^SUMMARY')
+    if [ -z "$summary" ]; then
+        printf "%-10s %-8s %s\n" "$name" "-" "探测驱动运行失败"
+        FAILED=1
+        return
+    fi
+
+    runs=$(echo "$summary" | sed 's/.*runs=\([0-9]*\).*/\1/')
+    success=$(echo "$summary" | sed 's/.*success=\([0-9]*\).*/\1/')
+    p50=$(echo "$summary" | sed 's/.*p50_ms=\([0-9.]*\).*/\1/')
+    max=$(echo "$summary" | sed 's/.*max_ms=\([0-9.]*\).*/\1/')
+
+    # 期望可达时失败次数为漏报，期望不可达时成功次数为误报
+    if [ "$expect" -eq 1 ]; then
+        wrong=$((runs - success))
+    else
+        wrong=$success
+    fi
+    verdict=PASS
+    [ "$wrong" -ne 0 ] && verdict=FAIL && FAILED=1
+
+    printf "%-10s %-8s %4s/%-4s %8s %10s %10s  %s\n" \
+        "$name" "$([ "$expect" -eq 1 ] && echo reach || echo block)" \
+        "$success" "$runs" "$wrong" "$p50" "$max" "$verdict"
+}
+
+echo "搭建网络拓扑..."
+setup_internet
+setup_public
+setup_ipv6only
+if [ "$HAVE_NFT" -eq 1 ]; then
+    setup_nat
+    setup_firewall
+else
+    echo "未找到nft，跳过nat和firewall拓扑"
+fi
+
+in_ns "$SRV_NS" "$WORK/server" $SERVER_ARGS > "$WORK/server.log" 2>&1 &
+SERVER_PID=$!
+sleep 0.5
+kill -0 "$SERVER_PID" 2> /dev/null || fail "服务端启动失败: $(cat "$WORK/server.log")"
+
+FAILED=0
+echo
+printf "%-10s %-8s %9s %8s %10s %10s  %s\n" "topology" "expect" "ok/runs" "wrong" "p50_ms" "max_ms" "result"
+run_case public "$PREFIX-public" 198.51.100.10 "$SRV_V4" 1
+run_case ipv6only "$PREFIX-ipv6only" 2001:db8:100::40 "$SRV_V6" 1
+if [ "$HAVE_NFT" -eq 1 ]; then
+    run_case nat "$PREFIX-nat" 10.0.0.2 "$SRV_V4" 0
+    run_case firewall "$PREFIX-firewall" 198.51.100.30 "$SRV_V4" 0
+fi
+
+exit $FAILED
@@ -0,0 +1,67 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "public_address_detector.h"
+
+// 探测驱动：对同一地址重复执行detect_public_address，输出每次耗时和汇总
+// 供netns_e2e.sh在各拓扑中调用，也可单独用于对比探测路径的延迟
+//
+// 用法: probe_driver <客户端IP> <服务端IP> [端口] [超时秒] [次数]
+// 汇总行格式: SUMMARY runs=N success=K p50_ms=X p99_ms=Y max_ms=Z
+
+#define MAX_RUNS 1000
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s <client-ip> <server-ip> [port] [timeout] [runs]\n", argv[0]);
+        return 2;
+    }
+
+    const char *client_ip = argv[1];
+    const char *server_ip = argv[2];
+    int port = argc > 3 ? atoi(argv[3]) : 8066;
+    int timeout = argc > 4 ? atoi(argv[4]) : 3;
+    int runs = argc > 5 ? atoi(argv[5]) : 5;
+    if (runs < 1 || runs > MAX_RUNS) {
+        runs = 5;
+    }
+
+    static double latencies[MAX_RUNS];
+    int success = 0;
+
+    if (detector_init() != 0) {
+        fprintf(stderr, "detector_init failed\n");
+        return 2;
+    }
+
+    for (int i = 0; i < runs; i++) {
+        double start = now_ms();
+        DetectionResult result = detect_public_address(client_ip, server_ip, port, timeout);
+        latencies[i] = now_ms() - start;
+        success += result.success;
+        printf("RUN %d success=%d ms=%.2f\n", i + 1, result.success, latencies[i]);
+        fflush(stdout);
+    }
+
+    detector_cleanup();
+
+    qsort(latencies, runs, sizeof(double), compare_double);
+    printf("SUMMARY runs=%d success=%d p50_ms=%.2f p99_ms=%.2f max_ms=%.2f\n",
+           runs, success, latencies[(runs - 1) / 2], latencies[(runs * 99 - 1) / 100], latencies[runs - 1]);
+    return 0;
+}
+
+// gcc -o probe_driver probe_driver.c ../Client/libs/public_address_detector.c -I../Client/libs -lpthread